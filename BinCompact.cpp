@@ -0,0 +1,587 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file compacts raw .bin images. See BinCompact.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "BinCompact.hpp"
+#include "CDSector.hpp"
+#include "CddaCodec.hpp"
+#include "CueHandler.hpp"
+#include "SparseWriter.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/*** Helper Functions *********************************************************/
+namespace {
+const char compactMagic[4] = {'C', 'U', 'E', 'C'};
+const uint16_t compactVersion = 2;
+const size_t HEADER_BYTES = 32;
+
+//Payload bytes of each t_COMPACT type. AUDIO payloads start with their length
+const size_t compactPayload[] = { 2352, 0, 2048, 2052, 2328, 2328, 2 };
+
+void writeLE(uint8_t *dest, uint64_t val, const size_t bytes) {
+	for(size_t cByte = 0; cByte < bytes; cByte++) {
+		dest[cByte] = (uint8_t)val;
+		val >>= 8;
+	}
+}
+
+uint64_t readLE(const uint8_t *src, const size_t bytes) {
+	uint64_t val = 0;
+	for(size_t cByte = bytes; cByte > 0; cByte--) {
+		val = (val << 8) | src[cByte - 1];
+	}
+	return val;
+}
+
+uint8_t toBCD(const uint32_t val) {
+	return (uint8_t)(((val / 10) << 4) | (val % 10));
+}
+
+//Convert the BCD MM:SS:FF header address into a sector number
+uint32_t headerAddress(const uint8_t *header) {
+	uint32_t minutes = (header[0] >> 4) * 10 + (header[0] & 0x0F);
+	uint32_t seconds = (header[1] >> 4) * 10 + (header[1] & 0x0F);
+	uint32_t frames = (header[2] >> 4) * 10 + (header[2] & 0x0F);
+	return (minutes * 60 + seconds) * 75 + frames;
+}
+
+//Write the sync and header of a sector for the address and mode passed
+void buildHeader(uint8_t *sector, const uint32_t address, const uint8_t mode) {
+	memcpy(sector, sectorSyncPattern, SECTOR_SYNC);
+	sector[SECTOR_HEADER + 0] = toBCD(address / 4500);
+	sector[SECTOR_HEADER + 1] = toBCD((address / 75) % 60);
+	sector[SECTOR_HEADER + 2] = toBCD(address % 75);
+	sector[SECTOR_HEADER + 3] = mode;
+}
+
+//Rebuild a full 2352 byte sector from its type and payload
+void rebuildSector(const t_COMPACT type, const uint8_t *payload,
+                   const uint32_t address, uint8_t *out) {
+	switch(type) {
+		case t_COMPACT::ZERO:
+			memset(out, 0, SECTOR_RAW);
+			break;
+		
+		case t_COMPACT::MODE1:
+			buildHeader(out, address, 1);
+			memcpy(out + SECTOR_DATA_M1, payload, 2048);
+			writeLE(out + 2064, sectorEDC(0, out, 2064), 4);
+			memset(out + 2068, 0, 8);
+			sectorECCGenerate(out, false);
+			break;
+		
+		case t_COMPACT::MODE2_FORM1:
+			buildHeader(out, address, 2);
+			memcpy(out + SECTOR_SUBHEADER, payload, 4);
+			memcpy(out + SECTOR_SUBHEADER + 4, payload, 4);
+			memcpy(out + SECTOR_DATA_M2, payload + 4, 2048);
+			writeLE(out + 2072, sectorEDC(0, out + SECTOR_SUBHEADER, 2056), 4);
+			sectorECCGenerate(out, true);
+			break;
+		
+		case t_COMPACT::MODE2_FORM2:
+		case t_COMPACT::MODE2_FORM2_NOEDC:
+			buildHeader(out, address, 2);
+			memcpy(out + SECTOR_SUBHEADER, payload, 4);
+			memcpy(out + SECTOR_SUBHEADER + 4, payload, 4);
+			memcpy(out + SECTOR_DATA_M2, payload + 4, 2324);
+			
+			if(type == t_COMPACT::MODE2_FORM2) {
+				uint32_t edc = sectorEDC(0, out + SECTOR_SUBHEADER, 2332);
+				writeLE(out + 2348, edc, 4);
+			} else {
+				memset(out + 2348, 0, 4);
+			}
+			break;
+		
+		default:
+			memcpy(out, payload, SECTOR_RAW);
+			break;
+	}
+}
+
+//Returns true if every byte of the sector is zero
+bool sectorIsZero(const uint8_t *sector) {
+	return bytesAreZero(sector, SECTOR_RAW);
+}
+
+//Pick the smallest type the sector can be stored as, and write its payload.
+//The sector is rebuilt from the payload and compared to guarantee a round trip.
+//-prev- is the sector before it in the block, or nullptr
+t_COMPACT encodeSector(const uint8_t *sector, const bool isData,
+                       const bool isAudio, const uint8_t *prev,
+                       const uint32_t address, uint8_t *payload,
+                       size_t &payloadLen) {
+	payloadLen = 0;
+	if(sectorIsZero(sector)) return t_COMPACT::ZERO;
+	
+	//AUDIO sectors are coded losslessly if that is smaller than raw
+	if(isAudio) {
+		uint8_t rebuilt[SECTOR_RAW];
+		size_t coded = cddaEncode(sector, prev, payload + 2, SECTOR_RAW - 3);
+		if(coded != 0 && cddaDecode(payload + 2, coded, prev, rebuilt) == 0
+		&& memcmp(rebuilt, sector, SECTOR_RAW) == 0) {
+			writeLE(payload, coded, 2);
+			payloadLen = 2 + coded;
+			return t_COMPACT::AUDIO;
+		}
+	}
+	
+	t_COMPACT type = t_COMPACT::RAW;
+	if(isData && sectorHasSync(sector)
+	&& headerAddress(sector + SECTOR_HEADER) == address) {
+		uint8_t mode = sector[SECTOR_HEADER + 3];
+		const uint8_t *sub = sector + SECTOR_SUBHEADER;
+		
+		if(mode == 1) {
+			type = t_COMPACT::MODE1;
+			memcpy(payload, sector + SECTOR_DATA_M1, 2048);
+		}
+		
+		//XA subheaders are stored twice, only one copy is kept
+		if(mode == 2 && memcmp(sub, sub + 4, 4) == 0) {
+			memcpy(payload, sub, 4);
+			
+			if(sub[2] & 0x20) {
+				type = t_COMPACT::MODE2_FORM2;
+				if(readLE(sector + 2348, 4) == 0) {
+					type = t_COMPACT::MODE2_FORM2_NOEDC;
+				}
+				memcpy(payload + 4, sector + SECTOR_DATA_M2, 2324);
+			} else {
+				type = t_COMPACT::MODE2_FORM1;
+				memcpy(payload + 4, sector + SECTOR_DATA_M2, 2048);
+			}
+		}
+	}
+	
+	//Make sure the sector rebuilds bit-exactly, otherwise store it raw
+	if(type != t_COMPACT::RAW) {
+		uint8_t rebuilt[SECTOR_RAW];
+		rebuildSector(type, payload, address, rebuilt);
+		if(memcmp(rebuilt, sector, SECTOR_RAW) == 0) {
+			payloadLen = compactPayload[(int)type];
+			return type;
+		}
+	}
+	
+	memcpy(payload, sector, SECTOR_RAW);
+	payloadLen = SECTOR_RAW;
+	return t_COMPACT::RAW;
+}
+
+unsigned int pickThreads(unsigned int threads, const size_t jobs) {
+	if(threads == 0) threads = std::thread::hardware_concurrency();
+	if(threads == 0) threads = 1;
+	if(threads > jobs) threads = (unsigned int)jobs;
+	if(threads == 0) threads = 1;
+	return threads;
+}
+} //namespace
+
+/*** BinCompactor Functions ***************************************************/
+BinCompactor::BinCompactor(CueHandler &cue) : m_cue(cue) { }
+
+int BinCompactor::encode(const size_t fileIndex, const std::string outPath) {
+	m_report = CompactReport();
+	
+	if(fileIndex >= m_cue.FILE.size()) {
+		std::cerr << "Error: BinCompactor: FILE does not exist." << std::endl;
+		return 1;
+	}
+	
+	//Collect the TRACKs of this FILE
+	std::string binPath = m_cue.cueFile->parentDir()
+	                    + m_cue.FILE[fileIndex].FILENAME;
+	std::vector <TrackSpan> spans;
+	std::vector <TrackSpan> allSpans = m_cue.getTrackSpans();
+	for(size_t cSpan = 0; cSpan < allSpans.size(); cSpan++) {
+		if(allSpans[cSpan].PATH != binPath) continue;
+		
+		//Only raw 2352 byte sector images can be compacted
+		if(m_cue.TRACKSectorSize(allSpans[cSpan].TYPE) != SECTOR_RAW) {
+			std::cerr << "Error: BinCompactor: " << binPath
+			          << ": TRACK is not 2352 bytes per sector." << std::endl;
+			return 1;
+		}
+		spans.push_back(allSpans[cSpan]);
+	}
+	
+	std::ifstream binFile(binPath, std::ios::in | std::ios::binary
+	                      | std::ios::ate);
+	if(binFile.is_open() == false) {
+		std::cerr << "Error: BinCompactor: Could not open " << binPath << '.'
+		          << std::endl;
+		return 1;
+	}
+	
+	unsigned long long binBytes = (unsigned long long)binFile.tellg();
+	unsigned long long sectors = binBytes / SECTOR_RAW;
+	uint32_t tailBytes = (uint32_t)(binBytes % SECTOR_RAW);
+	size_t blocks = (size_t)((sectors + m_blockSectors - 1) / m_blockSectors);
+	
+	//Which sectors are in data TRACKs and AUDIO TRACKs, per sector
+	std::vector <bool> isData(sectors, false);
+	std::vector <bool> isAudio(sectors, false);
+	for(size_t cSpan = 0; cSpan < spans.size(); cSpan++) {
+		t_TRACK type = spans[cSpan].TYPE;
+		bool data = (type == t_TRACK::MODE1_2352 || type == t_TRACK::MODE2_2352
+		          || type == t_TRACK::CDI_2352);
+		bool audio = (type == t_TRACK::AUDIO);
+		if(data == false && audio == false) continue;
+		
+		for(unsigned long long sect = spans[cSpan].START / SECTOR_RAW;
+		    sect < spans[cSpan].END / SECTOR_RAW && sect < sectors; sect++) {
+			if(data) isData[sect] = true;
+			if(audio) isAudio[sect] = true;
+		}
+	}
+	
+	//The address base comes from the first data sector with a sync pattern
+	uint32_t addrBase = 150;
+	for(unsigned long long sect = 0; sect < sectors; sect++) {
+		if(isData[sect] == false) continue;
+		
+		uint8_t sector[SECTOR_RAW];
+		binFile.seekg((std::streamoff)(sect * SECTOR_RAW));
+		binFile.read((char *)sector, SECTOR_RAW);
+		if(sectorHasSync(sector)) {
+			addrBase = headerAddress(sector + SECTOR_HEADER) - (uint32_t)sect;
+		}
+		break;
+	}
+	
+	std::ofstream outFile(outPath, std::ios::out | std::ios::trunc
+	                      | std::ios::binary);
+	if(outFile.is_open() == false) {
+		std::cerr << "Error: BinCompactor: Could not create " << outPath << '.'
+		          << std::endl;
+		return 1;
+	}
+	
+	//Header, then a placeholder block index filled in once blocks are written
+	uint8_t header[HEADER_BYTES] = {0};
+	memcpy(header, compactMagic, 4);
+	writeLE(header + 4, compactVersion, 2);
+	writeLE(header + 6, m_blockSectors, 2);
+	writeLE(header + 8, sectors, 8);
+	writeLE(header + 16, addrBase, 4);
+	writeLE(header + 20, tailBytes, 4);
+	writeLE(header + 24, blocks, 4);
+	outFile.write((const char *)header, HEADER_BYTES);
+	
+	std::vector <uint8_t> index((blocks + 1) * 8, 0);
+	outFile.write((const char *)index.data(), (std::streamsize)index.size());
+	uint64_t offset = HEADER_BYTES + index.size();
+	
+	//Blocks are encoded in waves across the threads, then written in order
+	unsigned int threadCount = pickThreads(m_threads, blocks);
+	size_t waveBlocks = threadCount * 4;
+	std::vector <std::vector <uint8_t> > encoded(waveBlocks);
+	std::vector <CompactReport> threadReport(threadCount);
+	
+	for(size_t waveStart = 0; waveStart < blocks; waveStart += waveBlocks) {
+		size_t waveEnd = waveStart + waveBlocks;
+		if(waveEnd > blocks) waveEnd = blocks;
+		
+		std::atomic <size_t> nextBlock(waveStart);
+		auto worker = [&](CompactReport &local) {
+			std::ifstream in(binPath, std::ios::in | std::ios::binary);
+			std::vector <uint8_t> raw(m_blockSectors * SECTOR_RAW);
+			uint8_t payload[SECTOR_RAW];
+			
+			size_t block;
+			while((block = nextBlock.fetch_add(1)) < waveEnd) {
+				unsigned long long first = block;
+				first *= m_blockSectors;
+				size_t count = m_blockSectors;
+				if(sectors - first < count) count = (size_t)(sectors - first);
+				
+				in.seekg((std::streamoff)(first * SECTOR_RAW));
+				in.read((char *)raw.data(),
+				        (std::streamsize)(count * SECTOR_RAW));
+				
+				std::vector <uint8_t> &out = encoded[block - waveStart];
+				out.clear();
+				for(size_t cSect = 0; cSect < count; cSect++) {
+					unsigned long long sect = first + cSect;
+					const uint8_t *sector = raw.data() + cSect * SECTOR_RAW;
+					const uint8_t *prev = (cSect == 0) ? nullptr
+					                    : sector - SECTOR_RAW;
+					
+					size_t payloadLen;
+					t_COMPACT type = encodeSector(sector, isData[sect],
+					                   isAudio[sect], prev,
+					                   (uint32_t)sect + addrBase, payload,
+					                   payloadLen);
+					
+					out.push_back((uint8_t)type);
+					out.insert(out.end(), payload, payload + payloadLen);
+					++local.sectorCount[(int)type];
+				}
+			}
+		};
+		
+		std::vector <std::thread> threads;
+		for(unsigned int cThread = 0; cThread < threadCount; cThread++) {
+			threads.push_back(std::thread(worker,
+			                              std::ref(threadReport[cThread])));
+		}
+		for(size_t cThread = 0; cThread < threads.size(); cThread++) {
+			threads[cThread].join();
+		}
+		
+		for(size_t block = waveStart; block < waveEnd; block++) {
+			const std::vector <uint8_t> &out = encoded[block - waveStart];
+			writeLE(index.data() + block * 8, offset, 8);
+			outFile.write((const char *)out.data(),
+			              (std::streamsize)out.size());
+			offset += out.size();
+		}
+	}
+	writeLE(index.data() + blocks * 8, offset, 8);
+	
+	//The tail is whatever is left after the last whole sector
+	std::vector <uint8_t> tail(tailBytes);
+	binFile.clear();
+	binFile.seekg((std::streamoff)(sectors * SECTOR_RAW));
+	binFile.read((char *)tail.data(), tailBytes);
+	outFile.write((const char *)tail.data(), tailBytes);
+	offset += tailBytes;
+	
+	//Go back and fill in the block index
+	outFile.seekp(HEADER_BYTES);
+	outFile.write((const char *)index.data(), (std::streamsize)index.size());
+	outFile.close();
+	
+	if(outFile.fail()) {
+		std::cerr << "Error: BinCompactor: Failed writing " << outPath << '.'
+		          << std::endl;
+		return 1;
+	}
+	
+	for(size_t cThread = 0; cThread < threadReport.size(); cThread++) {
+		for(int type = 0; type < (int)t_COMPACT::MAX_TYPES; type++) {
+			const CompactReport &local = threadReport[cThread];
+			m_report.sectorCount[type] += local.sectorCount[type];
+		}
+	}
+	m_report.sectors = sectors;
+	m_report.inBytes = binBytes;
+	m_report.outBytes = offset;
+	
+	return 0;
+}
+
+/*** CompactImage Functions ***************************************************/
+int CompactImage::open(const std::string path) {
+	m_path = path;
+	m_sectors = 0;
+	m_blockOffsets.clear();
+	m_file.close();
+	m_file.clear();
+	m_file.open(path, std::ios::in | std::ios::binary | std::ios::ate);
+	
+	//Every size in the header is checked against the file before use
+	unsigned long long fileBytes = (unsigned long long)m_file.tellg();
+	m_file.seekg(0);
+	
+	uint8_t header[HEADER_BYTES];
+	m_file.read((char *)header, HEADER_BYTES);
+	if(m_file.gcount() != (std::streamsize)HEADER_BYTES
+	|| memcmp(header, compactMagic, 4) != 0
+	|| readLE(header + 4, 2) == 0 || readLE(header + 4, 2) > compactVersion) {
+		std::cerr << "Error: CompactImage: " << path
+		          << ": Not a compact image." << std::endl;
+		return 1;
+	}
+	
+	m_blockSectors = (uint16_t)readLE(header + 6, 2);
+	unsigned long long sectors = readLE(header + 8, 8);
+	m_addrBase = (uint32_t)readLE(header + 16, 4);
+	m_tailBytes = (uint32_t)readLE(header + 20, 4);
+	size_t blocks = (size_t)readLE(header + 24, 4);
+	
+	//Every sector is in a block, and the index has to fit in the file
+	if(m_blockSectors == 0
+	|| blocks != (sectors + m_blockSectors - 1) / m_blockSectors
+	|| ((unsigned long long)blocks + 1) * 8 > fileBytes - HEADER_BYTES) {
+		std::cerr << "Error: CompactImage: " << path
+		          << ": Header is corrupt." << std::endl;
+		return 1;
+	}
+	
+	std::vector <uint8_t> index((blocks + 1) * 8);
+	m_file.read((char *)index.data(), (std::streamsize)index.size());
+	if(m_file.gcount() != (std::streamsize)index.size()) {
+		std::cerr << "Error: CompactImage: " << path
+		          << ": Block index is truncated." << std::endl;
+		return 1;
+	}
+	
+	//Blocks follow the index in order, and the tail follows the blocks
+	std::vector <uint64_t> offsets(blocks + 1);
+	uint64_t prev = HEADER_BYTES + index.size();
+	for(size_t block = 0; block <= blocks; block++) {
+		offsets[block] = readLE(index.data() + block * 8, 8);
+		
+		bool increasing = (block == 0) ? offsets[block] == prev
+		                               : offsets[block] > prev;
+		if(increasing == false || offsets[block] > fileBytes) {
+			std::cerr << "Error: CompactImage: " << path
+			          << ": Block index is corrupt." << std::endl;
+			return 1;
+		}
+		prev = offsets[block];
+	}
+	
+	if(offsets[blocks] + m_tailBytes > fileBytes) {
+		std::cerr << "Error: CompactImage: " << path
+		          << ": Tail is truncated." << std::endl;
+		return 1;
+	}
+	
+	m_blockOffsets.swap(offsets);
+	m_sectors = sectors;
+	return 0;
+}
+
+int CompactImage::decodeBlock(const size_t block, const uint8_t *src,
+                              const size_t len, uint8_t *out) {
+	unsigned long long first = (unsigned long long)block * m_blockSectors;
+	size_t pos = 0;
+	
+	for(unsigned long long sect = first; sect < first + m_blockSectors
+	    && sect < m_sectors; sect++) {
+		if(pos >= len || src[pos] >= (uint8_t)t_COMPACT::MAX_TYPES) return 1;
+		
+		t_COMPACT type = (t_COMPACT)src[pos];
+		size_t payload = compactPayload[(int)type];
+		if(pos + 1 + payload > len) return 1;
+		
+		//AUDIO sectors are predicted from the sector before them
+		if(type == t_COMPACT::AUDIO) {
+			size_t coded = (size_t)readLE(src + pos + 1, 2);
+			payload += coded;
+			if(pos + 1 + payload > len) return 1;
+			
+			const uint8_t *prev = (sect == first) ? nullptr : out - SECTOR_RAW;
+			if(cddaDecode(src + pos + 3, coded, prev, out) != 0) return 1;
+		} else {
+			rebuildSector(type, src + pos + 1, (uint32_t)sect + m_addrBase, out);
+		}
+		out += SECTOR_RAW;
+		pos += 1 + payload;
+	}
+	
+	return 0;
+}
+
+int CompactImage::readSector(const unsigned long long sector, uint8_t *out) {
+	if(sector >= m_sectors) return 1;
+	
+	//Read the whole block holding the sector
+	size_t block = (size_t)(sector / m_blockSectors);
+	size_t srcBytes = m_blockOffsets[block + 1] - m_blockOffsets[block];
+	std::vector <uint8_t> src(srcBytes);
+	m_file.clear();
+	m_file.seekg((std::streamoff)m_blockOffsets[block]);
+	m_file.read((char *)src.data(), (std::streamsize)src.size());
+	
+	std::vector <uint8_t> raw((size_t)m_blockSectors * SECTOR_RAW);
+	if(decodeBlock(block, src.data(), src.size(), raw.data()) != 0) return 1;
+	
+	size_t inBlock = (size_t)(sector % m_blockSectors);
+	memcpy(out, raw.data() + inBlock * SECTOR_RAW, SECTOR_RAW);
+	return 0;
+}
+
+int CompactImage::decodeTo(const std::string outPath, unsigned int threads) {
+	if(m_blockOffsets.empty()) return 1;
+	
+	//Pregaps and silence decode to zero sectors, which are left as holes
+	SparseWriter outFile;
+	if(outFile.open(outPath) != 0) {
+		std::cerr << "Error: CompactImage: Could not create " << outPath << '.'
+		          << std::endl;
+		return 1;
+	}
+	
+	size_t blocks = m_blockOffsets.size() - 1;
+	unsigned int threadCount = pickThreads(threads, blocks);
+	size_t waveBlocks = threadCount * 4;
+	std::vector <std::vector <uint8_t> > decoded(waveBlocks);
+	std::atomic <bool> failed(false);
+	
+	//Blocks are decoded in waves across the threads, then written in order
+	for(size_t waveStart = 0; waveStart < blocks; waveStart += waveBlocks) {
+		size_t waveEnd = waveStart + waveBlocks;
+		if(waveEnd > blocks) waveEnd = blocks;
+		
+		std::atomic <size_t> nextBlock(waveStart);
+		auto worker = [&]() {
+			std::ifstream in(m_path, std::ios::in | std::ios::binary);
+			std::vector <uint8_t> src;
+			
+			size_t block;
+			while((block = nextBlock.fetch_add(1)) < waveEnd) {
+				src.resize(m_blockOffsets[block + 1] - m_blockOffsets[block]);
+				in.seekg((std::streamoff)m_blockOffsets[block]);
+				in.read((char *)src.data(), (std::streamsize)src.size());
+				
+				unsigned long long first = block;
+				first *= m_blockSectors;
+				size_t count = m_blockSectors;
+				if(m_sectors - first < count) {
+					count = (size_t)(m_sectors - first);
+				}
+				
+				std::vector <uint8_t> &out = decoded[block - waveStart];
+				out.resize(count * SECTOR_RAW);
+				int status = decodeBlock(block, src.data(), src.size(),
+				                         out.data());
+				if(status != 0) failed = true;
+			}
+		};
+		
+		std::vector <std::thread> workers;
+		for(unsigned int cThread = 0; cThread < threadCount; cThread++) {
+			workers.push_back(std::thread(worker));
+		}
+		for(size_t cThread = 0; cThread < workers.size(); cThread++) {
+			workers[cThread].join();
+		}
+		
+		for(size_t block = waveStart; block < waveEnd; block++) {
+			const std::vector <uint8_t> &out = decoded[block - waveStart];
+			outFile.write(out.data(), out.size());
+		}
+	}
+	
+	//Copy the raw tail bytes
+	std::vector <uint8_t> tail(m_tailBytes);
+	m_file.clear();
+	m_file.seekg((std::streamoff)m_blockOffsets.back());
+	m_file.read((char *)tail.data(), m_tailBytes);
+	outFile.write(tail.data(), m_tailBytes);
+	
+	if(outFile.close() != 0 || failed) {
+		std::cerr << "Error: CompactImage: Failed decoding " << m_path << '.'
+		          << std::endl;
+		return 1;
+	}
+	
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file compacts raw .bin images by dropping every field of a sector that
+* can be regenerated from its user data (sync, header, EDC, ECC), and rebuilds
+* them bit-exactly on decode. The TRACK types from the .cue decide which
+* sectors are tried as data sectors. Sectors of AUDIO TRACKs are coded
+* losslessly with CddaCodec. Every sector is rebuilt and compared while
+* encoding, anything that would not round trip is stored as-is.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef BIN_COMPACT_H
+#define BIN_COMPACT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "CueHandler.hpp"
+
+/*** Compact file format ******************************************************/
+/*	All values are little endian.
+	Header (32 bytes)
+		0	"CUEC" magic
+		4	u16 version (2. Version 1 files have no AUDIO sectors)
+		6	u16 sectors per block
+		8	u64 number of 2352 byte sectors
+		16	u32 address base. Sector n has the header address n + base
+		20	u32 tail bytes. Bytes after the last whole sector, stored raw
+		24	u32 number of blocks
+		28	u32 reserved (0)
+	Block Index
+		(blocks + 1) u64 file offsets. Block n is from offset[n] to offset[n+1]
+	Blocks
+		Each sector is a t_COMPACT type byte followed by its payload. AUDIO
+		sectors are predicted from the sector before them in the block, so
+		a block is always decoded from its first sector
+	Tail
+		The tail bytes, raw                                                   */
+
+//Stored form of a sector. Payload sizes in brackets
+enum class t_COMPACT : uint8_t {
+	RAW, //Stored as-is (2352)
+	ZERO, //All zero bytes (0)
+	MODE1, //Mode 1 user data (2048)
+	MODE2_FORM1, //XA subheader and user data (4 + 2048)
+	MODE2_FORM2, //XA subheader and user data, EDC regenerated (4 + 2324)
+	MODE2_FORM2_NOEDC, //XA Form 2 with an unused (zero) EDC (4 + 2324)
+	AUDIO, //CDDA coded by cddaEncode (u16 length + coded bytes)
+	MAX_TYPES
+};
+
+//Totals from an encode or decode
+struct CompactReport {
+	unsigned long long sectors = 0; //Sectors processed
+	unsigned long long sectorCount[(int)t_COMPACT::MAX_TYPES] = {}; //Per type
+	unsigned long long inBytes = 0;
+	unsigned long long outBytes = 0;
+};
+
+/*** Encoder ******************************************************************/
+class BinCompactor {
+	public:
+	//Takes a CueHandler with its cue data already loaded (getCueData)
+	BinCompactor(CueHandler &cue);
+	
+	/** Configuration Functions ***********************************************/
+	//Number of worker threads. 0 uses the number of hardware threads
+	void setThreads(const unsigned int threads) { this->m_threads = threads; }
+	
+	//Sectors per block. A block is the smallest unit that can be decoded
+	void setBlockSectors(const uint16_t sectors) {
+		this->m_blockSectors = (sectors == 0) ? 1 : sectors;
+	}
+	
+	/** Encoding **************************************************************/
+	//Encode the bin file of FILE[fileIndex] into a compact file at outPath.
+	//Returns 0 on success, 1 on failure
+	int encode(const size_t fileIndex, const std::string outPath);
+	
+	//The totals of the last encode() call
+	const CompactReport &report() const { return m_report; }
+	
+	private:
+	CueHandler &m_cue;
+	unsigned int m_threads = 0;
+	uint16_t m_blockSectors = 256;
+	CompactReport m_report;
+};
+
+/*** Decoder ******************************************************************/
+class CompactImage {
+	public:
+	CompactImage() { }
+	
+	//Open a compact file and load its block index. Returns 0 on success
+	int open(const std::string path);
+	
+	//Number of 2352 byte sectors, and total size of the original bin
+	unsigned long long sectors() const { return m_sectors; }
+	unsigned long long bytes() const { return m_sectors * 2352 + m_tailBytes; }
+	
+	//Decode a single sector into -out- (2352 bytes). Only the block holding
+	//the sector is read. Returns 0 on success
+	int readSector(const unsigned long long sector, uint8_t *out);
+	
+	//Decode the whole image back into a bin file, blocks are decoded across
+	//-threads- threads (0 for the number of hardware threads). Zero sectors
+	//are left as holes in the bin file (see SparseWriter)
+	int decodeTo(const std::string outPath, unsigned int threads = 0);
+	
+	private:
+	std::string m_path;
+	std::ifstream m_file;
+	uint16_t m_blockSectors = 0;
+	unsigned long long m_sectors = 0;
+	uint32_t m_addrBase = 0;
+	uint32_t m_tailBytes = 0;
+	std::vector <uint64_t> m_blockOffsets;
+	
+	//Decode one block of compact data into raw sectors
+	int decodeBlock(const size_t block, const uint8_t *src, const size_t len,
+	                uint8_t *out);
+};
+
+#endif
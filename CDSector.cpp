@@ -0,0 +1,461 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file handles raw CD-ROM sectors. See CDSector.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "CDSector.hpp"
+#include "CueHandler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+const uint8_t sectorSyncPattern[SECTOR_SYNC] = {
+	0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00
+};
+
+/*** Lookup Tables ************************************************************/
+/*******************************************************************************
+The EDC is a reflected CRC32 with the polynomial 0xD8018001. It is computed 4
+bytes at a time (slicing-by-4), table[n] advances the CRC by n+1 bytes.
+
+The ECC is a Reed-Solomon Product Code over GF(2^8), polynomial 0x11D.
+eccF multiplies by alpha, eccB is the inverse of (x ^ eccF[x]).
+*******************************************************************************/
+struct SectorTables {
+	uint32_t edc[4][256];
+	uint8_t eccF[256];
+	uint8_t eccB[256];
+	
+	SectorTables() {
+		for(uint32_t i = 0; i < 256; i++) {
+			//ECC tables
+			uint32_t j = (i << 1) ^ ((i & 0x80) ? 0x11D : 0);
+			eccF[i] = (uint8_t)j;
+			eccB[i ^ j] = (uint8_t)i;
+			
+			//Bytewise EDC table
+			uint32_t edcVal = i;
+			for(int bit = 0; bit < 8; bit++) {
+				edcVal = (edcVal >> 1) ^ ((edcVal & 1) ? 0xD8018001 : 0);
+			}
+			edc[0][i] = edcVal;
+		}
+		
+		//Slicing tables, each one is the previous table advanced a byte
+		for(int slice = 1; slice < 4; slice++) {
+			for(uint32_t i = 0; i < 256; i++) {
+				uint32_t prev = edc[slice - 1][i];
+				edc[slice][i] = (prev >> 8) ^ edc[0][prev & 0xFF];
+			}
+		}
+	}
+};
+
+//Built once on first use (thread safe since C++11)
+static const SectorTables &tables() {
+	static const SectorTables tbl;
+	return tbl;
+}
+
+/*** Sector functions *********************************************************/
+uint32_t sectorEDC(uint32_t edc, const uint8_t *src, size_t len) {
+	const SectorTables &tbl = tables();
+	
+	//4 bytes at a time. Bytes are combined little endian regardless of host
+	while(len >= 4) {
+		edc ^= (uint32_t)src[0] | ((uint32_t)src[1] << 8)
+		     | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+		
+		edc = tbl.edc[3][edc & 0xFF] ^ tbl.edc[2][(edc >> 8) & 0xFF]
+		    ^ tbl.edc[1][(edc >> 16) & 0xFF] ^ tbl.edc[0][edc >> 24];
+		
+		src += 4;
+		len -= 4;
+	}
+	
+	//Any remaining bytes one at a time
+	while(len--) {
+		edc = (edc >> 8) ^ tbl.edc[0][(edc ^ *src++) & 0xFF];
+	}
+	
+	return edc;
+}
+
+//Compute one set of parity (P or Q) over the sector from byte 12
+static void eccComputeBlock(const uint8_t *src, const uint32_t majorCount,
+                            const uint32_t minorCount, const uint32_t majorMult,
+                            const uint32_t minorInc, uint8_t *dest) {
+	const SectorTables &tbl = tables();
+	uint32_t size = majorCount * minorCount;
+	
+	for(uint32_t major = 0; major < majorCount; major++) {
+		uint32_t index = (major >> 1) * majorMult + (major & 1);
+		uint8_t eccA = 0, eccB = 0;
+		
+		for(uint32_t minor = 0; minor < minorCount; minor++) {
+			uint8_t temp = src[index];
+			index += minorInc;
+			if(index >= size) index -= size;
+			
+			eccA ^= temp;
+			eccB ^= temp;
+			eccA = tbl.eccF[eccA];
+		}
+		
+		eccA = tbl.eccB[tbl.eccF[eccA] ^ eccB];
+		dest[major] = eccA;
+		dest[major + majorCount] = eccA ^ eccB;
+	}
+}
+
+//P parity is 86 columns of 24 bytes, Q is 52 diagonals of 43 bytes
+static void eccComputeP(const uint8_t *sector, uint8_t *dest) {
+	eccComputeBlock(sector + SECTOR_HEADER, 86, 24, 2, 86, dest);
+}
+
+static void eccComputeQ(const uint8_t *sector, uint8_t *dest) {
+	eccComputeBlock(sector + SECTOR_HEADER, 52, 43, 86, 88, dest);
+}
+
+void sectorECCGenerate(uint8_t *sector, const bool zeroAddress) {
+	//Mode 2 ECC is computed with a zeroed header, save and restore it
+	uint8_t header[4] = {0};
+	if(zeroAddress) {
+		memcpy(header, sector + SECTOR_HEADER, 4);
+		memset(sector + SECTOR_HEADER, 0, 4);
+	}
+	
+	//Q covers the P parity, so P must be generated first
+	eccComputeP(sector, sector + SECTOR_ECC_P);
+	eccComputeQ(sector, sector + SECTOR_ECC_Q);
+	
+	if(zeroAddress) memcpy(sector + SECTOR_HEADER, header, 4);
+}
+
+bool sectorECCCheck(uint8_t *sector, const bool zeroAddress) {
+	uint8_t header[4] = {0};
+	if(zeroAddress) {
+		memcpy(header, sector + SECTOR_HEADER, 4);
+		memset(sector + SECTOR_HEADER, 0, 4);
+	}
+	
+	//Compute into a scratch buffer and compare with what is stored
+	uint8_t parity[172];
+	eccComputeP(sector, parity);
+	bool good = memcmp(parity, sector + SECTOR_ECC_P, 172) == 0;
+	
+	if(good) {
+		eccComputeQ(sector, parity);
+		good = memcmp(parity, sector + SECTOR_ECC_Q, 104) == 0;
+	}
+	
+	if(zeroAddress) memcpy(sector + SECTOR_HEADER, header, 4);
+	return good;
+}
+
+bool sectorHasSync(const uint8_t *sector) {
+	return memcmp(sector, sectorSyncPattern, SECTOR_SYNC) == 0;
+}
+
+t_TRACK sectorSniffMode(const uint8_t *head, const size_t len,
+                        const unsigned long long fileSize) {
+	//Raw data. The first sector has a sync pattern, the first sector with a
+	//mode of 1 or 2 decides (leading sectors can be empty mode 0 sectors)
+	if(len >= SECTOR_RAW && sectorHasSync(head)) {
+		for(size_t offset = 0; offset + SECTOR_RAW <= len;
+		    offset += SECTOR_RAW) {
+			if(sectorHasSync(head + offset) == false) continue;
+			
+			uint8_t mode = head[offset + SECTOR_HEADER + 3];
+			if(mode == 1) return t_TRACK::MODE1_2352;
+			if(mode == 2) return t_TRACK::MODE2_2352;
+		}
+		
+		return t_TRACK::MODE1_2352;
+	}
+	
+	//Cooked data. Look for the "CD001" volume descriptor ID in sector 16
+	const char *isoID = "CD001";
+	const size_t cookedPVD = 16 * 2048 + 1;
+	const size_t xaPVD = 16 * 2336 + 8 + 1; //After the 8 byte subheader
+	
+	if(len >= cookedPVD + 5 && memcmp(head + cookedPVD, isoID, 5) == 0) {
+		return t_TRACK::MODE1_2048;
+	}
+	if(len >= xaPVD + 5 && memcmp(head + xaPVD, isoID, 5) == 0) {
+		return t_TRACK::MODE2_2336;
+	}
+	
+	//No data signature, fall back on the size
+	if(fileSize % SECTOR_RAW == 0) return t_TRACK::AUDIO;
+	if(fileSize % 2448 == 0) return t_TRACK::CDG;
+	if(fileSize % 2048 == 0) return t_TRACK::MODE1_2048;
+	
+	return t_TRACK::UNKNOWN;
+}
+
+//Read a little endian 32 bit value
+static uint32_t readLE32(const uint8_t *src) {
+	return (uint32_t)src[0] | ((uint32_t)src[1] << 8)
+	     | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+//Write a 32 bit value little endian
+static void writeLE32(uint8_t *dest, const uint32_t val) {
+	dest[0] = (uint8_t)val;
+	dest[1] = (uint8_t)(val >> 8);
+	dest[2] = (uint8_t)(val >> 16);
+	dest[3] = (uint8_t)(val >> 24);
+}
+
+t_SECTOR sectorCheck(uint8_t *sector, const bool repair) {
+	if(sectorHasSync(sector) == false) return t_SECTOR::BAD_SYNC;
+	
+	uint8_t mode = sector[SECTOR_HEADER + 3];
+	
+	//Mode 0 sectors hold only zeros and carry no EDC or ECC
+	if(mode == 0) return t_SECTOR::OK;
+	
+	//Offsets of the data covered by the EDC, and if ECC follows
+	size_t edcStart, edcEnd;
+	bool hasECC = true;
+	
+	if(mode == 1) {
+		//Mode 1 EDC covers the sync, header and data
+		edcStart = 0;
+		edcEnd = 2064;
+	} else {
+		//Mode 2 XA. Form 2 (bit 5 of the submode byte) has no ECC
+		if(sector[SECTOR_SUBHEADER + 2] & 0x20) {
+			edcStart = SECTOR_SUBHEADER;
+			edcEnd = 2348;
+			hasECC = false;
+			
+			//A Form 2 EDC of 0 means the EDC is not used
+			if(readLE32(sector + edcEnd) == 0) return t_SECTOR::OK;
+		} else {
+			edcStart = SECTOR_SUBHEADER;
+			edcEnd = 2072;
+		}
+	}
+	
+	//Check the EDC. If it fails the user data itself is corrupt
+	uint32_t edc = sectorEDC(0, sector + edcStart, edcEnd - edcStart);
+	if(edc != readLE32(sector + edcEnd)) return t_SECTOR::BAD_EDC;
+	
+	if(hasECC == false) return t_SECTOR::OK;
+	
+	//The data is good, so a bad ECC is the parity itself being damaged
+	bool zeroAddress = (mode != 1);
+	if(sectorECCCheck(sector, zeroAddress)) return t_SECTOR::OK;
+	
+	if(repair == false) return t_SECTOR::BAD_ECC;
+	
+	//Mode 1 has 8 reserved zero bytes between EDC and ECC, restore them too
+	if(mode == 1) memset(sector + 2068, 0, 8);
+	writeLE32(sector + edcEnd, edc);
+	sectorECCGenerate(sector, zeroAddress);
+	return t_SECTOR::REPAIRED;
+}
+
+/*** Sector Verifier **********************************************************/
+namespace {
+//A run of sectors of one TRACK, the unit of work handed to a thread
+struct VerifyJob {
+	size_t span; //Index into the span vector
+	unsigned long long firstSector; //First sector number inside the bin file
+	unsigned long long sectors; //Number of sectors in the run
+};
+
+//Sectors per job. Small enough to balance threads, large enough to stream
+const unsigned long long JOB_SECTORS = 8192;
+} //namespace
+
+SectorVerifier::SectorVerifier(CueHandler &cue) : m_cue(cue) { }
+
+VerifyReport SectorVerifier::verify() {
+	std::vector <TrackSpan> spans = m_cue.getTrackSpans();
+	
+	//Data TRACKs that could not be read in full
+	std::vector <char> spanUnread(spans.size(), 0);
+	
+	//Split every data TRACK into jobs
+	std::vector <VerifyJob> jobs;
+	for(size_t cSpan = 0; cSpan < spans.size(); cSpan++) {
+		const TrackSpan &span = spans[cSpan];
+		
+		//Only raw 2352 and 2336 byte data sectors carry EDC/ECC
+		if(span.TYPE != t_TRACK::MODE1_2352 && span.TYPE != t_TRACK::MODE2_2352
+		&& span.TYPE != t_TRACK::CDI_2352 && span.TYPE != t_TRACK::MODE2_2336
+		&& span.TYPE != t_TRACK::CDI_2336) continue;
+		
+		//A missing bin file has no size, so its TRACKs have no sectors to
+		//count. The TRACK itself is counted as unread
+		std::ifstream binFile(span.PATH, std::ios::in | std::ios::binary);
+		if(binFile.is_open() == false) {
+			spanUnread[cSpan] = 1;
+			continue;
+		}
+		
+		unsigned long long sectSize = m_cue.TRACKSectorSize(span.TYPE);
+		unsigned long long first = span.START / sectSize;
+		unsigned long long last = span.END / sectSize;
+		
+		for(unsigned long long sect = first; sect < last; sect += JOB_SECTORS) {
+			VerifyJob job;
+			job.span = cSpan;
+			job.firstSector = sect;
+			job.sectors = std::min(JOB_SECTORS, last - sect);
+			jobs.push_back(job);
+		}
+	}
+	
+	unsigned int threadCount = m_threads;
+	if(threadCount == 0) threadCount = std::thread::hardware_concurrency();
+	if(threadCount == 0) threadCount = 1;
+	if(threadCount > jobs.size()) threadCount = (unsigned int)jobs.size();
+	
+	VerifyReport report;
+	std::mutex reportMutex;
+	std::atomic <size_t> nextJob(0);
+	
+	//Each worker pulls jobs until none are left, then merges its totals
+	auto worker = [&]() {
+		VerifyReport local;
+		std::vector <size_t> localUnread; //Spans with unread sectors
+		std::vector <uint8_t> buffer;
+		uint8_t sector[SECTOR_RAW];
+		
+		std::fstream binFile;
+		std::string openPath;
+		
+		size_t jobIdx;
+		while((jobIdx = nextJob.fetch_add(1)) < jobs.size()) {
+			const VerifyJob &job = jobs[jobIdx];
+			const TrackSpan &span = spans[job.span];
+			size_t sectSize = m_cue.TRACKSectorSize(span.TYPE);
+			
+			//Keep the bin file open between jobs in the same file
+			if(openPath != span.PATH) {
+				binFile.close();
+				binFile.clear();
+				
+				std::ios::openmode mode = std::ios::in | std::ios::binary;
+				if(m_repair) mode |= std::ios::out;
+				binFile.open(span.PATH, mode);
+				openPath = span.PATH;
+			}
+			if(binFile.is_open() == false) {
+				local.unread += job.sectors;
+				localUnread.push_back(job.span);
+				continue;
+			}
+			
+			unsigned long long done = 0;
+			while(done < job.sectors) {
+				size_t count = (size_t)std::min((unsigned long long)m_batch,
+				                                job.sectors - done);
+				unsigned long long firstSector = job.firstSector + done;
+				std::streamoff offset = (std::streamoff)(firstSector * sectSize);
+				
+				buffer.resize(count * sectSize);
+				binFile.seekg(offset);
+				binFile.read((char *)buffer.data(), buffer.size());
+				if((size_t)binFile.gcount() != buffer.size()) {
+					binFile.clear();
+					local.unread += job.sectors - done;
+					localUnread.push_back(job.span);
+					break;
+				}
+				
+				bool dirty = false;
+				for(size_t cSect = 0; cSect < count; cSect++) {
+					uint8_t *src = buffer.data() + cSect * sectSize;
+					
+					//2336 byte sectors are rebuilt into a full raw sector
+					uint8_t *check = src;
+					if(sectSize != SECTOR_RAW) {
+						memcpy(sector, sectorSyncPattern, SECTOR_SYNC);
+						memset(sector + SECTOR_HEADER, 0, 3);
+						sector[SECTOR_HEADER + 3] = 2;
+						memcpy(sector + SECTOR_SUBHEADER, src, sectSize);
+						check = sector;
+					}
+					
+					t_SECTOR result = sectorCheck(check, m_repair);
+					++local.sectors;
+					if(result == t_SECTOR::OK) continue;
+					
+					if(result == t_SECTOR::REPAIRED) {
+						if(check != src) {
+							memcpy(src, check + SECTOR_SUBHEADER, sectSize);
+						}
+						dirty = true;
+						++local.repaired;
+					}
+					if(result == t_SECTOR::BAD_EDC) ++local.badEDC;
+					if(result == t_SECTOR::BAD_ECC) ++local.badECC;
+					if(result == t_SECTOR::BAD_SYNC) ++local.badSync;
+					
+					SectorError err;
+					err.PATH = span.PATH;
+					err.TRACK = span.ID;
+					err.SECTOR = firstSector + cSect;
+					err.ERROR = result;
+					local.errors.push_back(err);
+				}
+				
+				//Write the repaired batch back over the original sectors
+				if(dirty) {
+					binFile.seekp(offset);
+					binFile.write((const char *)buffer.data(), buffer.size());
+					binFile.flush();
+				}
+				
+				done += count;
+			}
+		}
+		
+		std::lock_guard <std::mutex> lock(reportMutex);
+		report.sectors += local.sectors;
+		report.badEDC += local.badEDC;
+		report.badECC += local.badECC;
+		report.badSync += local.badSync;
+		report.repaired += local.repaired;
+		report.unread += local.unread;
+		for(size_t span : localUnread) spanUnread[span] = 1;
+		report.errors.insert(report.errors.end(), local.errors.begin(),
+		                     local.errors.end());
+	};
+	
+	std::vector <std::thread> threads;
+	for(unsigned int cThread = 0; cThread < threadCount; cThread++) {
+		threads.push_back(std::thread(worker));
+	}
+	for(size_t cThread = 0; cThread < threads.size(); cThread++) {
+		threads[cThread].join();
+	}
+	
+	for(size_t cSpan = 0; cSpan < spans.size(); cSpan++) {
+		if(spanUnread[cSpan]) ++report.unreadTracks;
+	}
+	
+	//Threads finish in any order, sort the errors by file then sector
+	std::sort(report.errors.begin(), report.errors.end(),
+	  [](const SectorError &a, const SectorError &b) {
+		if(a.PATH != b.PATH) return a.PATH < b.PATH;
+		return a.SECTOR < b.SECTOR;
+	});
+	
+	return report;
+}
@@ -0,0 +1,145 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file handles raw CD-ROM sectors. It computes and checks the EDC (CRC)
+* and Reed-Solomon ECC carried by MODE1 and MODE2 XA sectors, and verifies
+* every data TRACK referenced by a CueHandler across multiple threads.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef CD_SECTOR_H
+#define CD_SECTOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CueHandler.hpp"
+
+/*** Raw sector layout ********************************************************/
+/*	Offset	MODE1			MODE2 XA Form 1		MODE2 XA Form 2
+	0		Sync (12)		Sync (12)			Sync (12)
+	12		Header (4)		Header (4)			Header (4)
+	16		Data (2048)		Subheader (8)		Subheader (8)
+	24		..				Data (2048)			Data (2324)
+	2064	EDC (4)			..					..
+	2072	Zero (8)		EDC (4)				..
+	2076	ECC P (172)		ECC P (172)			..
+	2248	ECC Q (104)		ECC Q (104)			EDC (4) at 2348
+	2336/2048 byte TRACKs are the same sectors with the first 16 bytes removed,
+	or only the 2048 byte Data field.                                         */
+const size_t SECTOR_RAW = 2352;
+const size_t SECTOR_SYNC = 12;
+const size_t SECTOR_HEADER = 12; //Offset of the header (MM SS FF MODE)
+const size_t SECTOR_SUBHEADER = 16; //Offset of the XA subheader
+const size_t SECTOR_DATA_M1 = 16; //Offset of Mode 1 user data
+const size_t SECTOR_DATA_M2 = 24; //Offset of Mode 2 XA user data
+const size_t SECTOR_ECC_P = 2076; //Offset of the P parity bytes
+const size_t SECTOR_ECC_Q = 2248; //Offset of the Q parity bytes
+
+//12 byte sync pattern at the start of every raw data sector
+extern const uint8_t sectorSyncPattern[SECTOR_SYNC];
+
+//Bytes from the start of a bin file sectorSniffMode() looks at. Enough to
+//reach the ISO9660 volume descriptor (sector 16) of any sector layout
+const size_t SECTOR_SNIFF_BYTES = 17 * SECTOR_RAW;
+
+/*** Enums ********************************************************************/
+//Result of checking one sector
+enum class t_SECTOR {
+	OK, //EDC and ECC (where present) match, or the sector carries neither
+	BAD_EDC, //User data does not match its EDC. Data is corrupt
+	BAD_ECC, //EDC is good but the ECC parity is wrong
+	REPAIRED, //ECC was wrong and has been regenerated from good data
+	BAD_SYNC, //Sector in a data TRACK has no sync pattern
+	MAX_TYPES
+};
+
+/*** Sector functions *********************************************************/
+//Continue an EDC (CD-ROM CRC32) over -len- bytes. Start with edc = 0
+uint32_t sectorEDC(uint32_t edc, const uint8_t *src, size_t len);
+
+//Compute the P and Q ECC parity of a full 2352 byte sector into the sector.
+//Mode 2 sectors compute the ECC as if the header were zero (zeroAddress).
+void sectorECCGenerate(uint8_t *sector, const bool zeroAddress);
+
+//Returns true if the P and Q ECC parity stored in the sector are correct
+bool sectorECCCheck(uint8_t *sector, const bool zeroAddress);
+
+//Check a full 2352 byte raw sector. The layout is picked from the mode byte
+//and XA subheader. If -repair- is set, wrong ECC on good data is regenerated
+t_SECTOR sectorCheck(uint8_t *sector, const bool repair);
+
+//Returns true if the buffer starts with the 12 byte sync pattern
+bool sectorHasSync(const uint8_t *sector);
+
+//Guess the TRACK type of a whole bin file from its first -len- bytes (up to
+//SECTOR_SNIFF_BYTES) and its size. Raw sectors are told apart by the sync and
+//mode byte, cooked ones by where the ISO9660 volume descriptor is. Anything
+//else that is a whole number of 2352 byte sectors is AUDIO. Returns UNKNOWN
+//if the size fits no sector layout. (CDI tracks are reported as MODE2)
+t_TRACK sectorSniffMode(const uint8_t *head, const size_t len,
+                        const unsigned long long fileSize);
+
+/*** Sector Verifier **********************************************************/
+//A sector that did not check OK
+struct SectorError {
+	std::string PATH; //bin file the sector is in
+	unsigned int TRACK = 0; //TRACK ID the sector belongs to
+	unsigned long long SECTOR = 0; //Sector number inside the bin file
+	t_SECTOR ERROR = t_SECTOR::OK;
+};
+
+//Totals from a verify() run
+struct VerifyReport {
+	unsigned long long sectors = 0; //Data sectors checked
+	unsigned long long badEDC = 0;
+	unsigned long long badECC = 0;
+	unsigned long long badSync = 0;
+	unsigned long long repaired = 0;
+	//Data sectors that could not be read, and data TRACKs that were not read
+	//in full (a missing bin file has no sectors to count, only TRACKs)
+	unsigned long long unread = 0;
+	unsigned long long unreadTracks = 0;
+	std::vector <SectorError> errors; //Sorted by PATH and SECTOR
+	
+	//Returns true if every data sector was read and checked OK (or was
+	//repaired)
+	bool good() const {
+		return (badEDC + badECC + badSync + unread + unreadTracks) == 0;
+	}
+};
+
+class SectorVerifier {
+	public:
+	//Takes a CueHandler with its cue data already loaded (getCueData)
+	SectorVerifier(CueHandler &cue);
+	
+	/** Configuration Functions ***********************************************/
+	//Number of worker threads. 0 uses the number of hardware threads
+	void setThreads(const unsigned int threads) { this->m_threads = threads; }
+	
+	//Regenerate wrong ECC in place when the EDC proves the data is good
+	void setRepair(const bool repair) { this->m_repair = repair; }
+	
+	//Sectors read from disk per batch, per thread
+	void setBatchSectors(const size_t sectors) { this->m_batch = sectors; }
+	
+	/** Verification **********************************************************/
+	//Stream every data TRACK and check the EDC/ECC of every sector in it.
+	//AUDIO, CDG and MODE1/2048 TRACKs carry no EDC/ECC and are skipped.
+	VerifyReport verify();
+	
+	private:
+	CueHandler &m_cue;
+	unsigned int m_threads = 0;
+	bool m_repair = false;
+	size_t m_batch = 512;
+};
+
+#endif
@@ -0,0 +1,356 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* Lossless CDDA sector coding. See CddaCodec.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "CddaCodec.hpp"
+
+#include <cstdint>
+
+namespace {
+//Frames of the previous sector the predictors look back at
+const size_t HISTORY = 4;
+
+const unsigned int MAX_ORDER = 4;
+const unsigned int MAX_RICE = 31;
+
+//A value >> k this big is written whole instead
+const uint32_t RICE_ESCAPE = 32;
+
+//Channels a stereo mode codes
+enum t_CHANNEL { LEFT, RIGHT, SIDE, MID };
+const t_CHANNEL modeChannels[4][2] = {
+	{LEFT, RIGHT}, {LEFT, SIDE}, {SIDE, RIGHT}, {MID, SIDE}
+};
+
+//Smallest and largest sample value of each channel
+const int32_t channelMin[4] = {-32768, -32768, -65535, -32768};
+const int32_t channelMax[4] = {32767, 32767, 65535, 32767};
+
+/** Bit Streams ***************************************************************/
+//Writes bits most significant first. Stops storing bytes past maxLen
+struct BitWriter {
+	uint8_t *OUT;
+	size_t MAX_LEN;
+	size_t POS = 0;
+	uint64_t ACC = 0;
+	unsigned int BITS = 0; //Bits in ACC not yet stored
+	
+	BitWriter(uint8_t *out, const size_t maxLen) : OUT(out), MAX_LEN(maxLen) { }
+	
+	//Write the low -count- bits of -val-. -count- is at most 32
+	void put(const uint32_t val, const unsigned int count) {
+		uint64_t mask = (count == 32) ? 0xFFFFFFFF : ((1ULL << count) - 1);
+		ACC = (ACC << count) | (val & mask);
+		BITS += count;
+		
+		while(BITS >= 8) {
+			BITS -= 8;
+			if(POS < MAX_LEN) OUT[POS] = (uint8_t)(ACC >> BITS);
+			POS++;
+		}
+	}
+	
+	//Pad to a whole byte. Returns the length, or 0 if it went past MAX_LEN
+	size_t finish() {
+		if(BITS != 0) put(0, 8 - BITS);
+		return (POS <= MAX_LEN) ? POS : 0;
+	}
+};
+
+//Reads bits most significant first. Every read fails past the end
+struct BitReader {
+	const uint8_t *SRC;
+	size_t LEN;
+	size_t POS = 0;
+	uint64_t ACC = 0;
+	unsigned int BITS = 0; //Bits in ACC not yet read
+	
+	BitReader(const uint8_t *src, const size_t len) : SRC(src), LEN(len) { }
+	
+	//Read -count- bits (at most 32) into -val-. Returns false at the end
+	bool get(const unsigned int count, uint32_t &val) {
+		while(BITS < count) {
+			if(POS >= LEN) return false;
+			ACC = (ACC << 8) | SRC[POS++];
+			BITS += 8;
+		}
+		
+		BITS -= count;
+		uint64_t mask = (count == 32) ? 0xFFFFFFFF : ((1ULL << count) - 1);
+		val = (uint32_t)((ACC >> BITS) & mask);
+		return true;
+	}
+	
+	//Count 0 bits up to a 1 bit, or up to -limit- 0 bits
+	bool unary(const uint32_t limit, uint32_t &count) {
+		count = 0;
+		while(count < limit) {
+			uint32_t bit;
+			if(get(1, bit) == false) return false;
+			if(bit == 1) return true;
+			count++;
+		}
+		return true;
+	}
+};
+
+/** Samples *******************************************************************/
+//Sample -frame- of one channel of a raw sector
+int32_t channelSample(const uint8_t *sector, const size_t frame,
+                      const t_CHANNEL channel) {
+	const uint8_t *src = sector + frame * 4;
+	int32_t left = (int16_t)(uint16_t)(src[0] | (src[1] << 8));
+	int32_t right = (int16_t)(uint16_t)(src[2] | (src[3] << 8));
+	
+	switch(channel) {
+		case LEFT: return left;
+		case RIGHT: return right;
+		case SIDE: return left - right;
+		default: return (left + right) >> 1;
+	}
+}
+
+//Fill -samples- with HISTORY frames of the previous sector (or silence) and
+//then the frames of the sector
+void loadChannel(const uint8_t *sector, const uint8_t *prev,
+                 const t_CHANNEL channel, int32_t *samples) {
+	for(size_t cHist = 0; cHist < HISTORY; cHist++) {
+		samples[cHist] = 0;
+		if(prev != nullptr) {
+			size_t frame = CDDA_FRAMES - HISTORY + cHist;
+			samples[cHist] = channelSample(prev, frame, channel);
+		}
+	}
+	
+	for(size_t frame = 0; frame < CDDA_FRAMES; frame++) {
+		samples[HISTORY + frame] = channelSample(sector, frame, channel);
+	}
+}
+
+//Fixed polynomial prediction of samples[pos] from the samples before it
+inline int32_t predict(const int32_t *samples, const size_t pos,
+                       const unsigned int order) {
+	const int32_t *s = samples + pos;
+	switch(order) {
+		case 0: return 0;
+		case 1: return s[-1];
+		case 2: return 2 * s[-1] - s[-2];
+		case 3: return 3 * s[-1] - 3 * s[-2] + s[-3];
+		default: return 4 * s[-1] - 6 * s[-2] + 4 * s[-3] - s[-4];
+	}
+}
+
+inline uint32_t zigzag(const int32_t val) {
+	return (val >= 0) ? (uint32_t)val * 2 : (uint32_t)(-(val + 1)) * 2 + 1;
+}
+
+inline int64_t unzigzag(const uint32_t val) {
+	return (val & 1) ? -(int64_t)(val >> 1) - 1 : (int64_t)(val >> 1);
+}
+
+//How one channel will be coded
+struct ChannelPlan {
+	unsigned int ORDER = 0;
+	unsigned int RICE = 0;
+	uint64_t COST = 0; //Sum of residual magnitudes, then bits
+	uint32_t RESIDUAL[CDDA_FRAMES]; //Zigzag mapped
+};
+
+//Pick the order with the smallest residuals, as FLAC does
+void planOrder(const int32_t *samples, ChannelPlan &plan) {
+	uint64_t sums[MAX_ORDER + 1] = {0};
+	for(size_t pos = HISTORY; pos < HISTORY + CDDA_FRAMES; pos++) {
+		for(unsigned int order = 0; order <= MAX_ORDER; order++) {
+			int32_t res = samples[pos] - predict(samples, pos, order);
+			sums[order] += (uint64_t)(res < 0 ? -(int64_t)res : res);
+		}
+	}
+	
+	plan.ORDER = 0;
+	for(unsigned int order = 1; order <= MAX_ORDER; order++) {
+		if(sums[order] < sums[plan.ORDER]) plan.ORDER = order;
+	}
+	plan.COST = sums[plan.ORDER];
+}
+
+//Bits to Rice code the residuals with parameter -rice-
+uint64_t riceBits(const uint32_t *residual, const unsigned int rice) {
+	uint64_t bits = 0;
+	for(size_t cRes = 0; cRes < CDDA_FRAMES; cRes++) {
+		uint32_t high = residual[cRes] >> rice;
+		bits += (high < RICE_ESCAPE) ? high + 1 + rice : RICE_ESCAPE + 32;
+	}
+	return bits;
+}
+
+//Work out the residuals and the best Rice parameter for the planned order
+void planRice(const int32_t *samples, ChannelPlan &plan) {
+	for(size_t frame = 0; frame < CDDA_FRAMES; frame++) {
+		size_t pos = HISTORY + frame;
+		plan.RESIDUAL[frame] = zigzag(samples[pos]
+		                              - predict(samples, pos, plan.ORDER));
+	}
+	
+	//Start from the size of the mean residual, then try either side of it
+	uint64_t mean = plan.COST * 2 / CDDA_FRAMES;
+	unsigned int guess = 0;
+	while(guess < MAX_RICE && (1ULL << (guess + 1)) <= mean) guess++;
+	
+	plan.RICE = guess;
+	plan.COST = riceBits(plan.RESIDUAL, guess);
+	for(unsigned int rice = (guess == 0) ? 0 : guess - 1;
+	    rice <= guess + 1 && rice <= MAX_RICE; rice++) {
+		uint64_t bits = riceBits(plan.RESIDUAL, rice);
+		if(bits < plan.COST) {
+			plan.COST = bits;
+			plan.RICE = rice;
+		}
+	}
+}
+} //namespace
+
+/*** Codec functions **********************************************************/
+size_t cddaEncode(const uint8_t *sector, const uint8_t *prev, uint8_t *out,
+                  const size_t maxLen) {
+	//Plan every channel, then pick the pair that codes smallest
+	int32_t samples[4][HISTORY + CDDA_FRAMES];
+	ChannelPlan plans[4];
+	for(int channel = LEFT; channel <= MID; channel++) {
+		loadChannel(sector, prev, (t_CHANNEL)channel, samples[channel]);
+		planOrder(samples[channel], plans[channel]);
+	}
+	
+	unsigned int mode = 0;
+	for(unsigned int cMode = 1; cMode < 4; cMode++) {
+		const t_CHANNEL *pair = modeChannels[cMode];
+		const t_CHANNEL *best = modeChannels[mode];
+		if(plans[pair[0]].COST + plans[pair[1]].COST
+		 < plans[best[0]].COST + plans[best[1]].COST) mode = cMode;
+	}
+	
+	const t_CHANNEL *pair = modeChannels[mode];
+	planRice(samples[pair[0]], plans[pair[0]]);
+	planRice(samples[pair[1]], plans[pair[1]]);
+	
+	BitWriter bits(out, maxLen);
+	bits.put(mode, 2);
+	bits.put(plans[pair[0]].ORDER, 3);
+	bits.put(plans[pair[1]].ORDER, 3);
+	bits.put(plans[pair[0]].RICE, 5);
+	bits.put(plans[pair[1]].RICE, 5);
+	
+	for(int cChan = 0; cChan < 2; cChan++) {
+		const ChannelPlan &plan = plans[pair[cChan]];
+		for(size_t cRes = 0; cRes < CDDA_FRAMES; cRes++) {
+			uint32_t val = plan.RESIDUAL[cRes];
+			uint32_t high = val >> plan.RICE;
+			
+			if(high >= RICE_ESCAPE) {
+				bits.put(0, RICE_ESCAPE);
+				bits.put(val, 32);
+				continue;
+			}
+			
+			//Unary, its end bit, then the low bits
+			bits.put(0, high);
+			bits.put(1, 1);
+			bits.put(val, plan.RICE);
+		}
+		
+		//Stop early once it cannot fit
+		if(bits.POS > maxLen) return 0;
+	}
+	
+	return bits.finish();
+}
+
+int cddaDecode(const uint8_t *src, const size_t len, const uint8_t *prev,
+               uint8_t *sector) {
+	BitReader bits(src, len);
+	uint32_t mode, order[2], rice[2];
+	if(bits.get(2, mode) == false || bits.get(3, order[0]) == false
+	|| bits.get(3, order[1]) == false || bits.get(5, rice[0]) == false
+	|| bits.get(5, rice[1]) == false) return 1;
+	if(order[0] > MAX_ORDER || order[1] > MAX_ORDER) return 1;
+	
+	const t_CHANNEL *pair = modeChannels[mode];
+	int32_t samples[2][HISTORY + CDDA_FRAMES];
+	
+	for(int cChan = 0; cChan < 2; cChan++) {
+		t_CHANNEL channel = pair[cChan];
+		int32_t *chan = samples[cChan];
+		
+		for(size_t cHist = 0; cHist < HISTORY; cHist++) {
+			chan[cHist] = 0;
+			if(prev != nullptr) {
+				size_t frame = CDDA_FRAMES - HISTORY + cHist;
+				chan[cHist] = channelSample(prev, frame, channel);
+			}
+		}
+		
+		for(size_t pos = HISTORY; pos < HISTORY + CDDA_FRAMES; pos++) {
+			uint32_t high, low, val;
+			if(bits.unary(RICE_ESCAPE, high) == false) return 1;
+			
+			if(high == RICE_ESCAPE) {
+				if(bits.get(32, val) == false) return 1;
+			} else {
+				if(bits.get(rice[cChan], low) == false) return 1;
+				val = (uint32_t)(((uint64_t)high << rice[cChan]) | low);
+			}
+			
+			//Anything out of the channel's range is corrupt data
+			int64_t sample = predict(chan, pos, order[cChan]) + unzigzag(val);
+			if(sample < channelMin[channel] || sample > channelMax[channel]) {
+				return 1;
+			}
+			chan[pos] = (int32_t)sample;
+		}
+	}
+	
+	//Back to left and right
+	for(size_t frame = 0; frame < CDDA_FRAMES; frame++) {
+		int32_t first = samples[0][HISTORY + frame];
+		int32_t second = samples[1][HISTORY + frame];
+		int32_t left, right;
+		
+		switch(mode) {
+			case 0:
+				left = first;
+				right = second;
+				break;
+			case 1:
+				left = first;
+				right = first - second;
+				break;
+			case 2:
+				left = first + second;
+				right = second;
+				break;
+			default: {
+				int32_t sum = first * 2 + (second & 1);
+				left = (sum + second) >> 1;
+				right = (sum - second) >> 1;
+				break;
+			}
+		}
+		
+		if(left < -32768 || left > 32767 || right < -32768 || right > 32767) {
+			return 1;
+		}
+		
+		uint8_t *dest = sector + frame * 4;
+		dest[0] = (uint8_t)((uint16_t)left);
+		dest[1] = (uint8_t)((uint16_t)left >> 8);
+		dest[2] = (uint8_t)((uint16_t)right);
+		dest[3] = (uint8_t)((uint16_t)right >> 8);
+	}
+	
+	return 0;
+}
@@ -0,0 +1,58 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file is a lossless coder for CDDA (AUDIO TRACK) sectors, in the style of
+* FLAC's fixed predictors, with no outside library. Each channel is predicted
+* from its previous samples, and the prediction error is Rice coded. Music
+* usually codes to 50-60% of its size. BinCompact uses it for the sectors of
+* AUDIO TRACKs, a sector at a time, so any block of sectors can be decoded on
+* its own.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef CDDA_CODEC_H
+#define CDDA_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*** Coded sector format ******************************************************/
+/*	A raw sector is 588 stereo frames of 16 bit little endian samples, left
+	then right. The coded sector is a bit stream, most significant bit first,
+	padded to a whole byte.
+		2 bits	Stereo mode. 0 left/right, 1 left/side, 2 side/right,
+				3 mid/side. side = L - R, mid = (L + R) >> 1 (the low bit
+				of L + R is the low bit of side)
+		3 bits	Predictor order (0-4) of the first channel
+		3 bits	Predictor order of the second channel
+		5 bits	Rice parameter k of the first channel
+		5 bits	Rice parameter k of the second channel
+		588 residuals of the first channel, then 588 of the second
+	
+	Predictors are FLAC's fixed polynomials of order 0 to 4. They start from
+	the last 4 frames of the previous sector (in the same stereo mode), or
+	from silence if there is no previous sector.
+	
+	Residuals are zigzag mapped (0, -1, 1, -2 .. to 0, 1, 2, 3 ..) and Rice
+	coded: the value >> k in unary (that many 0 bits, then a 1), then the
+	low k bits. A value >> k of 32 or more is written as 32 0 bits followed
+	by the 32 bit value.                                                      */
+const size_t CDDA_FRAMES = 588; //Stereo frames per sector
+
+/*** Codec functions **********************************************************/
+//Code one 2352 byte sector into -out- (at most -maxLen- bytes). -prev- is the
+//sector before it, or nullptr. Returns the coded length, or 0 if it does not
+//fit in -maxLen-
+size_t cddaEncode(const uint8_t *sector, const uint8_t *prev, uint8_t *out,
+                  const size_t maxLen);
+
+//Decode -len- coded bytes into a 2352 byte sector. -prev- must be the same
+//sector passed to cddaEncode. Returns 0 on success, 1 if the data is corrupt
+int cddaDecode(const uint8_t *src, const size_t len, const uint8_t *prev,
+               uint8_t *sector);
+
+#endif
@@ -0,0 +1,315 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* Renders parsed cue data as text, JSON or CSV. See CueFormat.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "CueFormat.hpp"
+#include "CueHandler.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+//Type strings, or UNKNOWN if the value is out of range
+const std::string &fileTypeStr(const t_FILE type) {
+	if((int)type < 0 || type >= t_FILE::MAX_TYPES) return t_FILE_str[0];
+	return t_FILE_str[(int)type];
+}
+
+const std::string &trackTypeStr(const t_TRACK type) {
+	if((int)type < 0 || type >= t_TRACK::MAX_TYPES) return t_TRACK_str[0];
+	return t_TRACK_str[(int)type];
+}
+} //namespace
+
+/*** Sinks ********************************************************************/
+int StringSink::write(const char *data, const size_t len) {
+	m_str.append(data, len);
+	return 0;
+}
+
+int FdSink::write(const char *data, const size_t len) {
+	size_t done = 0;
+	while(done < len) {
+		ssize_t written = ::write(m_fd, data + done, len - done);
+		if(written < 0) {
+			if(errno == EINTR) continue;
+			return 1;
+		}
+		done += (size_t)written;
+	}
+	
+	return 0;
+}
+
+int StdioSink::write(const char *data, const size_t len) {
+	if(fwrite(data, 1, len, m_file) != len) return 1;
+	return 0;
+}
+
+int StreamSink::write(const char *data, const size_t len) {
+	m_stream.write(data, (std::streamsize)len);
+	if(m_stream.fail()) return 1;
+	return 0;
+}
+
+/*** Output Functions *********************************************************/
+void CueFormatter::writeCue(const std::vector <FileData> &files,
+                            const std::string &name) {
+	m_cueName = &name;
+	
+	if(m_format == t_FORMAT::JSON) {
+		putLit("{\"cue\":");
+		putJSONString(name);
+		putLit(",\"files\":[");
+		for(size_t fIdx = 0; fIdx < files.size(); fIdx++) {
+			if(fIdx != 0) put(',');
+			writeJSONFILE(files[fIdx]);
+		}
+		putLit("]}\n");
+	} else {
+		for(size_t fIdx = 0; fIdx < files.size(); fIdx++) {
+			writeFILE(files[fIdx]);
+		}
+	}
+	
+	m_cueName = nullptr;
+}
+
+void CueFormatter::writeFILE(const FileData &refFILE) {
+	switch(m_format) {
+		case t_FORMAT::JSON:
+			writeJSONFILE(refFILE);
+			put('\n');
+			break;
+		
+		case t_FORMAT::CSV:
+			writeCSVFILE(refFILE);
+			break;
+		
+		default:
+			writeTextFILE(refFILE);
+			break;
+	}
+}
+
+int CueFormatter::flush() {
+	if(m_used != 0) {
+		if(m_sink.write(m_buffer, m_used) != 0) m_error = 1;
+		m_used = 0;
+	}
+	
+	return m_error;
+}
+
+/*** Format Functions *********************************************************/
+void CueFormatter::writeTextFILE(const FileData &refFILE) {
+	//Filename and type, then a seperator
+	putLit("FILENAME: ");
+	put(refFILE.FILENAME);
+	putLit("\t\tTYPE: ");
+	put(fileTypeStr(refFILE.TYPE));
+	putLit("\n----------------------------------------------------------\n");
+	
+	for(const TrackData &refTRACK : refFILE.TRACK) {
+		putLit("TRACK ");
+		putUInt(refTRACK.ID, 2);
+		putLit("        TYPE: ");
+		put(trackTypeStr(refTRACK.TYPE));
+		put('\n');
+		
+		for(const IndexData &refINDEX : refTRACK.INDEX) {
+			putLit("  INDEX ");
+			putUInt(refINDEX.ID, 2);
+			putLit("    BYTES: ");
+			putUInt(refINDEX.bytes(m_sectorBytes), 9, ' ');
+			putLit("    TIMESTAMP: ");
+			putTimestamp(refINDEX.FRAMES);
+			put('\n');
+		}
+		
+		//Blank line to split the TRACK fields
+		put('\n');
+	}
+}
+
+void CueFormatter::writeJSONFILE(const FileData &refFILE) {
+	putLit("{\"filename\":");
+	putJSONString(refFILE.FILENAME);
+	putLit(",\"type\":");
+	putJSONString(fileTypeStr(refFILE.TYPE));
+	putLit(",\"tracks\":[");
+	
+	for(size_t tIdx = 0; tIdx < refFILE.TRACK.size(); tIdx++) {
+		const TrackData &refTRACK = refFILE.TRACK[tIdx];
+		if(tIdx != 0) put(',');
+		
+		putLit("{\"id\":");
+		putUInt(refTRACK.ID);
+		putLit(",\"type\":");
+		putJSONString(trackTypeStr(refTRACK.TYPE));
+		putLit(",\"indexes\":[");
+		
+		for(size_t iIdx = 0; iIdx < refTRACK.INDEX.size(); iIdx++) {
+			const IndexData &refINDEX = refTRACK.INDEX[iIdx];
+			if(iIdx != 0) put(',');
+			
+			putLit("{\"id\":");
+			putUInt(refINDEX.ID);
+			putLit(",\"bytes\":");
+			putUInt(refINDEX.bytes(m_sectorBytes));
+			putLit(",\"timestamp\":\"");
+			putTimestamp(refINDEX.FRAMES);
+			putLit("\"}");
+		}
+		
+		putLit("]}");
+	}
+	
+	putLit("]}");
+}
+
+void CueFormatter::writeCSVFILE(const FileData &refFILE) {
+	if(m_csvHeader == false) {
+		putLit("cue,filename,file_type,track,track_type,index,bytes,"
+		       "timestamp\n");
+		m_csvHeader = true;
+	}
+	
+	for(const TrackData &refTRACK : refFILE.TRACK) {
+		//A TRACK without INDEXs still gets a row, with the INDEX fields empty
+		size_t rows = refTRACK.INDEX.empty() ? 1 : refTRACK.INDEX.size();
+		
+		for(size_t iIdx = 0; iIdx < rows; iIdx++) {
+			if(m_cueName != nullptr) putCSVField(*m_cueName);
+			put(',');
+			putCSVField(refFILE.FILENAME);
+			put(',');
+			put(fileTypeStr(refFILE.TYPE));
+			put(',');
+			putUInt(refTRACK.ID);
+			put(',');
+			put(trackTypeStr(refTRACK.TYPE));
+			put(',');
+			
+			if(refTRACK.INDEX.empty() == false) {
+				const IndexData &refINDEX = refTRACK.INDEX[iIdx];
+				putUInt(refINDEX.ID);
+				put(',');
+				putUInt(refINDEX.bytes(m_sectorBytes));
+				put(',');
+				putTimestamp(refINDEX.FRAMES);
+			} else {
+				putLit(",,");
+			}
+			
+			put('\n');
+		}
+	}
+}
+
+/*** Buffer Functions *********************************************************/
+void CueFormatter::put(const char *data, const size_t len) {
+	//Make room, or write large blocks straight to the sink
+	if(m_used + len > sizeof(m_buffer)) {
+		flush();
+		
+		if(len > sizeof(m_buffer)) {
+			if(m_sink.write(data, len) != 0) m_error = 1;
+			return;
+		}
+	}
+	
+	memcpy(m_buffer + m_used, data, len);
+	m_used += len;
+}
+
+void CueFormatter::put(const char chr) {
+	if(m_used == sizeof(m_buffer)) flush();
+	m_buffer[m_used++] = chr;
+}
+
+void CueFormatter::putUInt(unsigned long long val, const unsigned int width,
+                           const char pad) {
+	//Digits are made backwards from the end of a scratch buffer
+	char digits[24];
+	char *end = digits + sizeof(digits);
+	char *pos = end;
+	
+	do {
+		*--pos = (char)('0' + val % 10);
+		val /= 10;
+	} while(val != 0);
+	
+	//Pad to width (never more than the scratch buffer)
+	while((size_t)(end - pos) < width && pos > digits) *--pos = pad;
+	
+	put(pos, (size_t)(end - pos));
+}
+
+void CueFormatter::putTimestamp(const uint32_t frames) {
+	//75 sectors per second, 60 seconds per minute
+	unsigned long seconds = frames / 75;
+	unsigned long rFrames = frames % 75;
+	unsigned long minutes = seconds / 60;
+	seconds = seconds % 60;
+	
+	putUInt(minutes, 2);
+	put(':');
+	putUInt(seconds, 2);
+	put(':');
+	putUInt(rFrames, 2);
+}
+
+void CueFormatter::putJSONString(const std::string &str) {
+	const char *hex = "0123456789abcdef";
+	
+	put('"');
+	for(const char chr : str) {
+		switch(chr) {
+			case '"': putLit("\\\""); break;
+			case '\\': putLit("\\\\"); break;
+			case '\n': putLit("\\n"); break;
+			case '\r': putLit("\\r"); break;
+			case '\t': putLit("\\t"); break;
+			
+			default:
+				//Other control characters as \u00XX, everything else as-is
+				if((unsigned char)chr < 0x20) {
+					putLit("\\u00");
+					put(hex[(chr >> 4) & 0x0F]);
+					put(hex[chr & 0x0F]);
+				} else {
+					put(chr);
+				}
+				break;
+		}
+	}
+	put('"');
+}
+
+void CueFormatter::putCSVField(const std::string &str) {
+	//Fields with a comma, quote or newline are quoted, with quotes doubled
+	if(str.find_first_of(",\"\r\n") == std::string::npos) {
+		put(str);
+		return;
+	}
+	
+	put('"');
+	for(const char chr : str) {
+		if(chr == '"') put('"');
+		put(chr);
+	}
+	put('"');
+}
@@ -0,0 +1,154 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file renders parsed cue data as text (the printFILE layout), JSON or
+* CSV into any sink: a std::string, a file descriptor, a FILE* or a
+* std::ostream. Output is built in a fixed buffer, numbers and timestamps are
+* formatted in place, so nothing is allocated per field.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef CUE_FORMAT_H
+#define CUE_FORMAT_H
+
+#include <cstddef>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "CueHandler.hpp"
+
+/*** Enums ********************************************************************/
+//Output formats
+/*	TEXT	The human readable printFILE layout
+	JSON	One JSON object per cue (or per FILE with writeFILE), one per line
+	CSV		One row per INDEX, with a header row before the first row       */
+enum class t_FORMAT {
+	TEXT, JSON, CSV, MAX_TYPES
+};
+
+/*** Sinks ********************************************************************/
+//Where the formatted bytes go. write() returns 0 on success, 1 on failure
+class FormatSink {
+	public:
+	virtual ~FormatSink() { }
+	virtual int write(const char *data, const size_t len) = 0;
+};
+
+//Appends to a std::string
+class StringSink : public FormatSink {
+	public:
+	StringSink(std::string &str) : m_str(str) { }
+	int write(const char *data, const size_t len);
+	
+	private:
+	std::string &m_str;
+};
+
+//Writes to a file descriptor (stdout is 1)
+class FdSink : public FormatSink {
+	public:
+	FdSink(const int fd) : m_fd(fd) { }
+	int write(const char *data, const size_t len);
+	
+	private:
+	int m_fd;
+};
+
+//Writes to a C FILE* stream
+class StdioSink : public FormatSink {
+	public:
+	StdioSink(FILE *file) : m_file(file) { }
+	int write(const char *data, const size_t len);
+	
+	private:
+	FILE *m_file;
+};
+
+//Writes to a std::ostream
+class StreamSink : public FormatSink {
+	public:
+	StreamSink(std::ostream &stream) : m_stream(stream) { }
+	int write(const char *data, const size_t len);
+	
+	private:
+	std::ostream &m_stream;
+};
+
+/*** CueFormatter Class *******************************************************/
+class CueFormatter {
+	public:
+	CueFormatter(FormatSink &sink, const t_FORMAT format = t_FORMAT::TEXT)
+	           : m_sink(sink), m_format(format) { }
+	
+	//Flushes anything left in the buffer
+	~CueFormatter() { flush(); }
+	
+	/** Configuration Functions ***********************************************/
+	void setFormat(const t_FORMAT format) { this->m_format = format; }
+	
+	//Bytes per sector used to print the byte offset of each INDEX
+	void setSectorBytes(const unsigned long bytes) {
+		this->m_sectorBytes = bytes;
+	}
+	
+	/** Output Functions ******************************************************/
+	//Render every FILE of a cue. -name- identifies the cue in JSON and CSV
+	void writeCue(const std::vector <FileData> &files,
+	              const std::string &name = "");
+	
+	//Render a single FILE
+	void writeFILE(const FileData &);
+	
+	//Pass the buffered output to the sink. Returns 0 if every write so far
+	//has succeeded, 1 if any failed
+	int flush();
+	
+	private:
+	FormatSink &m_sink;
+	t_FORMAT m_format;
+	unsigned long m_sectorBytes = 2352;
+	
+	//Cue name for CSV rows, and whether the CSV header has been written
+	const std::string *m_cueName = nullptr;
+	bool m_csvHeader = false;
+	
+	//Output buffer
+	char m_buffer[8192];
+	size_t m_used = 0;
+	int m_error = 0;
+	
+	/** Format Functions ******************************************************/
+	void writeTextFILE(const FileData &);
+	void writeJSONFILE(const FileData &);
+	void writeCSVFILE(const FileData &);
+	
+	/** Buffer Functions ******************************************************/
+	//Append raw bytes
+	void put(const char *data, const size_t len);
+	void put(const std::string &str) { put(str.data(), str.size()); }
+	void put(const char chr);
+	
+	//Append a string literal without counting its length at runtime
+	template <size_t N> void putLit(const char (&lit)[N]) { put(lit, N - 1); }
+	
+	//Append an unsigned integer, padded to -width- with -pad-
+	void putUInt(unsigned long long val, const unsigned int width = 0,
+	             const char pad = '0');
+	
+	//Append the MM:SS:FF timestamp of a number of frames (sectors)
+	void putTimestamp(const uint32_t frames);
+	
+	//Append a string as a quoted, escaped JSON string
+	void putJSONString(const std::string &str);
+	
+	//Append a CSV field, quoted only if it needs to be
+	void putCSVField(const std::string &str);
+};
+
+#endif
@@ -0,0 +1,210 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file builds .cue files for bare bin files. See CueGenerate.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "CueGenerate.hpp"
+#include "CDSector.hpp"
+#include "CueHandler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace {
+//Sectors of silence that make a pregap (2 seconds)
+const size_t PREGAP_SECTORS = 150;
+
+//Returns true if the filename ends in .bin, in any case
+bool isBinName(const std::string &name) {
+	if(name.size() < 4) return false;
+	
+	std::string ext = name.substr(name.size() - 4);
+	for(char &chr : ext) chr = (char)tolower((unsigned char)chr);
+	return ext == ".bin";
+}
+
+//Returns the filename part of a path
+std::string baseName(const std::string &path) {
+	size_t slash = path.find_last_of('/');
+	if(slash == std::string::npos) return path;
+	return path.substr(slash + 1);
+}
+
+//Natural order. Runs of digits compare by value, so "Track 2" < "Track 10"
+bool naturalLess(const std::string &a, const std::string &b) {
+	size_t posA = 0, posB = 0;
+	
+	while(posA < a.size() && posB < b.size()) {
+		if(isdigit((unsigned char)a[posA]) && isdigit((unsigned char)b[posB])) {
+			//Skip leading zeros, then the longer run is the bigger number
+			while(posA < a.size() && a[posA] == '0') ++posA;
+			while(posB < b.size() && b[posB] == '0') ++posB;
+			
+			size_t endA = posA, endB = posB;
+			while(endA < a.size() && isdigit((unsigned char)a[endA])) ++endA;
+			while(endB < b.size() && isdigit((unsigned char)b[endB])) ++endB;
+			
+			if(endA - posA != endB - posB) return endA - posA < endB - posB;
+			
+			int cmp = a.compare(posA, endA - posA, b, posB, endB - posB);
+			if(cmp != 0) return cmp < 0;
+			
+			posA = endA;
+			posB = endB;
+			continue;
+		}
+		
+		if(a[posA] != b[posB]) return a[posA] < b[posB];
+		++posA;
+		++posB;
+	}
+	
+	return (a.size() - posA) < (b.size() - posB);
+}
+
+//Stat a bin file, sniff its TRACK type and look for a silent pregap
+void sniffFile(BinInfo &bin, const bool detectPregap,
+               std::vector <uint8_t> &buffer) {
+	struct stat info;
+	if(stat(bin.PATH.c_str(), &info) != 0 || S_ISREG(info.st_mode) == false) {
+		return;
+	}
+	bin.SIZE = (unsigned long long)info.st_size;
+	
+	std::ifstream binFile(bin.PATH, std::ios::in | std::ios::binary);
+	if(binFile.is_open() == false) return;
+	
+	//Only the start of the file is needed to sniff it
+	size_t want = SECTOR_SNIFF_BYTES;
+	if(want > bin.SIZE) want = (size_t)bin.SIZE;
+	
+	buffer.resize(want);
+	binFile.read((char *)buffer.data(), (std::streamsize)want);
+	if((size_t)binFile.gcount() != want) return;
+	
+	bin.TYPE = sectorSniffMode(buffer.data(), want, bin.SIZE);
+	bin.READ = true;
+	
+	//A pregap is 150 sectors of zero samples, followed by more audio. Read
+	//the rest of the 150 sectors on top of what is already in the buffer
+	const size_t pregapBytes = PREGAP_SECTORS * SECTOR_RAW;
+	if(detectPregap == false || bin.TYPE != t_TRACK::AUDIO
+	   || bin.SIZE <= pregapBytes) return;
+	
+	buffer.resize(pregapBytes);
+	binFile.read((char *)buffer.data() + want,
+	             (std::streamsize)(pregapBytes - want));
+	if((size_t)binFile.gcount() != pregapBytes - want) return;
+	
+	bin.PREGAP = std::all_of(buffer.begin(), buffer.end(),
+	                         [](const uint8_t val) { return val == 0; });
+}
+} //namespace
+
+/*** Input Functions **********************************************************/
+int CueGenerator::addDirectory(const std::string dir) {
+	DIR *dirHandle = opendir(dir.c_str());
+	if(dirHandle == nullptr) return errorMsg("Could not open directory " + dir);
+	
+	std::string prefix = dir;
+	if(prefix.empty() == false && prefix.back() != '/') prefix.push_back('/');
+	
+	struct dirent *entry;
+	while((entry = readdir(dirHandle)) != nullptr) {
+		std::string name = entry->d_name;
+		if(isBinName(name)) addFile(prefix + name);
+	}
+	
+	closedir(dirHandle);
+	return 0;
+}
+
+void CueGenerator::addFile(const std::string path) {
+	BinInfo bin;
+	bin.PATH = path;
+	bin.FILENAME = baseName(path);
+	
+	m_files.push_back(bin);
+}
+
+int CueGenerator::sniff() {
+	unsigned int threadCount = m_threads;
+	if(threadCount == 0) threadCount = std::thread::hardware_concurrency();
+	if(threadCount == 0) threadCount = 1;
+	if(threadCount > m_files.size()) threadCount = (unsigned int)m_files.size();
+	
+	std::atomic <size_t> nextFile(0);
+	
+	//Each worker takes the next file until none are left
+	auto worker = [&]() {
+		std::vector <uint8_t> buffer;
+		
+		size_t fileIdx;
+		while((fileIdx = nextFile.fetch_add(1)) < m_files.size()) {
+			BinInfo &bin = m_files[fileIdx];
+			if(bin.READ == false) sniffFile(bin, m_pregap, buffer);
+		}
+	};
+	
+	std::vector <std::thread> threads;
+	for(unsigned int cThread = 0; cThread < threadCount; cThread++) {
+		threads.push_back(std::thread(worker));
+	}
+	for(size_t cThread = 0; cThread < threads.size(); cThread++) {
+		threads[cThread].join();
+	}
+	
+	//Directory order is arbitrary, put the TRACKs in filename order
+	std::stable_sort(m_files.begin(), m_files.end(),
+	  [](const BinInfo &a, const BinInfo &b) {
+		return naturalLess(a.FILENAME, b.FILENAME);
+	});
+	
+	//The first TRACK's pregap is never stored in the bin file
+	if(m_files.empty() == false) m_files.front().PREGAP = false;
+	
+	int failed = 0;
+	for(const BinInfo &bin : m_files) {
+		if(bin.READ == false) {
+			failed = errorMsg("Could not read " + bin.PATH);
+		} else if(bin.TYPE == t_TRACK::UNKNOWN) {
+			failed = errorMsg("Unknown sector layout in " + bin.PATH);
+		}
+	}
+	
+	return failed;
+}
+
+/*** Output Functions *********************************************************/
+int CueGenerator::generate(const std::string dir, const std::string cuePath) {
+	if(addDirectory(dir) != 0) return 1;
+	
+	//Unreadable files are reported by sniff() and left out of the .cue
+	sniff();
+	
+	//The data comes from our own sniffing, so skip validation
+	TrustedCueHandler cue(cuePath);
+	buildCue(cue);
+	if(cue.FILE.empty()) return errorMsg("No usable bin files in " + dir);
+	
+	cue.outputCueFile();
+	return 0;
+}
+
+int CueGenerator::errorMsg(const std::string msg) {
+	std::cerr << "Error: CueGenerator: " << msg << '.' << std::endl;
+	return 1;
+}
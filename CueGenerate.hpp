@@ -0,0 +1,102 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file builds .cue files for bin files that came without one. Every bin
+* file in a directory is stat'd and sniffed (sync pattern, mode byte, ISO9660
+* descriptor) across multiple threads, and becomes one FILE with one TRACK,
+* in natural filename order ("Track 2" before "Track 10").
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef CUE_GENERATE_H
+#define CUE_GENERATE_H
+
+#include <string>
+#include <vector>
+
+#include "CueHandler.hpp"
+
+/*** Structs ******************************************************************/
+//A bin file and what was detected about it
+struct BinInfo {
+	std::string PATH; //Path to the bin file
+	std::string FILENAME; //Filename only, as written to the .cue
+	unsigned long long SIZE = 0; //File size in bytes
+	t_TRACK TYPE = t_TRACK::UNKNOWN; //Sniffed TRACK type
+	bool PREGAP = false; //Starts with a 2 second silent pregap (AUDIO only)
+	bool READ = false; //File was stat'd and sniffed without error
+};
+
+/*** CueGenerator Class *******************************************************/
+class CueGenerator {
+	public:
+	CueGenerator() { }
+	
+	/** Configuration Functions ***********************************************/
+	//Number of worker threads. 0 uses the number of hardware threads
+	void setThreads(const unsigned int threads) { this->m_threads = threads; }
+	
+	//Look for 2 seconds of digital silence at the start of AUDIO files after
+	//the first TRACK, and write them as INDEX 00 pregaps (default on)
+	void setDetectPregap(const bool detect) { this->m_pregap = detect; }
+	
+	/** Input Functions *******************************************************/
+	//Add every .bin file (any case) in a directory. Returns 0 on success, 1 if
+	//the directory could not be read
+	int addDirectory(const std::string dir);
+	
+	//Add a single bin file
+	void addFile(const std::string path);
+	
+	//Stat and sniff every added file, then sort them by filename. Returns 0
+	//on success, 1 if any file could not be read or has an unknown layout
+	int sniff();
+	
+	//Every added file, after sniff() in .cue order
+	const std::vector <BinInfo> &files() const { return m_files; }
+	
+	/** Output Functions ******************************************************/
+	//Push a FILE, TRACK and INDEXs for every readable file into a CueHandler.
+	//TRACKs are numbered from 1, files with an unknown layout are left out
+	template <class CueType> void buildCue(CueType &cue) const;
+	
+	//Add, sniff and build a directory, then write it to cuePath. Returns 0 on
+	//success, 1 if there were no usable bin files
+	int generate(const std::string dir, const std::string cuePath);
+	
+	private:
+	unsigned int m_threads = 0;
+	bool m_pregap = true;
+	std::vector <BinInfo> m_files;
+	
+	//Print an error message to std::cerr, returns 1 for failure
+	int errorMsg(const std::string msg);
+};
+
+/*** Template Functions *******************************************************/
+template <class CueType> void CueGenerator::buildCue(CueType &cue) const {
+	unsigned int trackID = 1;
+	
+	for(const BinInfo &bin : m_files) {
+		if(bin.READ == false || bin.TYPE == t_TRACK::UNKNOWN) continue;
+		
+		cue.pushFILE(bin.FILENAME, t_FILE::BINARY);
+		cue.pushTRACK(trackID, bin.TYPE);
+		
+		//A pregap is 2 seconds (150 sectors) before INDEX 01
+		if(bin.PREGAP) {
+			cue.pushINDEXFrames(0, 0);
+			cue.pushINDEXFrames(1, 150);
+		} else {
+			cue.pushINDEXFrames(1, 0);
+		}
+		
+		++trackID;
+	}
+}
+
+#endif
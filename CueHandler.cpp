@@ -10,8 +10,11 @@
 * (c) ADBeta
 *******************************************************************************/
 #include "CueHandler.hpp"
+#include "CueFormat.hpp"
 #include "TeFiEd.hpp"
 
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <vector>
 
@@ -42,6 +45,7 @@ const char* sectByte = "Cannot convert timestamp - Bytes in dump do not match\
  the Sector Size. This is a corrupted or modified dump.\n";
 
 const char* timestampLength = "The timestamp string is not the right size\n";
+const char* timestampFormat = "The timestamp is not in MM:SS:FF format\n";
 const char* timeOverMax = "INDEX Timestamp exceeds 99 Minutes.\n";
 
 const char* createFail = "Failed to create a .cue file to output data to\n";
@@ -51,48 +55,111 @@ const char* invalidCmd = ".cue file contains an unrecognised command (line)\n";
 
 const char* badPushTrack = "Attempted to push a TRACK, but no FILE exists\n";
 const char* badPushIndex = "Attempted to push an INDEX, but no TRACK exists\n";
+const char* invalidID = "A TRACK or INDEX ID is not a 1 or 2 digit number\n";
+
+const char* binMissing = "A FILE in the .cue could not be opened to get its\
+ size. Its TRACKs will be empty.\n";
+
+const char* readFail = "The .cue file could not be read\n";
+
+const char* cueTooLarge = "The .cue data is larger than the size limit\n";
 
 } //namespace errStr
 
-void CueHandler::handleCueError(const char* msg) {
+/*** Error Policies ***********************************************************/
+void RuntimeErrors::handle(const unsigned char strictLevel, const char *msg) {
 	//if the strictness is at 0, just continue, don't worry about the error
-	if(this->strictLevel == 0) return;
+	if(strictLevel == 0) return;
 	
 	//Strictness 1 is a warning
-	if(this->strictLevel == 1) {
+	if(strictLevel == 1) {
 		std::cerr << errStr::warnMsg << msg;
 		return;
 	}
 	
 	//Strictness 2 is an error and exit
-	if(this->strictLevel == 2) {
+	if(strictLevel == 2) {
 		std::cerr << errStr::errMsg << msg;
 		exit(EXIT_FAILURE);
 	}
 }
 
-void CueHandler::forceCueError(const char* msg) {
+void RuntimeErrors::fatal(const char *msg) {
+	std::cerr << errStr::errMsg << msg;
+	exit(EXIT_FAILURE);
+}
+
+void StrictErrors::handle(const unsigned char, const char *msg) {
+	std::cerr << errStr::errMsg << msg;
+	exit(EXIT_FAILURE);
+}
+
+void StrictErrors::fatal(const char *msg) {
+	std::cerr << errStr::errMsg << msg;
+	exit(EXIT_FAILURE);
+}
+
+void TrustedInput::fatal(const char *msg) {
 	std::cerr << errStr::errMsg << msg;
 	exit(EXIT_FAILURE);
 }
 
+void RecoverableErrors::handle(const unsigned char strictLevel,
+                               const char *msg) {
+	if(strictLevel == 0) return;
+	
+	//Strictness 1 is a warning, 2 is an error the caller can catch
+	if(strictLevel == 1) {
+		std::cerr << errStr::warnMsg << msg;
+		return;
+	}
+	
+	throw CueError(msg);
+}
+
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::handleCueError(const char* msg) {
+	EP::handle(this->strictLevel, msg);
+}
+
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::forceCueError(const char* msg) {
+	//The policy exits or throws. Nothing after this may run either way
+	EP::fatal(msg);
+	exit(EXIT_FAILURE);
+}
+
 /*** CueHandler Functions *****************************************************/
-CueHandler::CueHandler(const std::string filename) {
+//Safety size limit of 100KB for .cue text, from a file or from memory
+const size_t cueByteLimit = 102400;
+
+template <class EP, class SP>
+BasicCueHandler<EP, SP>::BasicCueHandler(const std::string filename) {
+	//Make sure the input filename is a valid .cue file. Exit if not
+	//Validate will end execution or warn if there are issues. Done first, so
+	//nothing is leaked if the error policy throws
+	validateCueFilename(filename);
+	
 	//Set the TeFiEd file object to the passed filename string
 	cueFile = new TeFiEd(filename);
 	
 	//Set safety size limit of 100KB
-	cueFile->setByteLimit(102400);
+	cueFile->setByteLimit(cueByteLimit);
 	
-	//Make sure the input filename is a valid .cue file. Exit if not
-	//Validate will end execution or warn if there are issues
-	validateCueFilename(filename);
-		
 	//Debug option
 	//cueFile->setVerbose(true);
 }
 
-CueHandler::~CueHandler() {
+template <class EP, class SP>
+BasicCueHandler<EP, SP>::BasicCueHandler() {
+	//No filename. The TeFiEd object is still needed for outputCueFile and
+	//memoryUsage, it just never holds a file
+	cueFile = new TeFiEd("");
+	cueFile->setByteLimit(cueByteLimit);
+}
+
+template <class EP, class SP>
+BasicCueHandler<EP, SP>::~BasicCueHandler() {
 	//Delete the TeFiEd object
 	delete cueFile;
 	
@@ -112,7 +179,8 @@ const std::string t_TRACK_str[] = {
 };
 
 /*** FILE Vector Functions ****************************************************/
-t_LINE CueHandler::LINEStrToType(const std::string lineStr) {	
+template <class EP, class SP>
+t_LINE BasicCueHandler<EP, SP>::LINEStrToType(const std::string &lineStr) {	
 	//If line is empty return EMPTY
 	if(lineStr.length() == 0) return t_LINE::EMPTY;
 
@@ -131,17 +199,21 @@ t_LINE CueHandler::LINEStrToType(const std::string lineStr) {
 	return t_LINE::INVALID; 
 }
 
-t_TRACK CueHandler::TRACKStrToType(const std::string trackStr) {
+template <class EP, class SP>
+t_TRACK BasicCueHandler<EP, SP>::TRACKStrToType(const std::string &trackStr) {
 	//The TRACK Type substring is the 3rd word
-	std::string typeStr = getWord(trackStr, 3);
-	
+	return TRACKWordToType(LineFields(trackStr)[3]);
+}
+
+template <class EP, class SP>
+t_TRACK BasicCueHandler<EP, SP>::TRACKWordToType(const StrView typeStr) {
 	//If the TRACK string is empty, this is extremely corrupt. force and error
-	if(typeStr == "") forceCueError(errStr::invalidTRACK);
+	if(typeStr.empty()) forceCueError(errStr::invalidTRACK);
 	
 	//Go through all elements in t_TRACK (MAX_TYPES)
 	for(int compType = 0; compType < (int)t_TRACK::MAX_TYPES; compType++) {
 		//If the input string and the //TODO TRACKType string match
-		if(typeStr.compare(t_TRACK_str[compType]) == 0) {
+		if(typeStr.equals(t_TRACK_str[compType])) {
 			//Return the matched type as enum int
 			return (t_TRACK)compType;
 		}
@@ -153,18 +225,34 @@ t_TRACK CueHandler::TRACKStrToType(const std::string trackStr) {
 	return t_TRACK::UNKNOWN;
 }
 
-t_FILE CueHandler::FILEStrToType(const std::string fileStr) {
+template <class EP, class SP>
+unsigned int BasicCueHandler<EP, SP>::IDWordToInt(const StrView idStr) {
+	//IDs are 01 to 99 in a .cue, a longer or non digit ID is corrupt
+	if(idStr.LEN == 0 || idStr.LEN > 2) forceCueError(errStr::invalidID);
+	
+	unsigned int id = 0;
+	for(size_t cChr = 0; cChr < idStr.LEN; cChr++) {
+		char chr = idStr.DATA[cChr];
+		if(chr < '0' || chr > '9') forceCueError(errStr::invalidID);
+		id = id * 10 + (unsigned int)(chr - '0');
+	}
+	
+	return id;
+}
+
+template <class EP, class SP>
+t_FILE BasicCueHandler<EP, SP>::FILEStrToType(const std::string &fileStr) {
 	//The FILE type string is after the last " in the string, to end of line.
-	std::string typeStr = substrNonEmpty(fileStr, fileStr.find_last_of("\"")+1, 
-	                                     fileStr.length());
+	StrView typeStr = trimView(fileStr, fileStr.find_last_of("\"") + 1,
+	                           fileStr.length());
 	
 	//If the FILE type string is empty, this is extremely corrupt. Force error
-	if(typeStr == "") forceCueError(errStr::invalidFILE);
+	if(typeStr.empty()) forceCueError(errStr::invalidFILE);
 	
 	//Go through all elements in t_FILE_str and string compare them to input
 	for(int compType = 0; compType < (int)t_FILE::MAX_TYPES; compType++) {
 		//If the input string and the TRACKType string match
-		if(typeStr.compare(t_FILE_str[compType]) == 0) {
+		if(typeStr.equals(t_FILE_str[compType])) {
 			//Return the matched type as enum int
 			return (t_FILE)compType;
 		}
@@ -177,7 +265,8 @@ t_FILE CueHandler::FILEStrToType(const std::string fileStr) {
 }
 
 /*** Type to String conversion ************************************************/
-std::string CueHandler::FILETypeToStr(const t_FILE fileType) {
+template <class EP, class SP>
+std::string BasicCueHandler<EP, SP>::FILETypeToStr(const t_FILE fileType) {
 	std::string typeOut;
 	
 	//Go through all elements in t_FILE and match it with input type
@@ -193,7 +282,8 @@ std::string CueHandler::FILETypeToStr(const t_FILE fileType) {
 	return typeOut;
 }
 
-std::string CueHandler::TRACKTypeToStr(const t_TRACK trackType) {
+template <class EP, class SP>
+std::string BasicCueHandler<EP, SP>::TRACKTypeToStr(const t_TRACK trackType) {
 	std::string typeOut;	
 	
 	//Go through all elements in t_TRACK_str (current type string)
@@ -201,7 +291,7 @@ std::string CueHandler::TRACKTypeToStr(const t_TRACK trackType) {
 		//If the input type matches type in enum 
 		if(trackType == (t_TRACK)compType) {
 			//Set the output string
-			typeOut = t_FILE_str[compType];
+			typeOut = t_TRACK_str[compType];
 		}
 	}
 	
@@ -210,8 +300,28 @@ std::string CueHandler::TRACKTypeToStr(const t_TRACK trackType) {
 }
 
 
+template <class EP, class SP>
+unsigned int BasicCueHandler<EP, SP>::TRACKSectorSize(const t_TRACK trackType) {
+	switch(trackType) {
+		case t_TRACK::CDG:
+			return 2448;
+		
+		case t_TRACK::MODE1_2048:
+			return 2048;
+		
+		case t_TRACK::MODE2_2336:
+		case t_TRACK::CDI_2336:
+			return 2336;
+		
+		//AUDIO, all raw data modes and UNKNOWN use the full 2352 byte sector
+		default:
+			return 2352;
+	}
+}
+
 /*** Data Validation functions. Returns specific error codes ******************/
-void CueHandler::validateCueFilename(std::string cueStr) {
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::validateCueFilename(std::string cueStr) {
 	size_t npos = std::string::npos;
 
 	//Make sure the file extension is .cue or .CUE 
@@ -220,7 +330,10 @@ void CueHandler::validateCueFilename(std::string cueStr) {
 	}
 }
 
-void CueHandler::validateFILE(const FileData &refFILE) {
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::validateFILE(const FileData &refFILE) {
+	CUE_METRICS_PHASE(metrics, t_PHASE::VALIDATE);
+	
 	//A file is invalid if:
 	//No FILENAME
 	if(refFILE.FILENAME == "") {
@@ -235,7 +348,10 @@ void CueHandler::validateFILE(const FileData &refFILE) {
 	}
 }
 
-void CueHandler::validateTRACK(const TrackData &refTRACK) {
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::validateTRACK(const TrackData &refTRACK) {
+	CUE_METRICS_PHASE(metrics, t_PHASE::VALIDATE);
+	
 	//A TRACK is invalid if:
 	//It is over the 99th TRACK in a file
 	if(refTRACK.ID > 99) {
@@ -249,25 +365,28 @@ void CueHandler::validateTRACK(const TrackData &refTRACK) {
 	}
 }
 
-void CueHandler::validateINDEX(const IndexData &refINDEX) {
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::validateINDEX(const IndexData &refINDEX) {
+	CUE_METRICS_PHASE(metrics, t_PHASE::VALIDATE);
+	
 	//An INDEX is invalid if:
 	//There are more than 99 of them in a TRACK
 	if(refINDEX.ID > 99) {
 		handleCueError(errStr::overINDEXMax);
 	}
 
-	//Check if BYTES is divisible by SECTOR size TODO
-	/*
-	if(refINDEX.BYTES % 2352 != 0) {
-		errorMsg(0, "validateINDEX",
-		         "INDEX BYTES not divisible by SECTOR size");
-		return 2;
+	//It is past 99:59:74, the last timestamp a .cue can hold
+	if(refINDEX.FRAMES >= 100 * 60 * 75) {
+		handleCueError(errStr::timeOverMax);
 	}
-	*/
 }
 
 /*** CUE Metadata structure Adding ********************************************/
-void CueHandler::pushFILE(const std::string FN, const t_FILE TYPE) {
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::pushFILE(const std::string FN,
+                                       const t_FILE TYPE) {
+	CUE_METRICS_PHASE(metrics, t_PHASE::PUSH);
+	
 	//Temporary FILE object
 	FileData tempFILE;
 	
@@ -276,13 +395,18 @@ void CueHandler::pushFILE(const std::string FN, const t_FILE TYPE) {
 	tempFILE.TYPE = TYPE;
 	
 	//Validate will end execution or warn if there are issues
-	validateFILE(tempFILE);
+	if(EP::VALIDATE) validateFILE(tempFILE);
 	
-	//Push tempFILE to the FILE vect
+	//Push tempFILE to the FILE vect, counting a vector growth as an allocation
+	CUE_METRICS_COUNT(metrics, allocations, FILE.size() == FILE.capacity());
 	FILE.push_back(tempFILE);
 }
 
-void CueHandler::pushTRACK(const unsigned int ID, const t_TRACK TYPE) {
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::pushTRACK(const unsigned int ID,
+                                        const t_TRACK TYPE) {
+	CUE_METRICS_PHASE(metrics, t_PHASE::PUSH);
+	
 	//Temporary TRACK object
 	TrackData tempTRACK;
 	//Set the TRACK Parameters
@@ -290,34 +414,55 @@ void CueHandler::pushTRACK(const unsigned int ID, const t_TRACK TYPE) {
 	tempTRACK.TYPE = TYPE;
 	
 	//Validate will end execution or warn if there are issues
-	validateTRACK(tempTRACK);
+	if(EP::VALIDATE) validateTRACK(tempTRACK);
 	
 	//Get a pointer to the last entry in the FILE object
 	FileData *pointerFILE = &FILE.back();
 	//Push the tempTRACK to the back of the pointer 
+	CUE_METRICS_COUNT(metrics, allocations,
+	    pointerFILE->TRACK.size() == pointerFILE->TRACK.capacity());
 	pointerFILE->TRACK.push_back(tempTRACK);
 }
 
-void CueHandler::pushINDEX(const unsigned int ID, const unsigned long BYTES) {
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::pushINDEXFrames(const unsigned int ID,
+                                              const uint32_t FRAMES) {
+	CUE_METRICS_PHASE(metrics, t_PHASE::PUSH);
+	
 	//Temporary INDEX object
 	IndexData tempINDEX;
 	//Set INDEX parameters
 	tempINDEX.ID = ID;
-	tempINDEX.BYTES = BYTES;
+	tempINDEX.FRAMES = FRAMES;
 	
 	//Validate will end execution or warn if there are issues
-	validateINDEX(tempINDEX);
+	if(EP::VALIDATE) validateINDEX(tempINDEX);
 	
 	//Get a pointer to the last FILE and TRACK Object
 	TrackData *pointerTRACK = &FILE.back().TRACK.back();
 	//Push the INDEX to the end of current file
+	CUE_METRICS_COUNT(metrics, allocations,
+	    pointerTRACK->INDEX.size() == pointerTRACK->INDEX.capacity());
 	pointerTRACK->INDEX.push_back(tempINDEX);
 }
 
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::pushINDEX(const unsigned int ID,
+                                        const unsigned long BYTES) {
+	//Error check if the input is divisible by a sector. Exit if not
+	if(BYTES % SP::SECTOR_BYTES != 0) forceCueError(errStr::sectByte);
+	
+	unsigned long long sectors = BYTES / SP::SECTOR_BYTES;
+	if(sectors > UINT32_MAX) forceCueError(errStr::timeOverMax);
+	
+	pushINDEXFrames(ID, (uint32_t)sectors);
+}
+
 /*** CUE String Generation ****************************************************/
-std::string CueHandler::generateFILELine(const FileData &refFILE) {
+template <class EP, class SP>
+std::string BasicCueHandler<EP, SP>::generateFILELine(const FileData &refFILE) {
 	//Validate will end execution or warn if there are issues
-	validateFILE(refFILE);
+	if(EP::VALIDATE) validateFILE(refFILE);
 	
 	std::string outputLine = "FILE ";
 	
@@ -331,9 +476,11 @@ std::string CueHandler::generateFILELine(const FileData &refFILE) {
 }
 	
 //Converts TrackData Object into a string which is a CUE file line
-std::string CueHandler::generateTRACKLine(const TrackData &refTRACK) {
+template <class EP, class SP>
+std::string
+BasicCueHandler<EP, SP>::generateTRACKLine(const TrackData &refTRACK) {
 	//Validate will end execution or warn if there are issues
-	validateTRACK(refTRACK);
+	if(EP::VALIDATE) validateTRACK(refTRACK);
 	
 	std::string outputLine = "  TRACK ";
 	
@@ -346,101 +493,177 @@ std::string CueHandler::generateTRACKLine(const TrackData &refTRACK) {
 }
 	
 //Converts IndexData Object into a string which is a CUE file line
-std::string CueHandler::generateINDEXLine(const IndexData &refINDEX) {
+template <class EP, class SP>
+std::string
+BasicCueHandler<EP, SP>::generateINDEXLine(const IndexData &refINDEX) {
 	//Validate will end execution or warn if there are issues
-	validateINDEX(refINDEX);
+	if(EP::VALIDATE) validateINDEX(refINDEX);
 	
 	std::string outputLine = "    INDEX ";
 	
 	//Append the INDEX ID (padded to 2 length) and a space
 	outputLine.append( padIntStr(refINDEX.ID, 2) + " ");
 	//Append the INDEX TIMESTAMP (string
-	outputLine.append( bytesToTimestamp(refINDEX.BYTES) );
+	outputLine.append( framesToTimestamp(refINDEX.FRAMES) );
 	
 	return outputLine;
 }
 
 /*** CUE Data handling ********************************************************/
-std::string CueHandler::getFilenameFromLine(const std::string line) {
-
-	//Get the First and last quote in the string
-	size_t fQuote = line.find('\"') + 1;
-	size_t lQuote = line.find('\"', fQuote);
-	
-	//If the last quote is npos (could detect on first too, but may be slower)
-	if(lQuote == std::string::npos) forceCueError(errStr::noFilename);
+template <class EP, class SP>
+std::string
+BasicCueHandler<EP, SP>::getFilenameFromLine(const std::string &line) {
+	//The FILENAME is the first quoted word, spaces and all
+	LineFields fields(line, " \t\r", true);
+	if(fields.badQuote()) forceCueError(errStr::noFilename);
+	
+	for(size_t cWord = 1; cWord <= fields.size(); cWord++) {
+		if(fields.quoted(cWord)) return fields[cWord].str();
+	}
 	
-	//Return a substring of the input fron fQuote, of size first - last 
-	return line.substr(fQuote, lQuote - fQuote);
+	//No quotes at all
+	forceCueError(errStr::noFilename);
+	return "";
 }
 
 
-void CueHandler::getCueData() {
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::getCueData() {
 	//Clean the FILE vector RAM
 	FILE.clear();
 	FILE.shrink_to_fit();
 
 	//Read in the .cue file, with error handling
-	if(cueFile->read() != 0) exit(EXIT_FAILURE); 
+	{
+		CUE_METRICS_PHASE(metrics, t_PHASE::READ);
+		if(cueFile->read() != 0) forceCueError(errStr::readFail);
+		CUE_METRICS_COUNT(metrics, bytesRead, cueFile->bytes());
+	}
 	
 	//Make sure the Line Ending type is Unix, not DOS
-	cueFile->convertLineEnding(LineEnding::Unix);
+	{
+		CUE_METRICS_PHASE(metrics, t_PHASE::LINE_ENDING);
+		cueFile->convertLineEnding(LineEnding::Unix);
+	}
 
 	//Go through all the lines in the cue file.
 	for(size_t lineNum = 1; lineNum <= cueFile->lines(); lineNum++) {
-		//Copy the current line to a new string
-		std::string cLineStr = cueFile->getLine(lineNum);
+		CUE_METRICS_COUNT(metrics, lines, 1);
+		
+		//The line is parsed where it is stored, without a copy
+		parseCueLine(cueFile->getLine(lineNum));
+	}
+}
+
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::parseCueData(const char *text,
+                                           const size_t len) {
+	//Clean the FILE vector RAM
+	FILE.clear();
+	FILE.shrink_to_fit();
+	
+	if(len > cueByteLimit) forceCueError(errStr::cueTooLarge);
+	CUE_METRICS_COUNT(metrics, bytesRead, len);
+	
+	//Split the text into lines in place. One string is reused for every line,
+	//so only the line being parsed is ever copied
+	std::string cLineStr;
+	size_t lineStart = 0;
+	while(lineStart < len) {
+		const char *lineEnd = (const char *)memchr(text + lineStart, '\n',
+		                                           len - lineStart);
+		size_t lineLen = len - lineStart;
+		if(lineEnd != nullptr) lineLen = (size_t)(lineEnd - text) - lineStart;
 		
-		//Get the type of the current line
-		t_LINE cLineType = LINEStrToType(cLineStr);
+		//Same as getCueData converting DOS line endings to Unix
+		size_t textLen = lineLen;
+		if(textLen != 0 && text[lineStart + textLen - 1] == 0x0D) --textLen;
 		
-		//If the current line is invalid, exit with error message
-		if(cLineType == t_LINE::INVALID) forceCueError(errStr::invalidCmd);
+		CUE_METRICS_COUNT(metrics, lines, 1);
+		cLineStr.assign(text + lineStart, textLen);
+		parseCueLine(cLineStr);
 		
-		//If the current line is a REM command
-		if(cLineType == t_LINE::REM) {
-			//TODO Decide what to do with REMARKS
-			//std::cout << "REMARK at line: " << lineNo << "\t message: " <<
-			//cLineStr << std::endl;
+		lineStart += lineLen + 1;
+	}
+}
+
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::parseCueLine(const std::string &cLineStr) {
+	//Get the type of the current line
+	t_LINE cLineType;
+	{
+		CUE_METRICS_PHASE(metrics, t_PHASE::CLASSIFY);
+		cLineType = LINEStrToType(cLineStr);
+	}
+	
+	//If the current line is invalid, exit with error message
+	if(cLineType == t_LINE::INVALID) forceCueError(errStr::invalidCmd);
+	
+	//If the current line is a REM command
+	if(cLineType == t_LINE::REM) {
+		//TODO Decide what to do with REMARKS
+		//std::cout << "REMARK at line: " << lineNo << "\t message: " <<
+		//cLineStr << std::endl;
+	}
+	
+	//If the current line is a FILE command
+	if(cLineType == t_LINE::FILE) {
+		//Get the FILE type string, and the FILENAME String
+		t_FILE fileType;
+		std::string fileName;
+		{
+			CUE_METRICS_PHASE(metrics, t_PHASE::EXTRACT);
+			fileType = FILEStrToType(cLineStr);
+			fileName = getFilenameFromLine(cLineStr);
 		}
 		
-		//If the current line is a FILE command
-		if(cLineType == t_LINE::FILE) {
-			//Get the FILE type string, and the FILENAME String
-			t_FILE fileType = FILEStrToType(cLineStr);
-			std::string fileName = getFilenameFromLine(cLineStr);
-			
-			//push new FILE to the stack
-			pushFILE(fileName, fileType);
+		//push new FILE to the stack
+		pushFILE(fileName, fileType);
+	}
+	
+	//If the current line is a TRACK command
+	if(cLineType == t_LINE::TRACK) {
+		//Make sure a FILE is availible to push to
+		if(FILE.empty() == true) forceCueError(errStr::badPushTrack);
+	
+		//Get ID (second word), and TYPE (third word). Split only once
+		unsigned int lineID;
+		t_TRACK lineTYPE;
+		{
+			CUE_METRICS_PHASE(metrics, t_PHASE::EXTRACT);
+			LineFields fields(cLineStr);
+			lineID = IDWordToInt(fields[2]);
+			lineTYPE = TRACKWordToType(fields[3]);
 		}
 		
-		//If the current line is a TRACK command
-		if(cLineType == t_LINE::TRACK) {
-			//Make sure a FILE is availible to push to
-			if(FILE.empty() == true) forceCueError(errStr::badPushTrack);
+		//Push new TRACK to the FILE vector
+		pushTRACK(lineID, lineTYPE);
+	}
+	
+	//INDEX line type	
+	if(cLineType == t_LINE::INDEX) {
+		//Make sure a TRACK is availible to push to
+		if(FILE.back().TRACK.empty() == true) {
+			forceCueError(errStr::badPushIndex);
+		}
 		
-			//Get ID (second word), and TYPE
-			unsigned int lineID = std::stoi(getWord(cLineStr, 2));
-			t_TRACK lineTYPE = TRACKStrToType(cLineStr);
-			
-			//Push new TRACK to the FILE vector
-			pushTRACK(lineID, lineTYPE);
+		//Get ID (second word), and timestamp (third word). Both are read
+		//from the line in place, nothing is copied
+		LineFields fields(cLineStr);
+		unsigned int lineID;
+		{
+			CUE_METRICS_PHASE(metrics, t_PHASE::EXTRACT);
+			lineID = IDWordToInt(fields[2]);
 		}
 		
-		//INDEX line type	
-		if(cLineType == t_LINE::INDEX) {
-			//Make sure a TRACK is availible to push to
-			if(FILE.back().TRACK.empty() == true) {
-				forceCueError(errStr::badPushIndex);
-			}
-			
-			//Get ID (second word), and timestamp (third word)
-			unsigned int lineID = std::stoi(getWord(cLineStr, 2));
-			unsigned long lineBytes = timestampToBytes(getWord(cLineStr, 3));
-			
-			//Push new INDEX to TRACK sub-vector
-			pushINDEX(lineID, lineBytes);
+		uint32_t lineFrames;
+		{
+			CUE_METRICS_PHASE(metrics, t_PHASE::TIMESTAMP);
+			lineFrames = timestampToFrames(fields[3]);
 		}
+		
+		//Push new INDEX to TRACK sub-vector
+		pushINDEXFrames(lineID, lineFrames);
 	}
 }
 
@@ -482,7 +705,8 @@ int CueHandler::combineCueFiles(CueHandler &combined, const std::string outBin,
 }
 */
 
-void CueHandler::outputCueFile() {
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::outputCueFile() {
 	//Try to create a new TeFiEd file. Exit if not
 	if(cueFile->create() != 0) forceCueError(errStr::createFail);
 	
@@ -515,162 +739,270 @@ void CueHandler::outputCueFile() {
 	
 	//Write the cue data to the file
 	cueFile->overwrite();
+	CUE_METRICS_COUNT(metrics, bytesWritten, cueFile->bytes());
 }
 
-void CueHandler::printFILE(FileData & pFILE) {
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::printFILE(const FileData & pFILE) {
 	//Check if pFILE is empty, error if attempted read from empty
 	if(pFILE.FILENAME.empty()) forceCueError(errStr::fileEmpty);
 
-	//Print filename and data
-	std::cout << "FILENAME: " << pFILE.FILENAME;
-	std::cout << "\t\tTYPE: " << t_FILE_str[(int)pFILE.TYPE] << "\n";
-	//Seperator
-	std::cout << "----------------------------------------------------------\n";
+	//Render the FILE into a buffer, which is written to cout in one go when
+	//the formatter goes out of scope
+	StreamSink sink(std::cout);
+	CueFormatter formatter(sink, t_FORMAT::TEXT);
+	formatter.setSectorBytes(SP::SECTOR_BYTES);
+	formatter.writeFILE(pFILE);
+}
+
+/*** Memory Accounting ********************************************************/
+template <class EP, class SP>
+MemoryUsage BasicCueHandler<EP, SP>::memoryUsage() {
+	MemoryUsage usage;
+	
+	//The TeFiEd object itself is heap allocated, plus everything it holds
+	usage.heapBytes += sizeof(TeFiEd);
+	++usage.allocations;
+	usage += cueFile->memoryUsage();
+	
+	//Go through every FILE, TRACK and INDEX vector
+	usage.addVector(FILE);
+	for(size_t cFile = 0; cFile < FILE.size(); cFile++) {
+		const FileData &pFILE = FILE[cFile];
+		usage.addString(pFILE.FILENAME);
+		usage.addVector(pFILE.TRACK);
+		
+		for(size_t cTrack = 0; cTrack < pFILE.TRACK.size(); cTrack++) {
+			usage.addVector(pFILE.TRACK[cTrack].INDEX);
+		}
+	}
+	
+	return usage;
+}
+
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::compact() {
+	//Release all the .cue text, the data has been parsed into FILE already
+	cueFile->flush();
+	
+	//Shrink every vector and FILENAME string to fit their data
+	FILE.shrink_to_fit();
+	for(size_t cFile = 0; cFile < FILE.size(); cFile++) {
+		FileData &pFILE = FILE[cFile];
+		pFILE.FILENAME.shrink_to_fit();
+		pFILE.TRACK.shrink_to_fit();
+		
+		for(size_t cTrack = 0; cTrack < pFILE.TRACK.size(); cTrack++) {
+			pFILE.TRACK[cTrack].INDEX.shrink_to_fit();
+		}
+	}
+}
+
+/*** Snapshots ****************************************************************/
+CueModel &CueSnapshot::edit() {
+	//Someone else may still read this model, give this snapshot its own
+	if(m_owned.load(std::memory_order_relaxed) == false) {
+		m_model = std::make_shared <CueModel>(*m_model);
+		m_owned.store(true, std::memory_order_relaxed);
+	}
+	
+	return *m_model;
+}
+
+template <class EP, class SP>
+CueSnapshot BasicCueHandler<EP, SP>::snapshot() const {
+	CueModel model;
+	model.CUE_PATH = cueFile->filename();
+	model.BIN_DIR = cueFile->parentDir();
+	model.FILE = FILE;
+	
+	return CueSnapshot(std::move(model));
+}
+
+template <class EP, class SP>
+void BasicCueHandler<EP, SP>::restore(const CueSnapshot &snap) {
+	FILE = snap->FILE;
+}
 
-	//Print all TRACKs in vector held by FILE
-	for(size_t tIdx = 0; tIdx < pFILE.TRACK.size(); tIdx++) {
-		//Set TrackData object to point to current TRACK
-		TrackData pTRACK = pFILE.TRACK[tIdx];
+/*** Track Spans **************************************************************/
+template <class EP, class SP>
+std::vector <TrackSpan> BasicCueHandler<EP, SP>::getTrackSpans() {
+	std::vector <TrackSpan> spans;
+	
+	//Bin files are relative to the directory of the .cue file
+	std::string binDir = cueFile->parentDir();
+	
+	for(size_t cFile = 0; cFile < FILE.size(); cFile++) {
+		const FileData &pFILE = FILE[cFile];
+		std::string binPath = binDir + pFILE.FILENAME;
 		
-		//Print track number (TrackIndex + 1 to not have 00 track) and PREGAP:
-		std::cout << "TRACK " << padIntStr(pTRACK.ID, 2);
+		//Get the size of the bin file, the last TRACK ends there
+		unsigned long long fileBytes = 0;
+		std::ifstream binFile(binPath, std::ios::in | std::ios::binary
+		                      | std::ios::ate);
+		if(binFile.is_open()) {
+			fileBytes = (unsigned long long)binFile.tellg();
+		} else {
+			handleCueError(errStr::binMissing);
+		}
 		
-		//Print TRACK TYPE variable
-		std::cout << "        TYPE: " << t_TRACK_str[(int)pTRACK.TYPE] << "\n";
+		//Index of the first span belonging to this FILE
+		size_t firstSpan = spans.size();
 		
-		//Print all INDEXs contained in that TRACK
-		for(size_t iIdx  = 0; iIdx < pTRACK.INDEX.size(); iIdx++) {
-			IndexData pINDEX = pFILE.TRACK[tIdx].INDEX[iIdx];
+		//INDEX FRAMES count sectors, and each TRACK stores its sectors in its
+		//own size. So a TRACK starts after the bytes of the TRACKs before it
+		unsigned long long offset = 0;
+		uint32_t prevFrame = 0;
+		unsigned int prevSize = 0;
+		bool started = false;
+		
+		for(size_t cTrack = 0; cTrack < pFILE.TRACK.size(); cTrack++) {
+			const TrackData &pTRACK = pFILE.TRACK[cTrack];
+			
+			TrackSpan span;
+			span.PATH = binPath;
+			span.ID = pTRACK.ID;
+			span.TYPE = pTRACK.TYPE;
+			
+			//The TRACK starts at its first INDEX (the pregap if there is one)
+			if(pTRACK.INDEX.empty() == false) {
+				uint32_t frame = pTRACK.INDEX.front().FRAMES;
+				unsigned int size = TRACKSectorSize(pTRACK.TYPE);
+				
+				if(started == false) {
+					offset = pTRACK.INDEX.front().bytes(size);
+					started = true;
+				} else if(frame > prevFrame) {
+					unsigned long long frames = frame - prevFrame;
+					offset += frames * prevSize;
+				}
+				
+				span.START = offset;
+				prevFrame = frame;
+				prevSize = size;
+			}
 			
-			//Print the index number
-			std::cout << "  INDEX " << padIntStr(pINDEX.ID, 2)
-			//Print the raw BYTES format 
-			<< "    BYTES: " << padIntStr(pINDEX.BYTES, 9, ' ')
-			//Print the timestamp version
-			<< "    TIMESTAMP: " << bytesToTimestamp(pINDEX.BYTES) << "\n";
+			spans.push_back(span);
 		}
 		
-		//Print a blank line to split the TRACK fields and flush the buffer
-		std::cout << std::endl;
+		//Each TRACK ends where the next one starts, the last at end of file
+		for(size_t cSpan = firstSpan; cSpan < spans.size(); cSpan++) {
+			unsigned long long end = fileBytes;
+			if(cSpan + 1 < spans.size()) end = spans[cSpan + 1].START;
+			
+			//Never allow a span to run backwards or past the end of the file
+			if(end > fileBytes) end = fileBytes;
+			if(end < spans[cSpan].START) end = spans[cSpan].START;
+			spans[cSpan].END = end;
+		}
 	}
+	
+	return spans;
 }
 
 /** Helper Functions **********************************************************/
 /*******************************************************************************
-The timestamp is in Minute:Second:Frame format.
-There are 75 sectors per second, 2352 bytes per sector. If any number of bytes 
-is not divisible by the sector size, it is a malformed or corrupted dump, so
-the program will print an error message and exit.
+The timestamp is in Minute:Second:Frame format, with 75 frames (sectors) per
+second. INDEXs are kept as frames, so only bytesToTimestamp and
+timestampToBytes use SP::SECTOR_BYTES (2352 for RawSectors). If any number of
+bytes is not divisible by the sector size, it is a malformed or corrupted dump,
+so the program will print an error message and exit.
 
 Throughout this code I am trying to use divide numbers, then do modulo ops in 
 that order so the compiler stands some chance of optimizing, useing the 
 remainder of the ASM div operator.
 *******************************************************************************/
-std::string CueHandler::bytesToTimestamp(const unsigned long bytes) {
-	//There are 2352 byte per sector. Calculate how many sectors are in the file
-	unsigned long sectors = bytes / 2352;
-	
-	//Error check if the input is divisible by a sector. Exit if not
-	if(bytes % 2352 != 0) forceCueError(errStr::sectByte);
-	
-	//75 sectors per second. Frames are the left over sectors from a second
-	unsigned short seconds = sectors / 75;
-	unsigned short rFrames = sectors % 75;
+template <class EP, class SP>
+std::string BasicCueHandler<EP, SP>::framesToTimestamp(const uint32_t frames) {
+	//75 frames per second. rFrames are the left over frames from a second
+	unsigned long seconds = frames / 75;
+	unsigned short rFrames = frames % 75;
 	
 	//Convert seconds to minutes. Seconds is the remainder of itself after / 60
-	unsigned short minutes = seconds / 60;
+	unsigned long minutes = seconds / 60;
 	seconds = seconds % 60;
 	
 	//If minutes exceeds 99, there is probably an error due to Audio CD Standard
 	if(minutes > 99) forceCueError(errStr::timeOverMax);
 	
-	std::string timestamp;
-	//Now the string can be formed from the values. Need to 0 pad each value
-	timestamp.append(padIntStr(minutes, 2) + ":" + padIntStr(seconds, 2)
-	                           + ":" + padIntStr(rFrames, 2));
+	//Every field is two digits, so the string is built in place
+	char timestamp[8] = {
+		(char)('0' + minutes / 10), (char)('0' + minutes % 10), ':',
+		(char)('0' + seconds / 10), (char)('0' + seconds % 10), ':',
+		(char)('0' + rFrames / 10), (char)('0' + rFrames % 10)
+	};
 	
-	return timestamp;
+	return std::string(timestamp, sizeof(timestamp));
 }
 
-unsigned long CueHandler::timestampToBytes(const std::string timestamp) {
-	//Make sure the string input is long enough to have xx:xx:xx timestamp
-	if(timestamp.length() != 8) forceCueError(errStr::timestampLength);
+template <class EP, class SP>
+uint32_t
+BasicCueHandler<EP, SP>::timestampToFrames(const std::string &timestamp) {
+	return timestampToFrames(StrView(timestamp.data(), timestamp.size()));
+}
 
-	//Strip values from the timestamp. "MM:SS:ff" ff = sectors
-	unsigned short minutes = std::stoi(timestamp.substr(0, 2));
-	unsigned short seconds = std::stoi(timestamp.substr(3, 2));
-	unsigned short frames  = std::stoi(timestamp.substr(6, 2));
-	
-	//Add minutes to the seconds for sector calculation
-	seconds += (minutes * 60);
-	
-	//75 sectors per second, plus frames left over in the timestamp	
-	unsigned long sectors = (seconds * 75) + frames;
-	
-	//There are 2352 bytes per sector.
-	unsigned long bytes = sectors * 2352;
+template <class EP, class SP>
+uint32_t BasicCueHandler<EP, SP>::timestampToFrames(const StrView timestamp) {
+	//Make sure the string input is long enough to have xx:xx:xx timestamp
+	if(timestamp.LEN != 8) forceCueError(errStr::timestampLength);
+	
+	//"MM:SS:ff", ff = frames. Read the digit pairs directly
+	const char *str = timestamp.DATA;
+	for(int cChr = 0; cChr < 8; cChr++) {
+		bool colon = (cChr == 2 || cChr == 5);
+		bool digit = (str[cChr] >= '0' && str[cChr] <= '9');
+		if(colon ? str[cChr] != ':' : digit == false) {
+			forceCueError(errStr::timestampFormat);
+		}
+	}
 	
-	//Error check if the input is divisible by a sector. Exit if not
-	if(bytes % 2352 != 0) forceCueError(errStr::sectByte);
+	uint32_t minutes = (uint32_t)(str[0] - '0') * 10 + (uint32_t)(str[1] - '0');
+	uint32_t seconds = (uint32_t)(str[3] - '0') * 10 + (uint32_t)(str[4] - '0');
+	uint32_t frames = (uint32_t)(str[6] - '0') * 10 + (uint32_t)(str[7] - '0');
 	
-	return bytes;
+	//75 frames per second, plus frames left over in the timestamp
+	return (minutes * 60 + seconds) * 75 + frames;
 }
 
-//Coppied from TeFiEd to avoid static class methods
-std::string CueHandler::getWord(const std::string input, unsigned int index) {
-	//If index is 0, set it to 1. always 1 indexed
-	if(index == 0) index = 1;
-	
-	//Create output string object
-	std::string output;
-	
-	//Start and end of word, and current word found.
-	size_t wordStart = 0, wordEnd = 0, wordIndex = 0;
+template <class EP, class SP>
+std::string
+BasicCueHandler<EP, SP>::bytesToTimestamp(const unsigned long long bytes) {
+	//Error check if the input is divisible by a sector. Exit if not
+	if(bytes % SP::SECTOR_BYTES != 0) forceCueError(errStr::sectByte);
 	
-	//Find the start and end of a word
-	do {
-		//Get the start and end of a word, detected by delims 
-		wordStart = input.find_first_not_of(" \t\r", wordEnd);	
-		wordEnd = input.find_first_of(" \t\r", wordStart);
-		
-		//wordEnd can be allowed to overflow, but wordStart cannot.
-		if(wordStart != std::string::npos) {
-			//Incriment word index.
-			++wordIndex;
-			
-			//If this index is the one requested, set output
-			if(wordIndex == index) {
-				output = input.substr(wordStart, wordEnd - wordStart);
-				break;
-			}
-		}
-	} while(wordStart < input.size());	
+	unsigned long long sectors = bytes / SP::SECTOR_BYTES;
+	if(sectors > UINT32_MAX) forceCueError(errStr::timeOverMax);
 	
-	//If the index could not be found, return an empty string
-	if(wordIndex < index) return "";
-	return output;
+	return framesToTimestamp((uint32_t)sectors);
 }
 
-//Pass a string, start and end pos, returns substring of input, ignoring spaces
-std::string CueHandler::substrNonEmpty(std::string input, size_t s, size_t e) {
-	//If the input is empty, return empty
-	if(input.empty() == true) return "";
-	
-	//If end pos is greater than the string length, set it to the length
-	if(e > input.length()) e = input.length();
+template <class EP, class SP>
+unsigned long long
+BasicCueHandler<EP, SP>::timestampToBytes(const std::string timestamp) {
+	//There are SP::SECTOR_BYTES bytes per sector.
+	return (unsigned long long)timestampToFrames(timestamp) * SP::SECTOR_BYTES;
+}
 
-	//Overwrite s and e with the non-empty char positions
-	//Find the first non-empty char starting from start pos
-	s = input.find_first_not_of("\t ", s);
-	//Find the last non-empty char starting from end pos. +1 to align correctly
-	e = input.find_last_not_of("\t ", e) + 1;
-	
-	//Return a substring from the new start pos, to (end - start) length
-	return input.substr(s, e - s);
+//Same words as TeFiEd::getWord, split on spaces, tabs and CR only
+template <class EP, class SP>
+std::string BasicCueHandler<EP, SP>::getWord(const std::string &input,
+                                             unsigned int index) {
+	//Empty string if the index could not be found
+	return LineFields(input)[index].str();
 }
 
-std::string CueHandler::padIntStr(const unsigned long val, 
-                                  const unsigned int len, const char pad) {
+//Pass a string, start and end pos, returns substring of input, ignoring spaces
+template <class EP, class SP>
+std::string BasicCueHandler<EP, SP>::substrNonEmpty(const std::string &input,
+                                                    size_t s,
+                                                    size_t e) {
+	return trimView(input, s, e).str();
+}
+
+template <class EP, class SP>
+std::string BasicCueHandler<EP, SP>::padIntStr(const unsigned long val,
+                                               const unsigned int len,
+                                               const char pad) {
 	std::string intStr = std::to_string(val);
 	
 	//Pad the int string if length wanted is less than current length
@@ -682,3 +1014,9 @@ std::string CueHandler::padIntStr(const unsigned long val,
 	
 	return intStr;
 }
+
+/*** Instantiations ***********************************************************/
+template class BasicCueHandler <RuntimeErrors, RawSectors>;
+template class BasicCueHandler <StrictErrors, RawSectors>;
+template class BasicCueHandler <TrustedInput, RawSectors>;
+template class BasicCueHandler <RecoverableErrors, RawSectors>;
@@ -10,11 +10,17 @@
 * (c) ADBeta
 *******************************************************************************/
 
+#include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "TeFiEd.hpp"
+#include "CueMetrics.hpp"
 
 #ifndef CUE_HANDLER_H
 #define CUE_HANDLER_H
@@ -45,14 +51,20 @@ enum class t_TRACK {
 };
 
 //Strings of respective types mapped to enum values
-//extern const std::string t_FILE_str[];
-//extern const std::string t_TRACK_str[];
+extern const std::string t_FILE_str[];
+extern const std::string t_TRACK_str[];
 
 /*** Cue file data structs ****************************************************/
-//Grandchild INDEX (3rd level)
+//Grandchild INDEX (3rd level). 8 bytes, however wide long is
 struct IndexData {
 	unsigned int ID = 0; //Index ID (max 99)
-	unsigned long BYTES = 0; //Offset bytes (MM:SS:FF in the .cue file)
+	uint32_t FRAMES = 0; //Offset in sectors (MM:SS:FF in the .cue file)
+	
+	//Offset in bytes, for a TRACK with -sectorBytes- bytes per sector. 64 bit
+	//so positions past 4GB are not cut short on 32-bit systems
+	uint64_t bytes(const unsigned long sectorBytes = 2352) const {
+		return (uint64_t)FRAMES * sectorBytes;
+	}
 };
 
 //Child TRACK (2nd level)
@@ -69,36 +81,215 @@ struct FileData {
 	std::vector <TrackData> TRACK; //Vector of TRACKS in FILE (max 99)
 };
 
+//Byte range a TRACK occupies inside its bin file. Resolved by getTrackSpans()
+struct TrackSpan {
+	std::string PATH; //Path to the bin file (the .cue's directory + FILENAME)
+	unsigned int ID = 0; //TRACK ID
+	t_TRACK TYPE = t_TRACK::UNKNOWN; //TRACK type, decides the sector layout
+	unsigned long long START = 0; //First byte (first INDEX, includes pregap)
+	unsigned long long END = 0; //One byte past the last byte of the TRACK
+};
+
+/*** Snapshots ****************************************************************/
+//Everything parsed from a .cue file, without the text or the error state
+struct CueModel {
+	std::string CUE_PATH; //Path of the .cue file it was read from
+	std::string BIN_DIR; //Directory the bin FILENAMEs are relative to
+	std::vector <FileData> FILE; //Same layout as CueHandler::FILE
+};
+
+//Reference counted, read-only CueModel. Copying a snapshot only shares the
+//model, and a shared model never changes, so any number of threads can read
+//their own copies without locks. edit() copies the model first unless this
+//snapshot has held it alone since it was made (copy-on-write), so other
+//holders never see the change. use_count() is not used to decide, as seeing 1
+//does not order another thread's earlier reads before the write.
+//A single CueSnapshot object is not safe to copy and edit() at the same time
+class CueSnapshot {
+	public:
+	//An empty snapshot, with no FILEs
+	CueSnapshot() : m_model(std::make_shared <CueModel>()), m_owned(true) { }
+	
+	//Take ownership of a model
+	explicit CueSnapshot(CueModel model)
+	  : m_model(std::make_shared <CueModel>(std::move(model))),
+	    m_owned(true) { }
+	
+	//Copies share the model, so neither side owns it any more
+	CueSnapshot(const CueSnapshot &other)
+	  : m_model(other.m_model), m_owned(false) {
+		other.m_owned.store(false, std::memory_order_relaxed);
+	}
+	
+	CueSnapshot &operator=(const CueSnapshot &other) {
+		if(this == &other) return *this;
+		
+		m_model = other.m_model;
+		m_owned.store(false, std::memory_order_relaxed);
+		other.m_owned.store(false, std::memory_order_relaxed);
+		return *this;
+	}
+	
+	//Moving hands the model (and its ownership) over
+	CueSnapshot(CueSnapshot &&other)
+	  : m_model(std::move(other.m_model)),
+	    m_owned(other.m_owned.load(std::memory_order_relaxed)) {
+		other.m_owned.store(false, std::memory_order_relaxed);
+	}
+	
+	CueSnapshot &operator=(CueSnapshot &&other) {
+		if(this == &other) return *this;
+		
+		m_model = std::move(other.m_model);
+		m_owned.store(other.m_owned.load(std::memory_order_relaxed),
+		              std::memory_order_relaxed);
+		other.m_owned.store(false, std::memory_order_relaxed);
+		return *this;
+	}
+	
+	//Read-only access to the model
+	const CueModel &model() const { return *m_model; }
+	const CueModel *operator->() const { return m_model.get(); }
+	
+	//Number of snapshots sharing this model. Only a hint when other threads
+	//hold copies
+	long useCount() const { return m_model.use_count(); }
+	
+	//Writable model held only by this snapshot
+	CueModel &edit();
+	
+	private:
+	//Only ever handed out as const while it may be shared
+	std::shared_ptr <CueModel> m_model;
+	
+	//True while no other snapshot has ever shared m_model. Cleared on both
+	//sides of a copy, so it can be cleared through a const source
+	mutable std::atomic <bool> m_owned;
+};
+
+
+
+/*** Policies *****************************************************************/
+/*	BasicCueHandler takes an error policy and a sector geometry policy as
+	template arguments, so checks a use case does not need cost nothing.
+	
+	Error policy:
+		VALIDATE	push*() and generate*Line() run validate*() when true
+		handle()	Called by handleCueError() with strictLevel and the message
+		fatal()		Called by forceCueError() for errors parsing cannot go on
+					from. Must exit or throw, never return
+	
+	Sector geometry policy:
+		SECTOR_BYTES	Bytes per sector for byte <-> timestamp conversion    */
+
+//Default. Validates everything, strictLevel decides ignore, warn or exit
+struct RuntimeErrors {
+	static const bool VALIDATE = true;
+	static void handle(const unsigned char strictLevel, const char *msg);
+	static void fatal(const char *msg);
+};
+
+//Validates everything, and any error exits no matter the strictLevel
+struct StrictErrors {
+	static const bool VALIDATE = true;
+	static void handle(const unsigned char strictLevel, const char *msg);
+	static void fatal(const char *msg);
+};
+
+//For cue data from our own tools. Validation is compiled out, errors ignored
+struct TrustedInput {
+	static const bool VALIDATE = false;
+	static void handle(const unsigned char, const char *) { }
+	static void fatal(const char *msg);
+};
+
+//Thrown by RecoverableErrors. what() is the error message
+struct CueError : public std::runtime_error {
+	explicit CueError(const char *msg) : std::runtime_error(msg) { }
+};
+
+//For programs that must outlive a bad .cue (e.g. watching a library). Like
+//RuntimeErrors, but every error that would exit throws a CueError instead
+struct RecoverableErrors {
+	static const bool VALIDATE = true;
+	static void handle(const unsigned char strictLevel, const char *msg);
+	static void fatal(const char *msg) { throw CueError(msg); }
+};
 
+//Raw 2352 byte sectors, the sector size every INDEX timestamp is based on
+struct RawSectors {
+	static const unsigned long SECTOR_BYTES = 2352;
+};
 
 /*** CueHandler Class *********************************************************/
-class CueHandler {
+template <class ErrorPolicy, class SectorPolicy>
+class BasicCueHandler {
 	public:
 	//Constructor takes a filename and passes it to the TeFiEd file object
 	//Also creates the data structure array
-	CueHandler(const std::string filename);
+	BasicCueHandler(const std::string filename);
+	
+	//Constructor without a .cue file, for cue data held in memory (see
+	//parseCueData). Bin files are then relative to the working directory, and
+	//outputCueFile has no file to write to
+	BasicCueHandler();
 	
 	//Destructor, deletes data structure array and cleans up the TeFiEd object
-	~CueHandler();
+	~BasicCueHandler();
 	
 	
 	//Vector of FILEs. Cue Data is stored in this nested vector (INDEX & TRACK)
 	std::vector <FileData> FILE;
 	
+	#ifdef CUE_METRICS
+	//Per-phase timers and counters. Not a member at all without CUE_METRICS,
+	//so a plain build carries none of it
+	CueMetrics metrics;
+	#endif
+	
 	/*** Input / Output CUE Handling ******************************************/
 	//Gets the FILENAME from a FILE line string
-	std::string getFilenameFromLine(const std::string line);
+	std::string getFilenameFromLine(const std::string &line);
 	
 	//Gets all the data from a .cue file and populates the FILE vector.
 	void getCueData();
 	
+	//Populates the FILE vector from .cue text in memory (e.g. from an archive
+	//or a network request), the same way getCueData does from a file. The
+	//text is only borrowed for the call, and no file is opened
+	void parseCueData(const char *text, const size_t len);
+	void parseCueData(const StrView text) { parseCueData(text.DATA, text.LEN); }
+	
+	//Returns a read-only snapshot of the FILE data (after getCueData), to be
+	//shared between threads. Later changes to FILE do not affect it
+	CueSnapshot snapshot() const;
+	
+	//Replace the FILE data with the data of a snapshot, e.g. to output an
+	//edited snapshot with outputCueFile
+	void restore(const CueSnapshot &snap);
+	
 	//Output internal .cue data to the cueFile
 	void outputCueFile();
 	
-	//Prints the TRACK and INDEX data of the FileData struct passed.
-	void printFILE(FileData &);
+	//Prints the TRACK and INDEX data of the FileData struct passed. Use a
+	//CueFormatter (CueFormat.hpp) for JSON/CSV, or to print somewhere else
+	void printFILE(const FileData &);
+	
+	//Returns the byte range of every TRACK inside its bin file. A TRACK ends
+	//where the next TRACK in the same FILE starts, or at the end of the file.
+	std::vector <TrackSpan> getTrackSpans();
+	
+	/*** Memory Accounting ****************************************************/
+	//Returns the heap bytes, capacity slack and allocations held by the FILE
+	//vector (and all its children), and the TeFiEd object.
+	MemoryUsage memoryUsage();
+	
+	//Trims every vector and string in the FILE data to fit, and releases the
+	//TeFiEd text. Call once parsing is done; outputCueFile still works after.
+	void compact();
 		
 	/*** Validation functions. calls handleCueError if fails ******************/
+	//push*() and generate*Line() only call these if ErrorPolicy::VALIDATE
 	//Validate an input .cue file string (argv[1])
 	void validateCueFilename(std::string);
 	
@@ -118,7 +309,12 @@ class CueHandler {
 	//Push a new TRACK to the last entry in FILE[]
 	void pushTRACK(const unsigned int ID, const t_TRACK TYPE);
 	
-	//Push a new INDEX to the last entry in FILE[].TRACK[]
+	//Push a new INDEX to the last entry in FILE[].TRACK[], -FRAMES- sectors
+	//from the start of the FILE
+	void pushINDEXFrames(const unsigned int ID, const uint32_t FRAMES);
+	
+	//Push a new INDEX -BYTES- from the start of the FILE. Exits if -BYTES- is
+	//not a whole number of SP::SECTOR_BYTES sectors
 	void pushINDEX(const unsigned int ID, const unsigned long BYTES);
 
 	/*** Create a valid .cue file line from struct data ***********************/
@@ -136,12 +332,15 @@ class CueHandler {
 	
 	
 	//private:
-	//Errors depending on strictLevel
+	//Errors depending on the ErrorPolicy (and strictLevel for RuntimeErrors)
 	void handleCueError(const char* msg);
 	
 	//Force an error and bypass the handler. This is for deep internal errors
 	void forceCueError(const char* msg);
 	
+	//Parse one line of .cue text (without its line ending) into FILE
+	void parseCueLine(const std::string &cLineStr);
+	
 	//TODO make this private with a setter
 	//0: No Strictness
 	//1: Warn
@@ -153,37 +352,67 @@ class CueHandler {
 	
 	/*** Convert line information into struct type data ***********************/
 	//Returns the t_LINE of the string passed (whole line from cue file)
-	t_LINE LINEStrToType(const std::string lineStr);
+	t_LINE LINEStrToType(const std::string &lineStr);
 	
 	//Return the t_FILE of the string passed
-	t_FILE FILEStrToType(const std::string fileStr);	
+	t_FILE FILEStrToType(const std::string &fileStr);
 	
 	//Returns the t_TRACK of the string passed
-	t_TRACK TRACKStrToType(const std::string trackStr);
+	t_TRACK TRACKStrToType(const std::string &trackStr);
+	
+	//Returns the t_TRACK of the TRACK type word alone (e.g. "MODE2/2352")
+	t_TRACK TRACKWordToType(const StrView typeStr);
+	
+	//Returns the value of a TRACK or INDEX ID word, which is 1 or 2 digits
+	unsigned int IDWordToInt(const StrView idStr);
 	
 	//Returns the FILE type string from t_FILE_str via enum
 	std::string FILETypeToStr(const t_FILE);
 	
 	//Returns the TRACK type string from t_TRACK_str via enum
 	std::string TRACKTypeToStr(const t_TRACK);
+	
+	//Returns the number of bytes per sector a TRACK type uses in its bin file
+	unsigned int TRACKSectorSize(const t_TRACK);
 
 	/** Helper Functions ******************************************************/
+	//Converts a number of frames (sectors) into an Audio CD timestamp
+	std::string framesToTimestamp(const uint32_t frames);
+	
+	//Converts an Audio CD timestamp into a number of frames (sectors)
+	uint32_t timestampToFrames(const std::string &timestamp);
+	uint32_t timestampToFrames(const StrView timestamp);
+	
 	//Converts a number of bytes into an Audio CD timestamp.
-	std::string bytesToTimestamp(const unsigned long bytes);
+	std::string bytesToTimestamp(const unsigned long long bytes);
 	
 	//Converts an Audio CD timestamp into number of bytes
-	unsigned long timestampToBytes(const std::string timestamp);
+	unsigned long long timestampToBytes(const std::string timestamp);
 	
-	//Modified from TeFiEd. Returns -index- word in a string
-	std::string getWord(const std::string input, unsigned int index);
+	//Modified from TeFiEd. Returns -index- word in a string. Use LineFields
+	//directly to get more than one word from a line without copying
+	std::string getWord(const std::string &input, unsigned int index);
 	
 	//Pass a string, start and end pos. Returns a substring ignoring spaces
-	std::string substrNonEmpty(std::string input, size_t s, size_t e);
+	std::string substrNonEmpty(const std::string &input, size_t s, size_t e);
 	
 	//Takes an input uint32_t, zero-pads to -pad- then return a string
 	std::string padIntStr(const unsigned long val, const unsigned int len = 0,
 	                      const char pad = '0');
 
-}; //class CueHandler
+}; //class BasicCueHandler
+
+//The handler used everywhere by default. Behaves as CueHandler always has
+typedef BasicCueHandler <RuntimeErrors, RawSectors> CueHandler;
+
+//Every error exits, for checking cue files from unknown sources
+typedef BasicCueHandler <StrictErrors, RawSectors> StrictCueHandler;
+
+//No validation, for writing cue files built by our own tools
+typedef BasicCueHandler <TrustedInput, RawSectors> TrustedCueHandler;
+
+//Throws a CueError instead of exiting, for .cue files that may be corrupt or
+//half written
+typedef BasicCueHandler <RecoverableErrors, RawSectors> RecoverableCueHandler;
 
 #endif
@@ -0,0 +1,295 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* Streaming hash functions for image data. See CueHash.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "CueHash.hpp"
+
+#include <cstring>
+#include <string>
+
+/*** XXH64 ********************************************************************/
+namespace {
+const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl64(const uint64_t val, const int bits) {
+	return (val << bits) | (val >> (64 - bits));
+}
+
+inline uint32_t rotl32(const uint32_t val, const int bits) {
+	return (val << bits) | (val >> (32 - bits));
+}
+
+//Little endian loads, independent of the host byte order
+inline uint64_t readLE64(const uint8_t *src) {
+	uint64_t val = 0;
+	for(int cByte = 7; cByte >= 0; cByte--) val = (val << 8) | src[cByte];
+	return val;
+}
+
+inline uint32_t readLE32(const uint8_t *src) {
+	return (uint32_t)src[0] | ((uint32_t)src[1] << 8)
+	     | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+inline uint64_t xxhRound(uint64_t acc, const uint64_t input) {
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+inline uint64_t xxhMerge(uint64_t acc, const uint64_t val) {
+	acc ^= xxhRound(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+} //namespace
+
+void XXH64Hasher::reset(const uint64_t seed) {
+	m_seed = seed;
+	m_acc[0] = seed + PRIME64_1 + PRIME64_2;
+	m_acc[1] = seed + PRIME64_2;
+	m_acc[2] = seed;
+	m_acc[3] = seed - PRIME64_1;
+	m_total = 0;
+	m_buffered = 0;
+}
+
+void XXH64Hasher::update(const uint8_t *data, size_t len) {
+	m_total += len;
+	
+	//Top up a partially filled stripe first
+	if(m_buffered > 0) {
+		size_t fill = 32 - m_buffered;
+		if(fill > len) fill = len;
+		
+		memcpy(m_buffer + m_buffered, data, fill);
+		m_buffered += fill;
+		data += fill;
+		len -= fill;
+		
+		if(m_buffered < 32) return;
+		
+		for(int lane = 0; lane < 4; lane++) {
+			m_acc[lane] = xxhRound(m_acc[lane], readLE64(m_buffer + lane * 8));
+		}
+		m_buffered = 0;
+	}
+	
+	//Whole 32 byte stripes straight from the input
+	uint64_t acc0 = m_acc[0], acc1 = m_acc[1], acc2 = m_acc[2], acc3 = m_acc[3];
+	while(len >= 32) {
+		acc0 = xxhRound(acc0, readLE64(data));
+		acc1 = xxhRound(acc1, readLE64(data + 8));
+		acc2 = xxhRound(acc2, readLE64(data + 16));
+		acc3 = xxhRound(acc3, readLE64(data + 24));
+		data += 32;
+		len -= 32;
+	}
+	m_acc[0] = acc0; m_acc[1] = acc1; m_acc[2] = acc2; m_acc[3] = acc3;
+	
+	memcpy(m_buffer, data, len);
+	m_buffered = len;
+}
+
+uint64_t XXH64Hasher::digest() const {
+	uint64_t hash;
+	
+	if(m_total >= 32) {
+		hash = rotl64(m_acc[0], 1) + rotl64(m_acc[1], 7)
+		     + rotl64(m_acc[2], 12) + rotl64(m_acc[3], 18);
+		for(int lane = 0; lane < 4; lane++) hash = xxhMerge(hash, m_acc[lane]);
+	} else {
+		hash = m_seed + PRIME64_5;
+	}
+	
+	hash += m_total;
+	
+	//Mix in the bytes left in the buffer
+	const uint8_t *data = m_buffer;
+	size_t len = m_buffered;
+	while(len >= 8) {
+		hash ^= xxhRound(0, readLE64(data));
+		hash = rotl64(hash, 27) * PRIME64_1 + PRIME64_4;
+		data += 8;
+		len -= 8;
+	}
+	
+	if(len >= 4) {
+		hash ^= (uint64_t)readLE32(data) * PRIME64_1;
+		hash = rotl64(hash, 23) * PRIME64_2 + PRIME64_3;
+		data += 4;
+		len -= 4;
+	}
+	
+	while(len > 0) {
+		hash ^= (*data) * PRIME64_5;
+		hash = rotl64(hash, 11) * PRIME64_1;
+		++data;
+		--len;
+	}
+	
+	//Final avalanche
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PRIME64_3;
+	hash ^= hash >> 32;
+	
+	return hash;
+}
+
+/*** SHA-1 ********************************************************************/
+void SHA1Hasher::reset() {
+	m_state[0] = 0x67452301;
+	m_state[1] = 0xEFCDAB89;
+	m_state[2] = 0x98BADCFE;
+	m_state[3] = 0x10325476;
+	m_state[4] = 0xC3D2E1F0;
+	m_total = 0;
+	m_buffered = 0;
+}
+
+void SHA1Hasher::block(uint32_t *state, const uint8_t *data) {
+	uint32_t w[80];
+	
+	//Message words are big endian
+	for(int word = 0; word < 16; word++) {
+		w[word] = ((uint32_t)data[word * 4] << 24)
+		        | ((uint32_t)data[word * 4 + 1] << 16)
+		        | ((uint32_t)data[word * 4 + 2] << 8)
+		        | (uint32_t)data[word * 4 + 3];
+	}
+	for(int word = 16; word < 80; word++) {
+		w[word] = rotl32(w[word - 3] ^ w[word - 8] ^ w[word - 14]
+		                 ^ w[word - 16], 1);
+	}
+	
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4];
+	
+	for(int round = 0; round < 80; round++) {
+		uint32_t f, k;
+		if(round < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		} else if(round < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		} else if(round < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		
+		uint32_t temp = rotl32(a, 5) + f + e + k + w[round];
+		e = d;
+		d = c;
+		c = rotl32(b, 30);
+		b = a;
+		a = temp;
+	}
+	
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+void SHA1Hasher::update(const uint8_t *data, size_t len) {
+	m_total += len;
+	
+	if(m_buffered > 0) {
+		size_t fill = 64 - m_buffered;
+		if(fill > len) fill = len;
+		
+		memcpy(m_buffer + m_buffered, data, fill);
+		m_buffered += fill;
+		data += fill;
+		len -= fill;
+		
+		if(m_buffered < 64) return;
+		block(m_state, m_buffer);
+		m_buffered = 0;
+	}
+	
+	while(len >= 64) {
+		block(m_state, data);
+		data += 64;
+		len -= 64;
+	}
+	
+	memcpy(m_buffer, data, len);
+	m_buffered = len;
+}
+
+void SHA1Hasher::digest(uint8_t *out) const {
+	//Pad a copy of the state so more data can still be added afterwards
+	uint32_t state[5];
+	memcpy(state, m_state, sizeof(state));
+	
+	uint8_t pad[128] = {0};
+	memcpy(pad, m_buffer, m_buffered);
+	pad[m_buffered] = 0x80;
+	
+	size_t padLen = (m_buffered < 56) ? 64 : 128;
+	uint64_t bits = m_total * 8;
+	for(int cByte = 0; cByte < 8; cByte++) {
+		pad[padLen - 1 - cByte] = (uint8_t)(bits >> (cByte * 8));
+	}
+	
+	block(state, pad);
+	if(padLen == 128) block(state, pad + 64);
+	
+	for(int word = 0; word < 5; word++) {
+		out[word * 4] = (uint8_t)(state[word] >> 24);
+		out[word * 4 + 1] = (uint8_t)(state[word] >> 16);
+		out[word * 4 + 2] = (uint8_t)(state[word] >> 8);
+		out[word * 4 + 3] = (uint8_t)state[word];
+	}
+}
+
+/*** Helper Functions *********************************************************/
+std::string hashToHex(const uint8_t *data, const size_t len) {
+	const char *digits = "0123456789abcdef";
+	
+	std::string hex;
+	hex.reserve(len * 2);
+	for(size_t cByte = 0; cByte < len; cByte++) {
+		hex.push_back(digits[data[cByte] >> 4]);
+		hex.push_back(digits[data[cByte] & 0x0F]);
+	}
+	
+	return hex;
+}
+
+bool hexToHash(const std::string hex, uint8_t *out, const size_t len) {
+	if(hex.size() != len * 2) return false;
+	
+	for(size_t cByte = 0; cByte < len; cByte++) {
+		uint8_t val = 0;
+		for(int nibble = 0; nibble < 2; nibble++) {
+			char chr = hex[cByte * 2 + nibble];
+			val <<= 4;
+			
+			if(chr >= '0' && chr <= '9') val |= chr - '0';
+			else if(chr >= 'a' && chr <= 'f') val |= chr - 'a' + 10;
+			else if(chr >= 'A' && chr <= 'F') val |= chr - 'A' + 10;
+			else return false;
+		}
+		out[cByte] = val;
+	}
+	
+	return true;
+}
@@ -0,0 +1,75 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* Streaming hash functions for image data. XXH64 is a fast non-cryptographic
+* hash for finding candidate matches, SHA-1 is a stronger digest to confirm
+* them (and is what redump/no-intro DAT files list for each track).
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef CUE_HASH_H
+#define CUE_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*** XXH64 ********************************************************************/
+class XXH64Hasher {
+	public:
+	XXH64Hasher(const uint64_t seed = 0) { reset(seed); }
+	
+	//Start a new hash
+	void reset(const uint64_t seed = 0);
+	
+	//Hash -len- more bytes
+	void update(const uint8_t *data, size_t len);
+	
+	//Returns the hash of all the bytes so far. Does not change the state
+	uint64_t digest() const;
+	
+	private:
+	uint64_t m_acc[4];
+	uint64_t m_seed;
+	uint64_t m_total;
+	uint8_t m_buffer[32];
+	size_t m_buffered;
+};
+
+/*** SHA-1 ********************************************************************/
+class SHA1Hasher {
+	public:
+	SHA1Hasher() { reset(); }
+	
+	//Start a new hash
+	void reset();
+	
+	//Hash -len- more bytes
+	void update(const uint8_t *data, size_t len);
+	
+	//Writes the 20 byte digest of all the bytes so far to -out-
+	void digest(uint8_t *out) const;
+	
+	private:
+	uint32_t m_state[5];
+	uint64_t m_total;
+	uint8_t m_buffer[64];
+	size_t m_buffered;
+	
+	//Process one 64 byte block into the state
+	static void block(uint32_t *state, const uint8_t *data);
+};
+
+/*** Helper Functions *********************************************************/
+//Converts bytes to a lower case hex string. (e.g. a SHA-1 digest for printing)
+std::string hashToHex(const uint8_t *data, const size_t len);
+
+//Converts a lower or upper case hex string to bytes. Returns false if the
+//string is not exactly len * 2 hex digits
+bool hexToHash(const std::string hex, uint8_t *out, const size_t len);
+
+#endif
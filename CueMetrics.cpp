@@ -0,0 +1,64 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* Opt-in instrumentation for CueHandler. See CueMetrics.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "CueMetrics.hpp"
+
+#include <ostream>
+
+/*** Phase name strings mapped to t_PHASE *************************************/
+const char *t_PHASE_str[] = {
+	"READ", "LINE_ENDING", "CLASSIFY", "EXTRACT", "TIMESTAMP", "VALIDATE",
+	"PUSH"
+};
+
+/*** CueMetrics Functions *****************************************************/
+CueMetrics &CueMetrics::operator+=(const CueMetrics &other) {
+	//Add every phase timer and call count
+	for(int phase = 0; phase < (int)t_PHASE::MAX_PHASES; phase++) {
+		this->phaseNs[phase] += other.phaseNs[phase];
+		this->phaseCalls[phase] += other.phaseCalls[phase];
+	}
+
+	//Add the counters
+	this->lines += other.lines;
+	this->allocations += other.allocations;
+	this->bytesRead += other.bytesRead;
+	this->bytesWritten += other.bytesWritten;
+
+	return *this;
+}
+
+void CueMetrics::reset() {
+	*this = CueMetrics();
+}
+
+const char *CueMetrics::phaseName(const t_PHASE phase) {
+	if(phase >= t_PHASE::MAX_PHASES) return "UNKNOWN";
+	return t_PHASE_str[(int)phase];
+}
+
+void CueMetrics::print(std::ostream &out) const {
+	unsigned long long totalNs = 0;
+
+	//Print each phase, its time in microseconds and how often it ran
+	for(int phase = 0; phase < (int)t_PHASE::MAX_PHASES; phase++) {
+		out << phaseName((t_PHASE)phase) << ":\t" << phaseNs[phase] / 1000
+		    << " us\t(" << phaseCalls[phase] << " calls)\n";
+
+		totalNs += phaseNs[phase];
+	}
+
+	out << "TOTAL:\t\t" << totalNs / 1000 << " us\n";
+
+	//Print the counters
+	out << "Lines: " << lines << "    Allocations: " << allocations
+	    << "    Bytes Read: " << bytesRead << "    Bytes Written: "
+	    << bytesWritten << "\n";
+}
@@ -0,0 +1,111 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* Opt-in instrumentation for CueHandler. Per-phase timers and counters are only
+* compiled in when CUE_METRICS is defined (e.g. -DCUE_METRICS), otherwise every
+* CUE_METRICS_* macro expands to nothing and CueHandler has no metrics member.
+* The define changes CueHandler's layout, so every file must agree on it.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef CUE_METRICS_H
+#define CUE_METRICS_H
+
+#include <ostream>
+
+#ifdef CUE_METRICS
+#include <chrono>
+#endif
+
+/*** Enums ********************************************************************/
+//Phases of work CueHandler does. Time spent in nested phases is only charged
+//to the innermost phase, so the totals add up to the wall time measured.
+enum class t_PHASE {
+	READ, LINE_ENDING, CLASSIFY, EXTRACT, TIMESTAMP, VALIDATE, PUSH, MAX_PHASES
+};
+
+/*** Metrics struct ***********************************************************/
+struct CueMetrics {
+	//Nanoseconds spent in, and number of times each phase was entered
+	unsigned long long phaseNs[(int)t_PHASE::MAX_PHASES] = {};
+	unsigned long long phaseCalls[(int)t_PHASE::MAX_PHASES] = {};
+
+	//Counters
+	unsigned long long lines = 0; //Lines of .cue text processed
+	unsigned long long allocations = 0; //Vector growths while pushing data
+	unsigned long long bytesRead = 0; //Bytes of .cue text read
+	unsigned long long bytesWritten = 0; //Bytes of .cue text written
+
+	//Add another set of metrics to this one, for aggregating over a batch
+	CueMetrics &operator+=(const CueMetrics &);
+
+	//Zero all timers and counters
+	void reset();
+
+	//Print a human readable summary of the metrics to the stream passed
+	void print(std::ostream &) const;
+
+	//Returns the name string of a phase
+	static const char *phaseName(const t_PHASE);
+
+	/*** Internal timer state, only used by CuePhaseTimer ***/
+	int activePhase = -1; //Phase currently being timed. -1 for none
+	unsigned long long markNs = 0; //Timestamp of the last phase change
+};
+
+/*** Instrumentation macros ***************************************************/
+#ifdef CUE_METRICS
+
+//Scoped timer, charges the time it is alive to a phase. Pauses the phase that
+//was active when it was created, and resumes it when it goes out of scope.
+class CuePhaseTimer {
+	public:
+	CuePhaseTimer(CueMetrics &metrics, const t_PHASE phase) : m_metrics(metrics),
+	  m_prevPhase(metrics.activePhase) {
+		switchTo((int)phase);
+		++m_metrics.phaseCalls[(int)phase];
+	}
+
+	~CuePhaseTimer() { switchTo(m_prevPhase); }
+
+	private:
+	CueMetrics &m_metrics;
+	int m_prevPhase;
+
+	//Charge the time since the last mark to the active phase, then change it
+	void switchTo(const int phase) {
+		unsigned long long now = (unsigned long long)
+		  std::chrono::duration_cast<std::chrono::nanoseconds>(
+		  std::chrono::steady_clock::now().time_since_epoch()).count();
+
+		if(m_metrics.activePhase >= 0) {
+			m_metrics.phaseNs[m_metrics.activePhase] += now - m_metrics.markNs;
+		}
+
+		m_metrics.markNs = now;
+		m_metrics.activePhase = phase;
+	}
+};
+
+#define CUE_METRICS_CAT2(a, b) a##b
+#define CUE_METRICS_CAT(a, b) CUE_METRICS_CAT2(a, b)
+
+//Time the rest of the enclosing scope as -phase-
+#define CUE_METRICS_PHASE(metrics, phase) \
+	CuePhaseTimer CUE_METRICS_CAT(cuePhaseTimer_, __LINE__)(metrics, phase)
+
+//Add -n- to the -field- counter
+#define CUE_METRICS_COUNT(metrics, field, n) ((metrics).field += (n))
+
+#else
+
+#define CUE_METRICS_PHASE(metrics, phase)
+#define CUE_METRICS_COUNT(metrics, field, n)
+
+#endif //CUE_METRICS
+
+#endif
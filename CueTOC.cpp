@@ -0,0 +1,206 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* Absolute table of contents and LBA lookup. See CueTOC.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "CueTOC.hpp"
+#include "CueHandler.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+/*** Stat Cache ***************************************************************/
+bool StatCache::fileSize(const std::string &path, unsigned long long &size) {
+	std::lock_guard <std::mutex> lock(m_mutex);
+	
+	auto found = m_entries.find(path);
+	if(found == m_entries.end()) {
+		Entry entry;
+		struct stat info;
+		entry.EXISTS = (stat(path.c_str(), &info) == 0);
+		entry.SIZE = entry.EXISTS ? (unsigned long long)info.st_size : 0;
+		
+		found = m_entries.insert(std::make_pair(path, entry)).first;
+	}
+	
+	size = found->second.SIZE;
+	return found->second.EXISTS;
+}
+
+void StatCache::invalidate(const std::string &path) {
+	std::lock_guard <std::mutex> lock(m_mutex);
+	m_entries.erase(path);
+}
+
+void StatCache::clear() {
+	std::lock_guard <std::mutex> lock(m_mutex);
+	m_entries.clear();
+}
+
+/*** Building *****************************************************************/
+int CueTOC::build(CueHandler &cue, StatCache *cache) {
+	if(cache == nullptr) cache = &m_cache;
+	
+	m_tracks.clear();
+	m_indexes.clear();
+	m_trackLBA.clear();
+	m_indexLBA.clear();
+	m_fileLBA.clear();
+	m_fileTrack.clear();
+	m_sectors = 0;
+	
+	//Bin files are relative to the directory of the .cue file
+	std::string binDir = cue.cueFile->parentDir();
+	int missing = 0;
+	
+	for(size_t cFile = 0; cFile < cue.FILE.size(); cFile++) {
+		const FileData &pFILE = cue.FILE[cFile];
+		std::string binPath = binDir + pFILE.FILENAME;
+		
+		unsigned long long fileBytes = 0;
+		if(cache->fileSize(binPath, fileBytes) == false) {
+			std::cerr << "Error: CueTOC: Could not stat " << binPath << ".\n";
+			missing = 1;
+		}
+		
+		//The FILE starts where the previous one ended
+		uint32_t fileLBA = m_sectors;
+		size_t firstTrack = m_tracks.size();
+		m_fileLBA.push_back(fileLBA);
+		m_fileTrack.push_back(firstTrack);
+		
+		for(const TrackData &pTRACK : pFILE.TRACK) {
+			TocTrack track;
+			track.ID = pTRACK.ID;
+			track.TYPE = pTRACK.TYPE;
+			track.FILE = cFile;
+			track.PATH = binPath;
+			track.SECTOR_SIZE = cue.TRACKSectorSize(pTRACK.TYPE);
+			track.FIRST_INDEX = m_indexes.size();
+			track.INDEX_COUNT = pTRACK.INDEX.size();
+			
+			//Relative frame of the first INDEX, made absolute below
+			if(pTRACK.INDEX.empty() == false) {
+				track.LBA = pTRACK.INDEX.front().FRAMES;
+			}
+			
+			for(const IndexData &pINDEX : pTRACK.INDEX) {
+				TocIndex index;
+				index.ID = pINDEX.ID;
+				index.LBA = fileLBA + pINDEX.FRAMES;
+				m_indexes.push_back(index);
+			}
+			
+			m_tracks.push_back(track);
+		}
+		
+		//Walk the FILE's TRACKs, each sized by the next one's start. The
+		//last one takes whatever is left of the file, in its own sector size.
+		//The first TRACK can start part way into the file, the sectors before
+		//it still take up bytes and LBAs (as in getTrackSpans)
+		unsigned long long offset = 0;
+		uint32_t leading = 0;
+		if(firstTrack < m_tracks.size()) {
+			leading = m_tracks[firstTrack].LBA;
+			offset = (unsigned long long)leading
+			       * m_tracks[firstTrack].SECTOR_SIZE;
+		}
+		
+		for(size_t cTrack = firstTrack; cTrack < m_tracks.size(); cTrack++) {
+			TocTrack &track = m_tracks[cTrack];
+			uint32_t relLBA = track.LBA;
+			
+			uint32_t length = 0;
+			if(cTrack + 1 < m_tracks.size()) {
+				uint32_t nextLBA = m_tracks[cTrack + 1].LBA;
+				if(nextLBA > relLBA) length = nextLBA - relLBA;
+			} else if(fileBytes > offset) {
+				length = (uint32_t)((fileBytes - offset) / track.SECTOR_SIZE);
+			}
+			
+			track.LBA = fileLBA + relLBA;
+			track.LENGTH = length;
+			track.OFFSET = offset;
+			offset += (unsigned long long)length * track.SECTOR_SIZE;
+		}
+		
+		m_sectors = fileLBA + leading;
+		for(size_t cTrack = firstTrack; cTrack < m_tracks.size(); cTrack++) {
+			m_sectors += m_tracks[cTrack].LENGTH;
+		}
+	}
+	
+	//Pack the start LBAs for the lookups
+	m_trackLBA.reserve(m_tracks.size());
+	for(const TocTrack &track : m_tracks) m_trackLBA.push_back(track.LBA);
+	
+	m_indexLBA.reserve(m_indexes.size());
+	for(const TocIndex &index : m_indexes) m_indexLBA.push_back(index.LBA);
+	
+	return missing;
+}
+
+/*** Lookup *******************************************************************/
+const TocTrack *CueTOC::findTrack(const uint32_t lba) const {
+	if(lba >= m_sectors || m_trackLBA.empty()) return nullptr;
+	
+	//The last FILE starting at or before the LBA holds it
+	auto nextFile = std::upper_bound(m_fileLBA.begin(), m_fileLBA.end(), lba);
+	if(nextFile == m_fileLBA.begin()) return nullptr;
+	size_t file = (size_t)(nextFile - m_fileLBA.begin()) - 1;
+	
+	//A FILE with no TRACKs has no sectors of its own
+	size_t first = m_fileTrack[file];
+	if(first >= m_tracks.size() || m_tracks[first].FILE != file) return nullptr;
+	
+	//Sectors before the FILE's first TRACK belong to it
+	if(lba < m_tracks[first].LBA) return &m_tracks[first];
+	
+	//The last TRACK starting at or before the LBA
+	auto next = std::upper_bound(m_trackLBA.begin(), m_trackLBA.end(), lba);
+	if(next == m_trackLBA.begin()) return nullptr;
+	
+	return &m_tracks[(size_t)(next - m_trackLBA.begin()) - 1];
+}
+
+bool CueTOC::locate(const uint32_t lba, TocPosition &pos) const {
+	const TocTrack *track = findTrack(lba);
+	if(track == nullptr) return false;
+	
+	pos.TRACK = track;
+	
+	//Before the first TRACK of its FILE, counted from the start of the file
+	if(lba < track->LBA) {
+		pos.OFFSET = (unsigned long long)(lba - m_fileLBA[track->FILE])
+		           * track->SECTOR_SIZE;
+		pos.INDEX = 0;
+		return true;
+	}
+	
+	pos.OFFSET = track->OFFSET
+	           + (unsigned long long)(lba - track->LBA) * track->SECTOR_SIZE;
+	
+	//The last INDEX of the TRACK starting at or before the LBA
+	pos.INDEX = 0;
+	if(track->INDEX_COUNT != 0) {
+		auto first = m_indexLBA.begin() + track->FIRST_INDEX;
+		auto last = first + track->INDEX_COUNT;
+		auto next = std::upper_bound(first, last, lba);
+		
+		if(next != first) {
+			pos.INDEX = m_indexes[(size_t)(next - m_indexLBA.begin()) - 1].ID;
+		}
+	}
+	
+	return true;
+}
@@ -0,0 +1,123 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file builds an absolute table of contents from parsed cue data. INDEX
+* FRAMES are relative to their FILE, so the size of every bin file (from a stat
+* cache) is summed to give each TRACK and INDEX an absolute LBA. Finding the
+* TRACK and INDEX of any LBA is then a binary search over flat arrays.
+*
+* LBA 0 is the first sector of the first FILE. (The disc MSF is LBA + 150)
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef CUE_TOC_H
+#define CUE_TOC_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CueHandler.hpp"
+
+/*** Stat Cache ***************************************************************/
+//Remembers the size of files so each one is only stat'd once. Thread safe
+class StatCache {
+	public:
+	StatCache() { }
+	
+	//Get the size of a file. Returns false if it does not exist (this is
+	//cached as well)
+	bool fileSize(const std::string &path, unsigned long long &size);
+	
+	//Forget one file, or every file (after they have changed on disk)
+	void invalidate(const std::string &path);
+	void clear();
+	
+	private:
+	struct Entry {
+		bool EXISTS;
+		unsigned long long SIZE;
+	};
+	
+	std::mutex m_mutex;
+	std::unordered_map <std::string, Entry> m_entries;
+};
+
+/*** Structs ******************************************************************/
+//A TRACK with absolute positions
+struct TocTrack {
+	unsigned int ID = 0; //TRACK ID
+	t_TRACK TYPE = t_TRACK::UNKNOWN;
+	size_t FILE = 0; //Index into the FILE vector
+	std::string PATH; //bin file the TRACK is in
+	unsigned int SECTOR_SIZE = 2352; //Bytes per sector in the bin file
+	uint32_t LBA = 0; //Absolute LBA of the first INDEX (pregap included)
+	uint32_t LENGTH = 0; //Sectors, up to the next TRACK or the end of FILE
+	unsigned long long OFFSET = 0; //Byte offset of LBA in the bin file
+	size_t FIRST_INDEX = 0; //Position of the first INDEX in indexes()
+	size_t INDEX_COUNT = 0;
+};
+
+//An INDEX with an absolute position
+struct TocIndex {
+	unsigned int ID = 0; //INDEX ID
+	uint32_t LBA = 0; //Absolute LBA
+};
+
+//Result of a lookup
+struct TocPosition {
+	const TocTrack *TRACK = nullptr; //TRACK holding the LBA
+	unsigned int INDEX = 0; //ID of the INDEX holding the LBA
+	unsigned long long OFFSET = 0; //Byte offset of the sector in the bin file
+};
+
+/*** CueTOC Class *************************************************************/
+class CueTOC {
+	public:
+	CueTOC() { }
+	
+	//Build the TOC of a CueHandler with its cue data loaded (getCueData).
+	//Bin sizes come from -cache-, or an internal one if none is passed.
+	//Returns 0 on success, 1 if a bin file is missing (its TRACKs are empty)
+	int build(CueHandler &cue, StatCache *cache = nullptr);
+	
+	//Total number of sectors across every FILE
+	uint32_t sectors() const { return m_sectors; }
+	
+	//Every TRACK and INDEX, in order
+	const std::vector <TocTrack> &tracks() const { return m_tracks; }
+	const std::vector <TocIndex> &indexes() const { return m_indexes; }
+	
+	//Returns the TRACK holding an absolute LBA, nullptr if it is past the end.
+	//Sectors of a FILE before its first TRACK belong to that TRACK
+	const TocTrack *findTrack(const uint32_t lba) const;
+	
+	//Find the TRACK, INDEX and bin file offset of an absolute LBA. Returns
+	//false if it is past the end. Sectors before the first TRACK of a FILE
+	//have INDEX 0
+	bool locate(const uint32_t lba, TocPosition &pos) const;
+	
+	private:
+	std::vector <TocTrack> m_tracks;
+	std::vector <TocIndex> m_indexes;
+	uint32_t m_sectors = 0;
+	
+	//Start LBA of each TRACK (and of each INDEX) packed together, so the
+	//binary searches only touch these arrays
+	std::vector <uint32_t> m_trackLBA;
+	std::vector <uint32_t> m_indexLBA;
+	
+	//Start LBA of each FILE, and the position of its first TRACK in m_tracks
+	std::vector <uint32_t> m_fileLBA;
+	std::vector <size_t> m_fileTrack;
+	
+	StatCache m_cache;
+};
+
+#endif
@@ -0,0 +1,590 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* Memory mapped DAT hash index. See DatIndex.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "DatIndex.hpp"
+#include "CueHash.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*** Helper Functions *********************************************************/
+namespace {
+/*	Index file, in host byte order. An 80 byte header, then (each starting on
+	an 8 byte boundary) the hash table of 1 << SLOT_BITS uint32 slots, the ROM
+	records sorted by SHA-1, the game records, and the name pool. Every slot
+	holds the index + 1 of the first ROM with a SHA-1, or 0 if it is empty.  */
+struct FileHeader {
+	char MAGIC[4];
+	uint32_t VERSION;
+	uint32_t ENDIAN_MARK;
+	uint32_t SLOT_BITS;
+	uint64_t ROM_COUNT;
+	uint64_t GAME_COUNT;
+	uint64_t NAMES_LEN;
+	uint64_t SLOTS; //Byte offsets of each section
+	uint64_t ROMS;
+	uint64_t GAMES;
+	uint64_t NAMES;
+	uint64_t RESERVED;
+};
+
+//Not "CUED", which is the TrackDedup index
+const char indexMagic[4] = {'C', 'U', 'E', 'X'};
+const uint32_t indexVersion = 1;
+const uint32_t indexEndianMark = 0x01020304;
+
+//Bytes read from the DAT at once
+const size_t READ_CHUNK = 1024 * 1024;
+
+//A tag longer than this means the file is not XML
+const size_t MAX_TAG = 1024 * 1024;
+
+//Slot of a SHA-1. The digest is already uniform, so its first bytes are used
+inline uint64_t slotHash(const uint8_t *sha1) {
+	uint64_t hash;
+	memcpy(&hash, sha1, sizeof(hash));
+	return hash;
+}
+
+inline size_t align8(const size_t val) { return (val + 7) & ~(size_t)7; }
+
+//Replace the XML entities in an attribute value
+std::string decodeEntities(const char *str, const size_t len) {
+	std::string out;
+	out.reserve(len);
+	
+	for(size_t cChr = 0; cChr < len; cChr++) {
+		if(str[cChr] != '&') {
+			out.push_back(str[cChr]);
+			continue;
+		}
+		
+		const char *end = (const char *)memchr(str + cChr, ';', len - cChr);
+		if(end == nullptr) {
+			out.push_back('&');
+			continue;
+		}
+		
+		std::string ent(str + cChr + 1, end);
+		if(ent == "amp") out.push_back('&');
+		else if(ent == "lt") out.push_back('<');
+		else if(ent == "gt") out.push_back('>');
+		else if(ent == "quot") out.push_back('"');
+		else if(ent == "apos") out.push_back('\'');
+		else if(ent.size() > 1 && ent[0] == '#') {
+			unsigned long code = (ent[1] == 'x' || ent[1] == 'X')
+			                   ? strtoul(ent.c_str() + 2, nullptr, 16)
+			                   : strtoul(ent.c_str() + 1, nullptr, 10);
+			
+			//Written back out as UTF-8
+			if(code < 0x80) {
+				out.push_back((char)code);
+			} else if(code < 0x800) {
+				out.push_back((char)(0xC0 | (code >> 6)));
+				out.push_back((char)(0x80 | (code & 0x3F)));
+			} else if(code < 0x10000) {
+				out.push_back((char)(0xE0 | (code >> 12)));
+				out.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+				out.push_back((char)(0x80 | (code & 0x3F)));
+			} else {
+				out.push_back((char)(0xF0 | ((code >> 18) & 0x07)));
+				out.push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+				out.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+				out.push_back((char)(0x80 | (code & 0x3F)));
+			}
+		} else {
+			//Unknown entity, kept as it is
+			out.append(str + cChr, end + 1);
+		}
+		
+		cChr = (size_t)(end - str);
+	}
+	
+	return out;
+}
+
+//The parts of a tag that the index uses
+struct DatTag {
+	std::string NAME;
+	bool CLOSING = false; //</game>
+	std::string ATTR_NAME, ATTR_SIZE, ATTR_CRC, ATTR_SHA1;
+};
+
+//Split the inside of a tag (between '<' and '>') into its name and the
+//attributes of interest
+void parseTag(const char *str, const size_t len, DatTag &tag) {
+	size_t pos = 0;
+	if(pos < len && str[pos] == '/') {
+		tag.CLOSING = true;
+		++pos;
+	}
+	
+	size_t nameStart = pos;
+	while(pos < len && isspace((unsigned char)str[pos]) == 0
+	      && str[pos] != '/') {
+		++pos;
+	}
+	tag.NAME.assign(str + nameStart, pos - nameStart);
+	
+	//Only games and ROMs have attributes that are needed
+	if(tag.CLOSING || (tag.NAME != "game" && tag.NAME != "machine"
+	                   && tag.NAME != "rom")) return;
+	
+	while(pos < len) {
+		while(pos < len && (isspace((unsigned char)str[pos])
+		                    || str[pos] == '/')) {
+			++pos;
+		}
+		
+		size_t keyStart = pos;
+		while(pos < len && str[pos] != '='
+		      && isspace((unsigned char)str[pos]) == 0) {
+			++pos;
+		}
+		size_t keyLen = pos - keyStart;
+		
+		while(pos < len && isspace((unsigned char)str[pos])) ++pos;
+		if(pos >= len || str[pos] != '=') continue;
+		++pos;
+		while(pos < len && isspace((unsigned char)str[pos])) ++pos;
+		if(pos >= len || (str[pos] != '"' && str[pos] != '\'')) continue;
+		
+		char quote = str[pos++];
+		size_t valStart = pos;
+		while(pos < len && str[pos] != quote) ++pos;
+		size_t valLen = pos - valStart;
+		++pos;
+		
+		std::string *dest = nullptr;
+		if(keyLen == 4 && memcmp(str + keyStart, "name", 4) == 0) {
+			dest = &tag.ATTR_NAME;
+		} else if(keyLen == 4 && memcmp(str + keyStart, "size", 4) == 0) {
+			dest = &tag.ATTR_SIZE;
+		} else if(keyLen == 3 && memcmp(str + keyStart, "crc", 3) == 0) {
+			dest = &tag.ATTR_CRC;
+		} else if(keyLen == 4 && memcmp(str + keyStart, "sha1", 4) == 0) {
+			dest = &tag.ATTR_SHA1;
+		}
+		
+		if(dest != nullptr) *dest = decodeEntities(str + valStart, valLen);
+	}
+}
+
+//Find the '>' closing a tag that starts at -open-, skipping quoted attribute
+//values. Returns std::string::npos if the tag is not all in the buffer yet
+size_t tagEnd(const std::string &buf, const size_t open) {
+	char quote = 0;
+	for(size_t pos = open + 1; pos < buf.size(); pos++) {
+		char chr = buf[pos];
+		if(quote != 0) {
+			if(chr == quote) quote = 0;
+		} else if(chr == '"' || chr == '\'') {
+			quote = chr;
+		} else if(chr == '>') {
+			return pos;
+		}
+	}
+	
+	return std::string::npos;
+}
+} //namespace
+
+/*** Index File Functions *****************************************************/
+int DatIndex::build(const std::string datPath, const std::string indexPath) {
+	static_assert(sizeof(Rom) == 48, "Rom must match the file layout");
+	static_assert(sizeof(Game) == 16, "Game must match the file layout");
+	static_assert(sizeof(FileHeader) == 80, "Header must be 80 bytes");
+	
+	std::ifstream dat(datPath, std::ios::in | std::ios::binary);
+	if(dat.is_open() == false) return errorMsg("Could not open " + datPath);
+	
+	std::vector <Rom> roms;
+	std::vector <Game> games;
+	std::string names;
+	bool inGame = false;
+	
+	//Add a string to the name pool
+	auto poolAdd = [&](const std::string &str, uint32_t &offset,
+	                   uint32_t &len) {
+		offset = (uint32_t)names.size();
+		len = (uint32_t)str.size();
+		names.append(str);
+	};
+	
+	auto handleTag = [&](const DatTag &tag) {
+		if(tag.NAME == "game" || tag.NAME == "machine") {
+			inGame = (tag.CLOSING == false);
+			if(inGame == false) return;
+			
+			Game game;
+			memset(&game, 0, sizeof(game));
+			poolAdd(tag.ATTR_NAME, game.NAME, game.NAME_LEN);
+			games.push_back(game);
+			return;
+		}
+		
+		if(tag.NAME != "rom" || tag.CLOSING || inGame == false) return;
+		++games.back().ROMS;
+		
+		Rom rom;
+		memset(&rom, 0, sizeof(rom));
+		if(hexToHash(tag.ATTR_SHA1, rom.SHA1, 20) == false) return;
+		
+		rom.SIZE = strtoull(tag.ATTR_SIZE.c_str(), nullptr, 10);
+		rom.CRC = (uint32_t)strtoul(tag.ATTR_CRC.c_str(), nullptr, 16);
+		rom.GAME = (uint32_t)(games.size() - 1);
+		poolAdd(tag.ATTR_NAME, rom.NAME, rom.NAME_LEN);
+		roms.push_back(rom);
+	};
+	
+	//Stream the file, keeping any tag cut off at the end of a chunk for the
+	//next one
+	std::string buf;
+	std::vector <char> chunk(READ_CHUNK);
+	DatTag tag;
+	
+	while(dat) {
+		dat.read(chunk.data(), (std::streamsize)chunk.size());
+		buf.append(chunk.data(), (size_t)dat.gcount());
+		
+		size_t pos = 0;
+		while(true) {
+			size_t open = buf.find('<', pos);
+			if(open == std::string::npos) {
+				pos = buf.size();
+				break;
+			}
+			
+			//Comments can hold anything, including tags
+			if(buf.compare(open, 4, "<!--") == 0) {
+				size_t end = buf.find("-->", open + 4);
+				if(end == std::string::npos) {
+					pos = open;
+					break;
+				}
+				
+				pos = end + 3;
+				continue;
+			}
+			
+			size_t close = tagEnd(buf, open);
+			if(close == std::string::npos) {
+				pos = open;
+				break;
+			}
+			
+			//Declarations and processing instructions are skipped
+			if(buf[open + 1] != '?' && buf[open + 1] != '!') {
+				tag = DatTag();
+				parseTag(buf.data() + open + 1, close - open - 1, tag);
+				handleTag(tag);
+			}
+			
+			pos = close + 1;
+		}
+		
+		buf.erase(0, pos);
+		if(buf.size() > MAX_TAG) {
+			return errorMsg(datPath + " is not a DAT file");
+		}
+	}
+	
+	if(games.empty()) return errorMsg(datPath + " has no games");
+	if(names.size() > UINT32_MAX) return errorMsg(datPath + " is too large");
+	
+	//Identical data in several games ends up next to each other
+	std::sort(roms.begin(), roms.end(), [](const Rom &a, const Rom &b) {
+		int cmp = memcmp(a.SHA1, b.SHA1, 20);
+		if(cmp != 0) return cmp < 0;
+		return a.GAME < b.GAME;
+	});
+	
+	//At most half full, so probes stay short
+	uint32_t slotBits = 4;
+	while(((uint64_t)1 << slotBits) < (uint64_t)roms.size() * 2) ++slotBits;
+	uint64_t slotCount = (uint64_t)1 << slotBits;
+	uint64_t slotMask = slotCount - 1;
+	
+	std::vector <uint32_t> slots((size_t)slotCount, 0);
+	for(size_t cRom = 0; cRom < roms.size(); cRom++) {
+		if(cRom != 0
+		   && memcmp(roms[cRom].SHA1, roms[cRom - 1].SHA1, 20) == 0) continue;
+		
+		uint64_t slot = slotHash(roms[cRom].SHA1) & slotMask;
+		while(slots[(size_t)slot] != 0) slot = (slot + 1) & slotMask;
+		slots[(size_t)slot] = (uint32_t)(cRom + 1);
+	}
+	
+	FileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.MAGIC, indexMagic, 4);
+	header.VERSION = indexVersion;
+	header.ENDIAN_MARK = indexEndianMark;
+	header.SLOT_BITS = slotBits;
+	header.ROM_COUNT = roms.size();
+	header.GAME_COUNT = games.size();
+	header.NAMES_LEN = names.size();
+	header.SLOTS = sizeof(FileHeader);
+	header.ROMS = align8(header.SLOTS + slots.size() * sizeof(uint32_t));
+	header.GAMES = header.ROMS + roms.size() * sizeof(Rom);
+	header.NAMES = header.GAMES + games.size() * sizeof(Game);
+	
+	//Write a new file and rename it into place, so a reader never maps half
+	//of an index
+	std::string temp = indexPath + ".tmp";
+	std::ofstream out(temp, std::ios::out | std::ios::trunc | std::ios::binary);
+	if(out.is_open() == false) return errorMsg("Could not create " + temp);
+	
+	const char zeros[8] = {0};
+	out.write((const char *)&header, sizeof(header));
+	out.write((const char *)slots.data(),
+	          (std::streamsize)(slots.size() * sizeof(uint32_t)));
+	out.write(zeros, (std::streamsize)(header.ROMS - header.SLOTS
+	                                   - slots.size() * sizeof(uint32_t)));
+	out.write((const char *)roms.data(),
+	          (std::streamsize)(roms.size() * sizeof(Rom)));
+	out.write((const char *)games.data(),
+	          (std::streamsize)(games.size() * sizeof(Game)));
+	out.write(names.data(), (std::streamsize)names.size());
+	out.close();
+	
+	if(out.fail() || std::rename(temp.c_str(), indexPath.c_str()) != 0) {
+		std::remove(temp.c_str());
+		return errorMsg("Failed writing " + indexPath);
+	}
+	
+	return 0;
+}
+
+int DatIndex::open(const std::string indexPath) {
+	close();
+	
+	struct stat info;
+	if(stat(indexPath.c_str(), &info) != 0) {
+		return errorMsg("Could not open " + indexPath);
+	}
+	
+	size_t len = (size_t)info.st_size;
+	if(len < sizeof(FileHeader)) {
+		return errorMsg(indexPath + " is not a DAT index");
+	}
+	
+	const uint8_t *data = nullptr;
+	
+	#if defined(__unix__) || defined(__APPLE__)
+	int fd = ::open(indexPath.c_str(), O_RDONLY);
+	if(fd < 0) return errorMsg("Could not open " + indexPath);
+	
+	void *addr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(addr == MAP_FAILED) return errorMsg("Could not map " + indexPath);
+	
+	m_addr = addr;
+	m_len = len;
+	data = (const uint8_t *)addr;
+	#else
+	//No mmap, read the whole file instead
+	std::ifstream in(indexPath, std::ios::in | std::ios::binary);
+	m_copy.resize(len);
+	in.read((char *)m_copy.data(), (std::streamsize)len);
+	if((size_t)in.gcount() != len) {
+		close();
+		return errorMsg("Could not read " + indexPath);
+	}
+	data = m_copy.data();
+	#endif
+	
+	//Every section must be inside the file
+	FileHeader header;
+	memcpy(&header, data, sizeof(header));
+	
+	uint64_t slotCount = (uint64_t)1 << (header.SLOT_BITS & 63);
+	auto fits = [&](const uint64_t offset, const uint64_t count,
+	                const uint64_t size) {
+		return offset % 8 == 0 && offset <= len
+		       && count <= (len - offset) / size;
+	};
+	
+	if(memcmp(header.MAGIC, indexMagic, 4) != 0
+	   || header.VERSION != indexVersion
+	   || header.ENDIAN_MARK != indexEndianMark
+	   || header.SLOT_BITS > 32
+	   || fits(header.SLOTS, slotCount, sizeof(uint32_t)) == false
+	   || fits(header.ROMS, header.ROM_COUNT, sizeof(Rom)) == false
+	   || fits(header.GAMES, header.GAME_COUNT, sizeof(Game)) == false
+	   || header.NAMES > len || header.NAMES_LEN > len - header.NAMES) {
+		close();
+		return errorMsg(indexPath + " is not a DAT index, or is damaged");
+	}
+	
+	m_slots = (const uint32_t *)(data + header.SLOTS);
+	m_slotMask = slotCount - 1;
+	m_roms = (const Rom *)(data + header.ROMS);
+	m_romCount = (size_t)header.ROM_COUNT;
+	m_games = (const Game *)(data + header.GAMES);
+	m_gameCount = (size_t)header.GAME_COUNT;
+	m_names = (const char *)(data + header.NAMES);
+	m_namesLen = (size_t)header.NAMES_LEN;
+	
+	return 0;
+}
+
+void DatIndex::close() {
+	#if defined(__unix__) || defined(__APPLE__)
+	if(m_addr != nullptr) munmap(m_addr, m_len);
+	#endif
+	m_addr = nullptr;
+	m_len = 0;
+	m_copy.clear();
+	
+	m_slots = nullptr;
+	m_slotMask = 0;
+	m_roms = nullptr;
+	m_romCount = 0;
+	m_games = nullptr;
+	m_gameCount = 0;
+	m_names = nullptr;
+	m_namesLen = 0;
+}
+
+/*** Lookup Functions *********************************************************/
+size_t DatIndex::find(const uint8_t *sha1,
+                      std::vector <DatMatch> &matches) const {
+	matches.clear();
+	
+	long first = firstRom(sha1);
+	if(first < 0) return 0;
+	
+	for(size_t cRom = (size_t)first; cRom < m_romCount
+	    && memcmp(m_roms[cRom].SHA1, sha1, 20) == 0; cRom++) {
+		const Rom &rom = m_roms[cRom];
+		
+		DatMatch match;
+		match.ROM = poolString(rom.NAME, rom.NAME_LEN);
+		match.SIZE = rom.SIZE;
+		match.CRC = rom.CRC;
+		match.GAME_ID = rom.GAME;
+		if(rom.GAME < m_gameCount) {
+			const Game &game = m_games[rom.GAME];
+			match.GAME = poolString(game.NAME, game.NAME_LEN);
+		}
+		
+		matches.push_back(match);
+	}
+	
+	return matches.size();
+}
+
+DatIdentity DatIndex::identify(const std::vector <TrackHash> &tracks) const {
+	DatIdentity identity;
+	
+	//Count, for each game, the TRACKs it has with the same SHA-1 and size
+	std::vector <std::vector <DatMatch>> found(tracks.size());
+	std::unordered_map <uint32_t, size_t> votes;
+	
+	for(size_t cTrack = 0; cTrack < tracks.size(); cTrack++) {
+		const TrackHash &track = tracks[cTrack];
+		if(track.HASHED == false) continue;
+		
+		find(track.SHA1, found[cTrack]);
+		
+		//The same game can list the same data twice, it is counted once
+		uint32_t lastGame = UINT32_MAX;
+		for(const DatMatch &match : found[cTrack]) {
+			if(match.SIZE != track.END - track.START) continue;
+			if(match.GAME_ID == lastGame) continue;
+			
+			++votes[match.GAME_ID];
+			lastGame = match.GAME_ID;
+		}
+	}
+	
+	//Most TRACKs wins, then the first game in the DAT
+	bool picked = false;
+	uint32_t best = 0;
+	for(const auto &vote : votes) {
+		if(picked == false || vote.second > identity.MATCHED
+		   || (vote.second == identity.MATCHED && vote.first < best)) {
+			best = vote.first;
+			identity.MATCHED = vote.second;
+			picked = true;
+		}
+	}
+	
+	if(picked && best < m_gameCount) {
+		identity.GAME = poolString(m_games[best].NAME, m_games[best].NAME_LEN);
+		identity.GAME_ROMS = m_games[best].ROMS;
+	}
+	
+	for(size_t cTrack = 0; cTrack < tracks.size(); cTrack++) {
+		const TrackHash &track = tracks[cTrack];
+		
+		bool good = false;
+		for(const DatMatch &match : found[cTrack]) {
+			if(picked && match.GAME_ID == best
+			   && match.SIZE == track.END - track.START) {
+				good = true;
+				break;
+			}
+		}
+		
+		if(good == false) identity.BAD.push_back(cTrack);
+	}
+	
+	return identity;
+}
+
+/*** Private Functions ********************************************************/
+long DatIndex::firstRom(const uint8_t *sha1) const {
+	if(m_slots == nullptr) return -1;
+	
+	//Linear probing. Bounded, in case the table is damaged and full
+	uint64_t slot = slotHash(sha1) & m_slotMask;
+	for(uint64_t probe = 0; probe <= m_slotMask; probe++) {
+		uint32_t val = m_slots[(size_t)slot];
+		if(val == 0) return -1;
+		
+		size_t idx = (size_t)val - 1;
+		if(idx < m_romCount && memcmp(m_roms[idx].SHA1, sha1, 20) == 0) {
+			return (long)idx;
+		}
+		
+		slot = (slot + 1) & m_slotMask;
+	}
+	
+	return -1;
+}
+
+std::string DatIndex::poolString(const uint32_t offset,
+                                 const uint32_t len) const {
+	if(offset > m_namesLen || len > m_namesLen - offset) return "";
+	return std::string(m_names + offset, len);
+}
+
+int DatIndex::errorMsg(const std::string msg) {
+	std::cerr << "Error: DatIndex: " << msg << '.' << std::endl;
+	return 1;
+}
@@ -0,0 +1,125 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file identifies dumps against a redump/no-intro style DAT (XML). The DAT
+* is streamed once with a small tag scanner (it is never loaded as lines of
+* text) and written out as an index file: an open addressing hash table of
+* SHA-1s, the ROM records sorted by SHA-1, the games, and one pool of names.
+* The index file is memory mapped, so opening it takes no time no matter how
+* many millions of ROMs it holds, and a lookup touches one or two pages.
+*
+* redump lists one ROM per TRACK (each in its own bin file), so TRACKs hashed
+* by TrackDedup can be matched directly.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef DAT_INDEX_H
+#define DAT_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "TrackDedup.hpp"
+
+/*** Structs ******************************************************************/
+//A ROM in the DAT
+struct DatMatch {
+	std::string GAME; //Name of the game the ROM belongs to
+	std::string ROM; //File name of the ROM
+	uint64_t SIZE = 0; //Bytes
+	uint32_t CRC = 0; //CRC32, 0 if the DAT did not list one
+	uint32_t GAME_ID = 0; //Index of the game in the DAT
+};
+
+//What a set of TRACKs (one disc) was identified as
+struct DatIdentity {
+	std::string GAME; //Game matching the most TRACKs. Empty if none matched
+	size_t MATCHED = 0; //TRACKs found in GAME with the right size
+	size_t GAME_ROMS = 0; //ROMs listed for GAME (redump also lists the .cue)
+	std::vector <size_t> BAD; //TRACKs that are unhashed, not in GAME, or
+	                          //the wrong size. A good dump has none
+};
+
+/*** DatIndex Class ***********************************************************/
+class DatIndex {
+	public:
+	DatIndex() { }
+	
+	//Unmaps the index file
+	~DatIndex() { close(); }
+	
+	/** Index File Functions **************************************************/
+	//Stream a DAT file and write its index file. ROMs without a SHA-1 are
+	//skipped. Returns 0 on success, 1 on failure
+	static int build(const std::string datPath, const std::string indexPath);
+	
+	//Map an index file written by build(). Returns 0 on success, 1 if it is
+	//missing or corrupt
+	int open(const std::string indexPath);
+	
+	//Unmap the index file
+	void close();
+	
+	//Number of ROMs and games in the index
+	size_t roms() const { return m_romCount; }
+	size_t games() const { return m_gameCount; }
+	
+	/** Lookup Functions ******************************************************/
+	//Find every ROM with a SHA-1 (the same data can be in several games).
+	//Returns the number of ROMs found
+	size_t find(const uint8_t *sha1, std::vector <DatMatch> &matches) const;
+	
+	//Identify the TRACKs of one disc, as hashed by TrackDedup. The game that
+	//the most TRACKs match is picked, and every TRACK not in it is BAD
+	DatIdentity identify(const std::vector <TrackHash> &tracks) const;
+	
+	private:
+	//Index file layout, see DatIndex.cpp
+	struct Rom {
+		uint64_t SIZE;
+		uint8_t SHA1[20];
+		uint32_t CRC;
+		uint32_t GAME;
+		uint32_t NAME; //Offset in the name pool
+		uint32_t NAME_LEN;
+		uint32_t PADDING;
+	};
+	
+	struct Game {
+		uint32_t NAME;
+		uint32_t NAME_LEN;
+		uint32_t ROMS; //ROMs listed for the game, including skipped ones
+		uint32_t PADDING;
+	};
+	
+	//The mapped index file
+	void *m_addr = nullptr;
+	size_t m_len = 0;
+	std::vector <uint8_t> m_copy; //The file read into memory without mmap
+	
+	const uint32_t *m_slots = nullptr; //Hash table of ROM index + 1, 0 empty
+	uint64_t m_slotMask = 0;
+	const Rom *m_roms = nullptr; //Sorted by SHA-1
+	size_t m_romCount = 0;
+	const Game *m_games = nullptr;
+	size_t m_gameCount = 0;
+	const char *m_names = nullptr;
+	size_t m_namesLen = 0;
+	
+	//Index of the first ROM with a SHA-1, or -1 if there is none
+	long firstRom(const uint8_t *sha1) const;
+	
+	//A string from the name pool. Empty if it is out of range
+	std::string poolString(const uint32_t offset, const uint32_t len) const;
+	
+	//Print an error message to std::cerr, returns 1 for failure
+	static int errorMsg(const std::string msg);
+};
+
+#endif
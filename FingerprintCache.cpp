@@ -0,0 +1,370 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* Persistent, memory mapped bin fingerprint cache. See FingerprintCache.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "FingerprintCache.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*** Helper Functions *********************************************************/
+namespace {
+/*	Cache file, in host byte order (it is a local cache, ENDIAN_MARK catches a
+	file copied from another machine). A 32 byte header, then COUNT records
+	sorted by key. Each record is the FingerprintKey (48 bytes) and the
+	Fingerprint (32 bytes, with 4 bytes of zero padding).                     */
+struct FileHeader {
+	char MAGIC[4];
+	uint32_t VERSION;
+	uint32_t RECORD_BYTES;
+	uint32_t ENDIAN_MARK;
+	uint64_t COUNT;
+	uint64_t RESERVED;
+};
+
+const char cacheMagic[4] = {'C', 'U', 'E', 'F'};
+const uint32_t cacheVersion = 1;
+const uint32_t cacheByteOrder = 0x01020304;
+
+//Order of keys in the cache file
+bool keyLess(const FingerprintKey &a, const FingerprintKey &b) {
+	if(a.DEVICE != b.DEVICE) return a.DEVICE < b.DEVICE;
+	if(a.INODE != b.INODE) return a.INODE < b.INODE;
+	if(a.SIZE != b.SIZE) return a.SIZE < b.SIZE;
+	if(a.MTIME != b.MTIME) return a.MTIME < b.MTIME;
+	if(a.START != b.START) return a.START < b.START;
+	return a.END < b.END;
+}
+
+bool keyEqual(const FingerprintKey &a, const FingerprintKey &b) {
+	return keyLess(a, b) == false && keyLess(b, a) == false;
+}
+} //namespace
+
+/*** Mapping ******************************************************************/
+FingerprintCache::Mapping::~Mapping() {
+	#if defined(__unix__) || defined(__APPLE__)
+	if(ADDR != nullptr) munmap(ADDR, LEN);
+	#endif
+}
+
+/*** Cache File Functions *****************************************************/
+int FingerprintCache::open(const std::string path, const bool writer) {
+	close();
+	m_path = path;
+	
+	//Only one writer at a time, across processes. Readers never lock
+	if(writer) {
+		#if defined(__unix__) || defined(__APPLE__)
+		std::string lockPath = path + ".lock";
+		m_lockFd = ::open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+		if(m_lockFd < 0) return errorMsg("Could not create " + lockPath);
+		
+		if(flock(m_lockFd, LOCK_EX | LOCK_NB) != 0) {
+			close();
+			return errorMsg("Another writer is using " + path);
+		}
+		#endif
+		m_writer = true;
+	}
+	
+	std::shared_ptr <const Mapping> map = mapFile(path);
+	if(map == nullptr) {
+		close();
+		return errorMsg(path + " is not a fingerprint cache, or is damaged");
+	}
+	
+	std::atomic_store(&m_map, map);
+	return 0;
+}
+
+void FingerprintCache::close() {
+	std::atomic_store(&m_map, std::shared_ptr <const Mapping>());
+	
+	{
+		std::lock_guard <std::mutex> lock(m_mutex);
+		m_pending.clear();
+	}
+	
+	#if defined(__unix__) || defined(__APPLE__)
+	if(m_lockFd >= 0) ::close(m_lockFd);
+	#endif
+	m_lockFd = -1;
+	m_writer = false;
+}
+
+int FingerprintCache::reload() {
+	struct stat info;
+	if(stat(m_path.c_str(), &info) != 0) return 0;
+	
+	//Still the same file, nothing to do
+	std::shared_ptr <const Mapping> current = std::atomic_load(&m_map);
+	if(current != nullptr && current->DEVICE == (uint64_t)info.st_dev
+	   && current->INODE == (uint64_t)info.st_ino) return 0;
+	
+	std::shared_ptr <const Mapping> map = mapFile(m_path);
+	if(map == nullptr) {
+		return errorMsg(m_path + " is not a fingerprint cache, or is damaged");
+	}
+	
+	std::atomic_store(&m_map, map);
+	return 0;
+}
+
+int FingerprintCache::flush() {
+	if(m_writer == false) return errorMsg("flush() needs the writer lock");
+	
+	std::lock_guard <std::mutex> lock(m_mutex);
+	if(m_pending.empty()) return 0;
+	
+	std::shared_ptr <const Mapping> old = std::atomic_load(&m_map);
+	
+	//The newest state (size and modify time) of each file with new entries.
+	//Older entries for those files can never match again, so are dropped
+	std::map <std::pair <uint64_t, uint64_t>, std::pair <uint64_t, int64_t>>
+	  newest;
+	for(const Record &rec : m_pending) {
+		auto id = std::make_pair(rec.KEY.DEVICE, rec.KEY.INODE);
+		auto state = std::make_pair(rec.KEY.SIZE, rec.KEY.MTIME);
+		
+		auto found = newest.find(id);
+		if(found == newest.end() || found->second.second < state.second) {
+			newest[id] = state;
+		}
+	}
+	
+	auto current = [&](const Record &rec) {
+		auto found = newest.find(std::make_pair(rec.KEY.DEVICE, rec.KEY.INODE));
+		if(found == newest.end()) return true;
+		return found->second == std::make_pair(rec.KEY.SIZE, rec.KEY.MTIME);
+	};
+	
+	//Merge the two sorted lists. New entries replace equal old ones
+	std::vector <Record> merged;
+	merged.reserve((old ? old->COUNT : 0) + m_pending.size());
+	
+	size_t cOld = 0, cNew = 0;
+	size_t oldCount = old ? old->COUNT : 0;
+	while(cOld < oldCount || cNew < m_pending.size()) {
+		const Record *next;
+		if(cNew == m_pending.size()) {
+			next = &old->RECORDS[cOld++];
+		} else if(cOld == oldCount) {
+			next = &m_pending[cNew++];
+		} else if(keyLess(old->RECORDS[cOld].KEY, m_pending[cNew].KEY)) {
+			next = &old->RECORDS[cOld++];
+		} else {
+			if(keyEqual(old->RECORDS[cOld].KEY, m_pending[cNew].KEY)) ++cOld;
+			next = &m_pending[cNew++];
+		}
+		
+		if(current(*next)) merged.push_back(*next);
+	}
+	
+	//Write a new file and rename it into place. Readers that still map the
+	//old file keep reading it until they reload()
+	FileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.MAGIC, cacheMagic, 4);
+	header.VERSION = cacheVersion;
+	header.RECORD_BYTES = sizeof(Record);
+	header.ENDIAN_MARK = cacheByteOrder;
+	header.COUNT = merged.size();
+	
+	std::string temp = m_path + ".tmp";
+	std::ofstream out(temp, std::ios::out | std::ios::trunc | std::ios::binary);
+	if(out.is_open() == false) return errorMsg("Could not create " + temp);
+	
+	out.write((const char *)&header, sizeof(header));
+	out.write((const char *)merged.data(),
+	          (std::streamsize)(merged.size() * sizeof(Record)));
+	out.close();
+	
+	if(out.fail() || std::rename(temp.c_str(), m_path.c_str()) != 0) {
+		std::remove(temp.c_str());
+		return errorMsg("Failed writing " + m_path);
+	}
+	
+	std::shared_ptr <const Mapping> map = mapFile(m_path);
+	if(map == nullptr) return errorMsg("Could not map " + m_path);
+	
+	std::atomic_store(&m_map, map);
+	m_pending.clear();
+	return 0;
+}
+
+/*** Lookup Functions *********************************************************/
+bool FingerprintCache::fileKey(const std::string &path, FingerprintKey &key) {
+	struct stat info;
+	if(stat(path.c_str(), &info) != 0) return false;
+	
+	key.DEVICE = (uint64_t)info.st_dev;
+	key.INODE = (uint64_t)info.st_ino;
+	key.SIZE = (uint64_t)info.st_size;
+	
+	#if defined(__APPLE__)
+	key.MTIME = (int64_t)info.st_mtimespec.tv_sec * 1000000000
+	          + info.st_mtimespec.tv_nsec;
+	#elif defined(__unix__)
+	key.MTIME = (int64_t)info.st_mtim.tv_sec * 1000000000
+	          + info.st_mtim.tv_nsec;
+	#else
+	key.MTIME = (int64_t)info.st_mtime;
+	#endif
+	
+	key.START = 0;
+	key.END = key.SIZE;
+	return true;
+}
+
+bool FingerprintCache::lookup(const FingerprintKey &key,
+                              Fingerprint &print) const {
+	auto byKey = [](const Record &rec, const FingerprintKey &find) {
+		return keyLess(rec.KEY, find);
+	};
+	
+	//The mapped file is never changed, so it needs no lock
+	std::shared_ptr <const Mapping> map = std::atomic_load(&m_map);
+	if(map != nullptr && map->COUNT != 0) {
+		const Record *end = map->RECORDS + map->COUNT;
+		const Record *found = std::lower_bound(map->RECORDS, end, key, byKey);
+		
+		if(found != end && keyEqual(found->KEY, key)) {
+			print = found->PRINT;
+			return true;
+		}
+	}
+	
+	//Only the writer has entries that are not flushed yet
+	if(m_writer == false) return false;
+	
+	std::lock_guard <std::mutex> lock(m_mutex);
+	auto found = std::lower_bound(m_pending.begin(), m_pending.end(), key,
+	                              byKey);
+	if(found != m_pending.end() && keyEqual(found->KEY, key)) {
+		print = found->PRINT;
+		return true;
+	}
+	
+	return false;
+}
+
+int FingerprintCache::insert(const FingerprintKey &key,
+                             const Fingerprint &print) {
+	if(m_writer == false) return errorMsg("insert() needs the writer lock");
+	
+	//Zero the padding, so the file only holds what was inserted
+	Record rec;
+	memset((void *)&rec, 0, sizeof(rec));
+	rec.KEY.DEVICE = key.DEVICE;
+	rec.KEY.INODE = key.INODE;
+	rec.KEY.SIZE = key.SIZE;
+	rec.KEY.MTIME = key.MTIME;
+	rec.KEY.START = key.START;
+	rec.KEY.END = key.END;
+	rec.PRINT.FAST = print.FAST;
+	memcpy(rec.PRINT.SHA1, print.SHA1, sizeof(rec.PRINT.SHA1));
+	
+	//Keep the pending entries sorted, replacing an equal key
+	std::lock_guard <std::mutex> lock(m_mutex);
+	auto found = std::lower_bound(m_pending.begin(), m_pending.end(), rec,
+	  [](const Record &a, const Record &b) { return keyLess(a.KEY, b.KEY); });
+	
+	if(found != m_pending.end() && keyEqual(found->KEY, rec.KEY)) {
+		*found = rec;
+	} else {
+		m_pending.insert(found, rec);
+	}
+	
+	return 0;
+}
+
+size_t FingerprintCache::size() const {
+	std::shared_ptr <const Mapping> map = std::atomic_load(&m_map);
+	return map ? map->COUNT : 0;
+}
+
+/*** Private Functions ********************************************************/
+std::shared_ptr <const FingerprintCache::Mapping>
+FingerprintCache::mapFile(const std::string &path) const {
+	static_assert(sizeof(Record) == 80, "Record must match the file layout");
+	static_assert(sizeof(FileHeader) == 32, "Header must be 32 bytes");
+	
+	std::shared_ptr <Mapping> map = std::make_shared <Mapping>();
+	
+	struct stat info;
+	if(stat(path.c_str(), &info) != 0) {
+		//No cache file yet is an empty cache
+		if(errno == ENOENT) return map;
+		return nullptr;
+	}
+	
+	map->DEVICE = (uint64_t)info.st_dev;
+	map->INODE = (uint64_t)info.st_ino;
+	size_t len = (size_t)info.st_size;
+	if(len < sizeof(FileHeader)) return nullptr;
+	
+	const uint8_t *data = nullptr;
+	
+	#if defined(__unix__) || defined(__APPLE__)
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0) return nullptr;
+	
+	void *addr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(addr == MAP_FAILED) return nullptr;
+	
+	map->ADDR = addr;
+	map->LEN = len;
+	data = (const uint8_t *)addr;
+	#else
+	//No mmap, read the whole file instead
+	std::ifstream in(path, std::ios::in | std::ios::binary);
+	map->COPY.resize(len);
+	in.read((char *)map->COPY.data(), (std::streamsize)len);
+	if((size_t)in.gcount() != len) return nullptr;
+	data = map->COPY.data();
+	#endif
+	
+	FileHeader header;
+	memcpy(&header, data, sizeof(header));
+	if(memcmp(header.MAGIC, cacheMagic, 4) != 0
+	   || header.VERSION != cacheVersion
+	   || header.RECORD_BYTES != sizeof(Record)
+	   || header.ENDIAN_MARK != cacheByteOrder
+	   || header.COUNT != (len - sizeof(FileHeader)) / sizeof(Record)
+	   || (len - sizeof(FileHeader)) % sizeof(Record) != 0) return nullptr;
+	
+	map->RECORDS = (const Record *)(data + sizeof(FileHeader));
+	map->COUNT = (size_t)header.COUNT;
+	return map;
+}
+
+int FingerprintCache::errorMsg(const std::string msg) const {
+	std::cerr << "Error: FingerprintCache: " << msg << '.' << std::endl;
+	return 1;
+}
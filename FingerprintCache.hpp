@@ -0,0 +1,132 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file keeps a persistent cache of bin file fingerprints (XXH64 and
+* SHA-1), for a whole file or any byte range of it such as a TRACK. Entries
+* are keyed by the file's device, inode, size and modify time, so a file is
+* only read again if it changed, and moving or renaming it costs nothing.
+*
+* The cache file is an array of fixed size records sorted by key, which is
+* memory mapped and binary searched, so opening it reads nothing and a lookup
+* touches a few pages. Any number of threads and processes can read it while
+* a single writer (held with a lock file) adds entries. flush() writes a new
+* sorted file and renames it into place, so readers always see a whole file.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef FINGERPRINT_CACHE_H
+#define FINGERPRINT_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*** Structs ******************************************************************/
+//Which file, in which state, and which bytes of it
+struct FingerprintKey {
+	uint64_t DEVICE = 0; //st_dev
+	uint64_t INODE = 0; //st_ino
+	uint64_t SIZE = 0; //File size
+	int64_t MTIME = 0; //Modify time in nanoseconds (seconds on some systems)
+	uint64_t START = 0; //Byte range. 0 to SIZE is the whole file
+	uint64_t END = 0;
+};
+
+//The hashes of a byte range
+struct Fingerprint {
+	uint64_t FAST = 0; //XXH64
+	uint8_t SHA1[20] = {0};
+};
+
+/*** FingerprintCache Class ***************************************************/
+class FingerprintCache {
+	public:
+	FingerprintCache() { }
+	
+	//Writes nothing. Call flush() to keep inserted entries
+	~FingerprintCache() { close(); }
+	
+	/** Cache File Functions **************************************************/
+	//Open a cache file. A missing file is an empty cache, created by the
+	//first flush(). With -writer- set, the writer lock is taken. Returns 0 on
+	//success, 1 if the file is corrupt or another writer holds the lock
+	int open(const std::string path, const bool writer = false);
+	
+	//Drop the mapping, the unflushed entries and the writer lock
+	void close();
+	
+	//Map the cache file again if the writer has replaced it since it was
+	//opened, to see its new entries. Returns 0 on success
+	int reload();
+	
+	//Write every inserted entry into the cache file (writer only). Entries
+	//for a file whose size or modify time changed are dropped. Returns 0 on
+	//success
+	int flush();
+	
+	/** Lookup Functions ******************************************************/
+	//Fill the DEVICE, INODE, SIZE and MTIME of a key from a file, and set
+	//the range to the whole file. Returns false if the file cannot be stat'd
+	static bool fileKey(const std::string &path, FingerprintKey &key);
+	
+	//Find the fingerprint of a key. Returns true if it is cached. Lookups in
+	//the cache file take no lock, and any thread can call this at any time
+	bool lookup(const FingerprintKey &key, Fingerprint &print) const;
+	
+	//Add a fingerprint (writer only). lookup() finds it at once, flush()
+	//writes it to the cache file. Returns 0 on success
+	int insert(const FingerprintKey &key, const Fingerprint &print);
+	
+	//Entries in the mapped cache file, not counting unflushed ones
+	size_t size() const;
+	
+	//Returns true if this object holds the writer lock
+	bool writer() const { return m_writer; }
+	
+	private:
+	//One record in the cache file. Fixed size, so the file can be mapped
+	struct Record {
+		FingerprintKey KEY;
+		Fingerprint PRINT;
+	};
+	
+	//A mapped cache file. Kept alive by every lookup using it
+	struct Mapping {
+		const Record *RECORDS = nullptr;
+		size_t COUNT = 0;
+		void *ADDR = nullptr; //mmap'd region, or
+		size_t LEN = 0;
+		std::vector <uint8_t> COPY; //the file read into memory without mmap
+		uint64_t DEVICE = 0; //Identity of the mapped file, for reload()
+		uint64_t INODE = 0;
+		
+		~Mapping();
+	};
+	
+	std::string m_path;
+	bool m_writer = false;
+	int m_lockFd = -1;
+	
+	//Swapped with std::atomic_store, read with std::atomic_load
+	std::shared_ptr <const Mapping> m_map;
+	
+	//Entries inserted since the last flush, sorted by key
+	mutable std::mutex m_mutex;
+	std::vector <Record> m_pending;
+	
+	//Map -path-. A missing file gives an empty mapping. Returns nullptr if
+	//it is corrupt
+	std::shared_ptr <const Mapping> mapFile(const std::string &path) const;
+	
+	//Print an error message to std::cerr, returns 1 for failure
+	int errorMsg(const std::string msg) const;
+};
+
+#endif
@@ -0,0 +1,261 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file converts raw data TRACKs to cooked .iso images. See ImageConvert.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "ImageConvert.hpp"
+#include "CDSector.hpp"
+#include "CueHandler.hpp"
+#include "SparseWriter.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+/*** Double buffered writer ***************************************************/
+namespace {
+//Two buffers are filled in turn by the reader. The writer thread empties
+//whichever is full, so reading and writing overlap.
+class DoubleBufferWriter {
+	public:
+	DoubleBufferWriter(SparseWriter &out, const size_t bufferBytes)
+	  : m_out(out) {
+		for(int slot = 0; slot < 2; slot++) {
+			m_data[slot].resize(bufferBytes);
+			m_len[slot] = 0;
+			m_full[slot] = false;
+		}
+		
+		m_thread = std::thread(&DoubleBufferWriter::writeLoop, this);
+	}
+	
+	~DoubleBufferWriter() { finish(); }
+	
+	//Waits for the next buffer to be free and returns it to fill
+	uint8_t *acquire() {
+		std::unique_lock <std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [&]() { return m_full[m_fillSlot] == false; });
+		return m_data[m_fillSlot].data();
+	}
+	
+	//Hands the buffer from acquire() to the writer with -len- bytes in it
+	void submit(const size_t len) {
+		std::lock_guard <std::mutex> lock(m_mutex);
+		m_len[m_fillSlot] = len;
+		m_full[m_fillSlot] = true;
+		m_fillSlot ^= 1;
+		m_cond.notify_all();
+	}
+	
+	//Waits for all submitted buffers to be written, then stops the thread
+	void finish() {
+		{
+			std::lock_guard <std::mutex> lock(m_mutex);
+			m_done = true;
+			m_cond.notify_all();
+		}
+		
+		if(m_thread.joinable()) m_thread.join();
+	}
+	
+	private:
+	SparseWriter &m_out;
+	std::vector <uint8_t> m_data[2];
+	size_t m_len[2];
+	bool m_full[2];
+	int m_fillSlot = 0;
+	bool m_done = false;
+	
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::thread m_thread;
+	
+	void writeLoop() {
+		int writeSlot = 0;
+		
+		while(true) {
+			{
+				std::unique_lock <std::mutex> lock(m_mutex);
+				m_cond.wait(lock, [&]() { return m_full[writeSlot] || m_done; });
+				if(m_full[writeSlot] == false) return;
+			}
+			
+			//Write without holding the lock, the reader fills the other slot
+			m_out.write(m_data[writeSlot].data(), m_len[writeSlot]);
+			
+			{
+				std::lock_guard <std::mutex> lock(m_mutex);
+				m_full[writeSlot] = false;
+				m_cond.notify_all();
+			}
+			
+			writeSlot ^= 1;
+		}
+	}
+};
+} //namespace
+
+/*** ISOConverter Functions ***************************************************/
+ISOConverter::ISOConverter(CueHandler &cue) : m_cue(cue) { }
+
+int ISOConverter::errorMsg(const std::string msg) {
+	std::cerr << "Error: ISOConverter: " << msg << '.' << std::endl;
+	return 1;
+}
+
+int ISOConverter::convert(const std::string isoPath,
+                          const std::string cuePath) {
+	m_report = ConvertReport();
+	
+	//Find the first raw data TRACK
+	std::vector <TrackSpan> spans = m_cue.getTrackSpans();
+	const TrackSpan *dataSpan = nullptr;
+	for(size_t cSpan = 0; cSpan < spans.size(); cSpan++) {
+		t_TRACK type = spans[cSpan].TYPE;
+		
+		if(type == t_TRACK::MODE1_2352 || type == t_TRACK::MODE2_2352
+		|| type == t_TRACK::CDI_2352 || type == t_TRACK::MODE2_2336
+		|| type == t_TRACK::CDI_2336) {
+			dataSpan = &spans[cSpan];
+			break;
+		}
+	}
+	
+	if(dataSpan == nullptr) return errorMsg("No raw data TRACK to convert");
+	
+	//CueHandler exits on a bad .cue path, so check it before any work is done
+	if(cuePath.find(".cue") == std::string::npos
+	   && cuePath.find(".CUE") == std::string::npos) {
+		return errorMsg(cuePath + " is not a .cue file");
+	}
+	
+	//Make sure the .cue can be created. An existing one is left as it is
+	struct stat info;
+	bool cueExisted = (stat(cuePath.c_str(), &info) == 0);
+	{
+		std::ofstream cueProbe(cuePath, std::ios::out | std::ios::app);
+		if(cueProbe.is_open() == false) {
+			return errorMsg("Could not create " + cuePath);
+		}
+	}
+	if(cueExisted == false) std::remove(cuePath.c_str());
+	
+	std::ifstream binFile(dataSpan->PATH, std::ios::in | std::ios::binary);
+	if(binFile.is_open() == false) {
+		return errorMsg("Could not open " + dataSpan->PATH);
+	}
+	
+	SparseWriter isoFile;
+	if(isoFile.open(isoPath) != 0) {
+		return errorMsg("Could not create " + isoPath);
+	}
+	
+	size_t sectSize = m_cue.TRACKSectorSize(dataSpan->TYPE);
+	unsigned long long firstSector = dataSpan->START / sectSize;
+	unsigned long long lastSector = dataSpan->END / sectSize;
+	
+	//2336 byte sectors start at the subheader, so the data is 16 bytes sooner
+	size_t sectorShift = SECTOR_RAW - sectSize;
+	
+	std::vector <uint8_t> rawBuffer(m_batch * sectSize);
+	binFile.seekg((std::streamoff)(firstSector * sectSize));
+	
+	//Batches inside a hole of the bin file are all zero, so are not read
+	std::vector <FileHole> holes = fileHoles(dataSpan->PATH,
+	                                         firstSector * sectSize,
+	                                         lastSector * sectSize);
+	size_t cHole = 0;
+	
+	{
+		DoubleBufferWriter writer(isoFile, m_batch * 2048);
+		
+		unsigned long long sector = firstSector;
+		while(sector < lastSector) {
+			size_t count = m_batch;
+			if(lastSector - sector < count) count = (size_t)(lastSector - sector);
+			
+			unsigned long long batchStart = sector * sectSize;
+			unsigned long long batchEnd = (sector + count) * sectSize;
+			while(cHole < holes.size() && holes[cHole].END <= batchStart) {
+				++cHole;
+			}
+			
+			if(cHole < holes.size() && holes[cHole].START <= batchStart
+			   && holes[cHole].END >= batchEnd) {
+				uint8_t *cooked = writer.acquire();
+				memset(cooked, 0, count * 2048);
+				writer.submit(count * 2048);
+				
+				binFile.seekg((std::streamoff)batchEnd);
+				sector += count;
+				m_report.sectors += count;
+				continue;
+			}
+			
+			std::streamsize readBytes = (std::streamsize)(count * sectSize);
+			binFile.read((char *)rawBuffer.data(), readBytes);
+			if(binFile.gcount() != readBytes) break;
+			
+			//Gather the 2048 byte user data out of every raw sector
+			uint8_t *cooked = writer.acquire();
+			for(size_t cSect = 0; cSect < count; cSect++) {
+				const uint8_t *raw = rawBuffer.data() + cSect * sectSize;
+				
+				//Mode 1 data follows the header, Mode 2 follows the subheader
+				size_t dataOffset = SECTOR_DATA_M2;
+				if(sectorShift == 0 && raw[SECTOR_HEADER + 3] == 1) {
+					dataOffset = SECTOR_DATA_M1;
+				}
+				
+				memcpy(cooked + cSect * 2048, raw + dataOffset - sectorShift,
+				       2048);
+			}
+			writer.submit(count * 2048);
+			
+			sector += count;
+			m_report.sectors += count;
+		}
+		
+		writer.finish();
+	}
+	
+	m_report.bytesWritten = m_report.sectors * 2048;
+	m_report.holeBytes = isoFile.holeBytes();
+	
+	//Do not leave a partial .iso behind
+	if(isoFile.close() != 0) {
+		std::remove(isoPath.c_str());
+		return errorMsg("Failed writing " + isoPath);
+	}
+	
+	if(m_report.sectors != lastSector - firstSector) {
+		std::remove(isoPath.c_str());
+		return errorMsg("Bin file ended before the end of the TRACK");
+	}
+	
+	//The new .cue references the .iso by name, relative to the .cue
+	std::string isoName = isoPath;
+	if(isoName.find('/') != std::string::npos) {
+		isoName = isoName.substr(isoName.find_last_of('/') + 1);
+	}
+	
+	CueHandler isoCue(cuePath);
+	isoCue.pushFILE(isoName, t_FILE::BINARY);
+	isoCue.pushTRACK(1, t_TRACK::MODE1_2048);
+	isoCue.pushINDEXFrames(1, 0);
+	isoCue.outputCueFile();
+	
+	return 0;
+}
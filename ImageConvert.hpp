@@ -0,0 +1,61 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file converts raw data TRACKs (MODE1/2352, MODE2/2352) into cooked
+* 2048 byte per sector .iso images, with a matching MODE1/2048 .cue file.
+* Sectors are read in large batches, and a second thread writes one batch
+* while the next is being read (double buffering). The .iso is written
+* sparsely: zero runs, and batches that are holes in the bin file, are left
+* as holes instead of being read or written.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef IMAGE_CONVERT_H
+#define IMAGE_CONVERT_H
+
+#include <cstddef>
+#include <string>
+
+#include "CueHandler.hpp"
+
+//Totals from a convert() run
+struct ConvertReport {
+	unsigned long long sectors = 0; //Sectors converted
+	unsigned long long bytesWritten = 0; //Bytes written to the .iso
+	unsigned long long holeBytes = 0; //Of those, left as holes in the .iso
+};
+
+class ISOConverter {
+	public:
+	//Takes a CueHandler with its cue data already loaded (getCueData)
+	ISOConverter(CueHandler &cue);
+	
+	/** Configuration Functions ***********************************************/
+	//Sectors read per batch. Each of the two write buffers holds one batch
+	void setBatchSectors(const size_t sectors) { this->m_batch = sectors; }
+	
+	/** Conversion ************************************************************/
+	//Converts the first raw data TRACK to a cooked image at isoPath, then
+	//writes a .cue with a single MODE1/2048 TRACK referencing it to cuePath.
+	//MODE2 Form 2 sectors keep only their first 2048 bytes of user data, like
+	//any cooked image. cuePath must be a .cue path that can be created.
+	//Returns 0 on success, 1 on failure, and no .iso is left on failure.
+	int convert(const std::string isoPath, const std::string cuePath);
+	
+	//The totals of the last convert() call
+	const ConvertReport &report() const { return m_report; }
+	
+	private:
+	CueHandler &m_cue;
+	size_t m_batch = 2048;
+	ConvertReport m_report;
+	
+	//Print an error message to std::cerr, returns 1 for failure
+	int errorMsg(const std::string msg);
+};
+
+#endif
@@ -0,0 +1,525 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* ISO9660 / CD-XA filesystem index and extraction. See IsoFilesystem.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "IsoFilesystem.hpp"
+#include "CDSector.hpp"
+#include "CueHandler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+//Bytes of user data in a Form 1 (or cooked) sector
+const uint32_t ISO_BLOCK = 2048;
+
+//The volume descriptors start at sector 16
+const uint32_t ISO_VD_START = 16;
+
+//Directory record flag and XA attribute bits
+const uint8_t RECORD_DIRECTORY = 0x02;
+const uint16_t XA_FORM2 = 0x1000;
+const uint16_t XA_INTERLEAVED = 0x2000;
+const uint16_t XA_CDDA = 0x4000;
+
+//Submode bit of the XA subheader set for Form 2 sectors
+const uint8_t SUBMODE_FORM2 = 0x20;
+
+//A directory from the path table
+struct PathEntry {
+	uint32_t LBA;
+	uint16_t PARENT; //Path table number of the parent, from 1
+};
+
+inline uint16_t readLE16(const uint8_t *src) {
+	return (uint16_t)(src[0] | (src[1] << 8));
+}
+
+inline uint32_t readLE32(const uint8_t *src) {
+	return (uint32_t)src[0] | ((uint32_t)src[1] << 8)
+	     | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+inline uint16_t readBE16(const uint8_t *src) {
+	return (uint16_t)((src[0] << 8) | src[1]);
+}
+
+//Returns true if two names are the same in any case
+bool sameName(const std::string &a, const char *b, const size_t bLen) {
+	if(a.size() != bLen) return false;
+	
+	for(size_t cChr = 0; cChr < bLen; cChr++) {
+		if(toupper((unsigned char)a[cChr]) != toupper((unsigned char)b[cChr])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//Create a directory, an existing one is fine
+bool makeDir(const std::string &path) {
+	if(mkdir(path.c_str(), 0755) == 0 || errno == EEXIST) return true;
+	return false;
+}
+} //namespace
+
+/*** Index Functions **********************************************************/
+int IsoFilesystem::open(CueHandler &cue, const unsigned int trackID) {
+	close();
+	
+	//Find the TRACK, or the first one holding data
+	std::vector <TrackSpan> spans = cue.getTrackSpans();
+	const TrackSpan *span = nullptr;
+	for(const TrackSpan &cSpan : spans) {
+		if(trackID == 0 && cSpan.TYPE != t_TRACK::AUDIO
+		   && cSpan.TYPE != t_TRACK::CDG) {
+			span = &cSpan;
+			break;
+		}
+		if(trackID != 0 && cSpan.ID == trackID) {
+			span = &cSpan;
+			break;
+		}
+	}
+	if(span == nullptr) return errorMsg("No data TRACK to read");
+	
+	//Where the 2048 bytes of user data sit in each stored sector
+	switch(span->TYPE) {
+		case t_TRACK::MODE1_2048:
+			m_dataOffset = 0;
+			break;
+		
+		case t_TRACK::MODE1_2352:
+			m_dataOffset = SECTOR_DATA_M1;
+			break;
+		
+		case t_TRACK::MODE2_2336:
+		case t_TRACK::CDI_2336:
+			m_dataOffset = SECTOR_DATA_M2 - SECTOR_SUBHEADER;
+			m_mode2 = true;
+			break;
+		
+		case t_TRACK::MODE2_2352:
+		case t_TRACK::CDI_2352:
+			m_dataOffset = SECTOR_DATA_M2;
+			m_mode2 = true;
+			break;
+		
+		default:
+			return errorMsg("TRACK " + std::to_string(span->ID)
+			                + " does not hold data");
+	}
+	
+	m_path = span->PATH;
+	m_start = span->START;
+	m_sectorSize = cue.TRACKSectorSize(span->TYPE);
+	m_sectors = (span->END - span->START) / m_sectorSize;
+	
+	m_fd = ::open(m_path.c_str(), O_RDONLY);
+	if(m_fd < 0) return errorMsg("Could not open " + m_path);
+	
+	//Walk the volume descriptors to the primary one (type 1). 255 ends them
+	std::vector <uint8_t> pvd;
+	for(uint32_t lba = ISO_VD_START; ; lba++) {
+		if(readData(lba, ISO_BLOCK, pvd) != 0
+		   || memcmp(pvd.data() + 1, "CD001", 5) != 0 || pvd[0] == 255) {
+			close();
+			return errorMsg("No ISO9660 primary volume descriptor in "
+			                + m_path);
+		}
+		if(pvd[0] == 1) break;
+	}
+	
+	//Volume ID is padded with spaces
+	m_volumeID.assign((const char *)pvd.data() + 40, 32);
+	m_volumeID.erase(m_volumeID.find_last_not_of(' ') + 1);
+	
+	//Read the L (little endian) path table. Each entry is a directory, with
+	//every parent before its children
+	std::vector <uint8_t> table;
+	uint32_t tableBytes = readLE32(pvd.data() + 132);
+	if(readData(readLE32(pvd.data() + 140), tableBytes, table) != 0) {
+		close();
+		return errorMsg("Could not read the path table");
+	}
+	
+	std::vector <PathEntry> dirs;
+	for(size_t pos = 0; pos + 8 <= tableBytes; ) {
+		uint8_t nameLen = table[pos];
+		if(nameLen == 0) break;
+		
+		PathEntry dir;
+		dir.LBA = readLE32(table.data() + pos + 2);
+		dir.PARENT = readLE16(table.data() + pos + 6);
+		dirs.push_back(dir);
+		
+		//Names are padded to an even length
+		pos += 8 + nameLen + (nameLen & 1);
+	}
+	if(dirs.empty()) {
+		close();
+		return errorMsg("Empty path table");
+	}
+	
+	//The root directory, sized from its record in the volume descriptor
+	IsoEntry root;
+	root.LBA = readLE32(pvd.data() + 156 + 2);
+	root.SIZE = readLE32(pvd.data() + 156 + 10);
+	root.DIRECTORY = true;
+	m_entries.push_back(root);
+	
+	//Read the directories in path table order. Each one's entry was added
+	//while reading its parent, so no recursion is needed and every
+	//directory is read once
+	std::unordered_map <uint32_t, uint32_t> dirByLBA;
+	dirByLBA[root.LBA] = 0;
+	
+	for(size_t cDir = 0; cDir < dirs.size(); cDir++) {
+		auto found = dirByLBA.find(dirs[cDir].LBA);
+		if(found == dirByLBA.end() || (cDir != 0 && dirs[cDir].PARENT > cDir)) {
+			close();
+			return errorMsg("Path table does not match the directories");
+		}
+		
+		if(readDirectory(found->second, dirByLBA) != 0) {
+			close();
+			return errorMsg("Could not read a directory");
+		}
+	}
+	
+	return 0;
+}
+
+void IsoFilesystem::close() {
+	if(m_fd >= 0) ::close(m_fd);
+	m_fd = -1;
+	
+	m_path.clear();
+	m_start = 0;
+	m_sectors = 0;
+	m_sectorSize = 0;
+	m_dataOffset = 0;
+	m_mode2 = false;
+	
+	m_volumeID.clear();
+	m_entries.clear();
+	m_names.clear();
+}
+
+std::string IsoFilesystem::path(const size_t entryIdx) const {
+	if(entryIdx == 0 || entryIdx >= m_entries.size()) return "/";
+	
+	//Walk up to the root, then join the names back to front
+	std::vector <size_t> chain;
+	for(size_t idx = entryIdx; idx != 0; idx = m_entries[idx].PARENT) {
+		chain.push_back(idx);
+	}
+	
+	std::string fullPath;
+	for(auto it = chain.rbegin(); it != chain.rend(); ++it) {
+		fullPath += '/';
+		fullPath += name(m_entries[*it]);
+	}
+	
+	return fullPath;
+}
+
+long IsoFilesystem::find(const std::string &path) const {
+	if(m_entries.empty()) return -1;
+	
+	size_t idx = 0;
+	size_t pos = 0;
+	while(pos < path.size()) {
+		//Next path component
+		if(path[pos] == '/') {
+			++pos;
+			continue;
+		}
+		size_t end = path.find('/', pos);
+		if(end == std::string::npos) end = path.size();
+		std::string part = path.substr(pos, end - pos);
+		pos = end;
+		
+		const IsoEntry &dir = m_entries[idx];
+		if(dir.DIRECTORY == false) return -1;
+		
+		//Children of a directory are next to each other
+		size_t child = dir.FIRST_CHILD;
+		size_t last = (size_t)dir.FIRST_CHILD + dir.CHILD_COUNT;
+		for(; child < last; child++) {
+			const IsoEntry &entry = m_entries[child];
+			if(sameName(part, m_names.data() + entry.NAME, entry.NAME_LEN)) {
+				break;
+			}
+		}
+		if(child == last) return -1;
+		
+		idx = child;
+	}
+	
+	return (long)idx;
+}
+
+/*** Extraction Functions *****************************************************/
+int IsoFilesystem::extract(const size_t entryIdx, const std::string outPath) {
+	if(entryIdx >= m_entries.size() || m_entries[entryIdx].DIRECTORY) {
+		return errorMsg("Entry is not a file");
+	}
+	
+	std::vector <uint8_t> buffer;
+	return extractFile(m_entries[entryIdx], outPath, buffer);
+}
+
+int IsoFilesystem::extractAll(const std::string outDir) {
+	if(m_entries.empty()) return errorMsg("No filesystem is open");
+	
+	std::string prefix = outDir;
+	if(prefix.empty() == false && prefix.back() == '/') prefix.pop_back();
+	if(makeDir(prefix) == false) {
+		return errorMsg("Could not create directory " + prefix);
+	}
+	
+	//Parents come before their children, so directories are created in
+	//index order. Files are queued largest first, so a long STR file does
+	//not start last and hold up the end of the run
+	std::vector <size_t> files;
+	for(size_t cEntry = 1; cEntry < m_entries.size(); cEntry++) {
+		const IsoEntry &entry = m_entries[cEntry];
+		
+		if(entry.DIRECTORY) {
+			std::string dirPath = prefix + path(cEntry);
+			if(makeDir(dirPath) == false) {
+				return errorMsg("Could not create directory " + dirPath);
+			}
+		} else if(entry.CDDA == false) {
+			files.push_back(cEntry);
+		}
+	}
+	
+	std::stable_sort(files.begin(), files.end(),
+	  [this](const size_t a, const size_t b) {
+		return m_entries[a].SIZE > m_entries[b].SIZE;
+	});
+	
+	unsigned int threadCount = m_threads;
+	if(threadCount == 0) threadCount = std::thread::hardware_concurrency();
+	if(threadCount == 0) threadCount = 1;
+	if(threadCount > files.size()) threadCount = (unsigned int)files.size();
+	
+	std::atomic <size_t> nextFile(0);
+	std::atomic <int> failed(0);
+	
+	//Each worker takes the next file until none are left
+	auto worker = [&]() {
+		std::vector <uint8_t> buffer;
+		
+		size_t fileIdx;
+		while((fileIdx = nextFile.fetch_add(1)) < files.size()) {
+			size_t entryIdx = files[fileIdx];
+			if(extractFile(m_entries[entryIdx], prefix + path(entryIdx),
+			               buffer) != 0) {
+				failed = 1;
+			}
+		}
+	};
+	
+	std::vector <std::thread> threads;
+	for(unsigned int cThread = 0; cThread < threadCount; cThread++) {
+		threads.push_back(std::thread(worker));
+	}
+	for(size_t cThread = 0; cThread < threads.size(); cThread++) {
+		threads[cThread].join();
+	}
+	
+	return failed;
+}
+
+/*** Private Functions ********************************************************/
+int IsoFilesystem::readSectors(const uint32_t lba, const uint32_t count,
+                               uint8_t *buf) const {
+	if((unsigned long long)lba + count > m_sectors) return 1;
+	
+	size_t want = (size_t)count * m_sectorSize;
+	off_t offset = (off_t)(m_start + (unsigned long long)lba * m_sectorSize);
+	
+	//pread does not move a shared file position, so threads can share m_fd
+	size_t done = 0;
+	while(done < want) {
+		ssize_t got = pread(m_fd, buf + done, want - done,
+		                    offset + (off_t)done);
+		if(got < 0 && errno == EINTR) continue;
+		if(got <= 0) return 1;
+		done += (size_t)got;
+	}
+	
+	return 0;
+}
+
+int IsoFilesystem::readData(const uint32_t lba, const uint32_t bytes,
+                            std::vector <uint8_t> &data) const {
+	uint32_t count = (uint32_t)(((unsigned long long)bytes + ISO_BLOCK - 1)
+	                            / ISO_BLOCK);
+	
+	//Lengths come from the disc. Check them before allocating anything
+	if((unsigned long long)lba + count > m_sectors) return 1;
+	
+	std::vector <uint8_t> stored((size_t)count * m_sectorSize);
+	if(readSectors(lba, count, stored.data()) != 0) return 1;
+	
+	//Keep only the user data of each sector
+	data.resize((size_t)count * ISO_BLOCK);
+	for(uint32_t cSect = 0; cSect < count; cSect++) {
+		memcpy(data.data() + (size_t)cSect * ISO_BLOCK,
+		       stored.data() + (size_t)cSect * m_sectorSize + m_dataOffset,
+		       ISO_BLOCK);
+	}
+	
+	return 0;
+}
+
+int IsoFilesystem::readDirectory(const size_t dirIdx,
+                  std::unordered_map <uint32_t, uint32_t> &dirByLBA) {
+	std::vector <uint8_t> data;
+	if(readData(m_entries[dirIdx].LBA, m_entries[dirIdx].SIZE, data) != 0) {
+		return 1;
+	}
+	
+	uint32_t firstChild = (uint32_t)m_entries.size();
+	
+	//Records never cross a sector, a zero length pads out to the next one
+	size_t pos = 0;
+	while(pos < m_entries[dirIdx].SIZE && pos < data.size()) {
+		const uint8_t *record = data.data() + pos;
+		uint8_t recordLen = record[0];
+		
+		if(recordLen == 0) {
+			pos = (pos / ISO_BLOCK + 1) * ISO_BLOCK;
+			continue;
+		}
+		
+		uint8_t nameLen = record[32];
+		if(recordLen < 34 || 33u + nameLen > recordLen
+		   || pos + recordLen > data.size()) return 1;
+		pos += recordLen;
+		
+		//Skip the "." and ".." records (names 0x00 and 0x01)
+		const char *name = (const char *)record + 33;
+		if(nameLen == 1 && (name[0] == 0 || name[0] == 1)) continue;
+		
+		IsoEntry entry;
+		entry.PARENT = (uint32_t)dirIdx;
+		entry.LBA = readLE32(record + 2);
+		entry.SIZE = readLE32(record + 10);
+		entry.DIRECTORY = (record[25] & RECORD_DIRECTORY) != 0;
+		
+		//CD-XA keeps its attributes in the system use area after the name
+		size_t xaPos = 33 + nameLen + ((nameLen & 1) ? 0 : 1);
+		if(xaPos + 14 <= recordLen && record[xaPos + 6] == 'X'
+		   && record[xaPos + 7] == 'A') {
+			uint16_t attributes = readBE16(record + xaPos + 4);
+			entry.FORM2 = (attributes & (XA_FORM2 | XA_INTERLEAVED)) != 0;
+			entry.CDDA = (attributes & XA_CDDA) != 0;
+		}
+		
+		//Drop the ";1" version, and the '.' of names without an extension
+		size_t keep = nameLen;
+		const char *semi = (const char *)memchr(name, ';', nameLen);
+		if(semi != nullptr) keep = (size_t)(semi - name);
+		if(keep > 1 && name[keep - 1] == '.') --keep;
+		
+		//A name must never step out of the directory it is extracted to
+		std::string entryName(name, keep);
+		if(entryName.empty() || entryName == "." || entryName == "..") return 1;
+		std::replace(entryName.begin(), entryName.end(), '/', '_');
+		
+		entry.NAME = (uint32_t)m_names.size();
+		entry.NAME_LEN = (uint32_t)keep;
+		m_names += entryName;
+		
+		if(entry.DIRECTORY) dirByLBA[entry.LBA] = (uint32_t)m_entries.size();
+		m_entries.push_back(entry);
+	}
+	
+	m_entries[dirIdx].FIRST_CHILD = firstChild;
+	m_entries[dirIdx].CHILD_COUNT = (uint32_t)m_entries.size() - firstChild;
+	return 0;
+}
+
+int IsoFilesystem::extractFile(const IsoEntry &entry,
+                               const std::string &outPath,
+                               std::vector <uint8_t> &buffer) {
+	std::ofstream outFile(outPath, std::ios::out | std::ios::binary
+	                      | std::ios::trunc);
+	if(outFile.is_open() == false) {
+		return errorMsg("Could not create " + outPath);
+	}
+	
+	uint32_t sectors = (entry.SIZE + ISO_BLOCK - 1) / ISO_BLOCK;
+	uint32_t left = entry.SIZE;
+	bool whole = entry.FORM2 && m_mode2;
+	
+	buffer.resize(m_batch * m_sectorSize);
+	for(uint32_t done = 0; done < sectors; ) {
+		uint32_t count = sectors - done;
+		if(count > m_batch) count = (uint32_t)m_batch;
+		
+		if(readSectors(entry.LBA + done, count, buffer.data()) != 0) {
+			return errorMsg("Could not read " + outPath + " from the image");
+		}
+		
+		//A file that starts with a Form 2 sector is streamed data even if
+		//the XA attributes do not say so
+		if(done == 0 && m_mode2 && count != 0) {
+			const uint8_t *subheader = buffer.data() + m_dataOffset - 8;
+			if(subheader[2] & SUBMODE_FORM2) whole = true;
+		}
+		
+		if(whole) {
+			//Form 2 sectors are written as stored, subheader and all
+			outFile.write((const char *)buffer.data(),
+			              (std::streamsize)count * m_sectorSize);
+		} else {
+			//Pack the user data down in place, then write it in one go
+			size_t packed = 0;
+			for(uint32_t cSect = 0; cSect < count; cSect++) {
+				uint32_t bytes = std::min(left, ISO_BLOCK);
+				memmove(buffer.data() + packed,
+				        buffer.data() + (size_t)cSect * m_sectorSize
+				        + m_dataOffset, bytes);
+				packed += bytes;
+				left -= bytes;
+			}
+			outFile.write((const char *)buffer.data(),
+			              (std::streamsize)packed);
+		}
+		
+		done += count;
+	}
+	
+	if(outFile.good() == false) return errorMsg("Could not write " + outPath);
+	return 0;
+}
+
+int IsoFilesystem::errorMsg(const std::string msg) const {
+	std::cerr << "Error: IsoFilesystem: " << msg << '.' << std::endl;
+	return 1;
+}
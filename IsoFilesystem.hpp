@@ -0,0 +1,140 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file reads the ISO9660 (and CD-XA) filesystem of a data TRACK. The
+* directories are found from the path table and indexed into one flat array
+* of entries, with every directory's children stored next to each other and
+* the names kept in one string pool. Files are extracted across multiple
+* threads. XA Mode 2 Form 2 files (STR video, XA audio) carry 2324 bytes per
+* sector plus the subheader, so they are written as whole stored sectors
+* instead of being cut down to 2048 bytes.
+*
+* Sector numbers are counted from the start of the TRACK, which is how every
+* disc with its filesystem in the first TRACK (all PSX games) is laid out.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef ISO_FILESYSTEM_H
+#define ISO_FILESYSTEM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CueHandler.hpp"
+
+/*** Structs ******************************************************************/
+//A file or directory in the filesystem
+struct IsoEntry {
+	uint32_t NAME = 0; //Offset of the name in the name pool
+	uint32_t NAME_LEN = 0;
+	uint32_t PARENT = 0; //Entry index of the parent directory (root is 0)
+	uint32_t LBA = 0; //First sector, from the start of the TRACK
+	uint32_t SIZE = 0; //Bytes as recorded. Form 2 files count 2048 per sector
+	uint32_t FIRST_CHILD = 0; //Directories only. Entry index of the first child
+	uint32_t CHILD_COUNT = 0; //Directories only. Children follow FIRST_CHILD
+	bool DIRECTORY = false;
+	bool FORM2 = false; //XA Form 2 or interleaved. Extracted as whole sectors
+	bool CDDA = false; //XA link to a CDDA TRACK, holds no filesystem data
+};
+
+/*** IsoFilesystem Class ******************************************************/
+class IsoFilesystem {
+	public:
+	IsoFilesystem() { }
+	
+	//Closes the bin file
+	~IsoFilesystem() { close(); }
+	
+	/** Configuration Functions ***********************************************/
+	//Number of worker threads. 0 uses the number of hardware threads
+	void setThreads(const unsigned int threads) { this->m_threads = threads; }
+	
+	//Sectors read from disk per batch, per thread
+	void setBatchSectors(const size_t sectors) {
+		this->m_batch = (sectors == 0) ? 1 : sectors;
+	}
+	
+	/** Index Functions *******************************************************/
+	//Open the filesystem of a TRACK in a CueHandler with its cue data loaded
+	//(getCueData). trackID 0 picks the first data TRACK. The volume
+	//descriptor, path table and every directory are read into the index.
+	//Returns 0 on success, 1 on failure
+	int open(CueHandler &cue, const unsigned int trackID = 0);
+	
+	//Close the bin file and clear the index
+	void close();
+	
+	//Volume identifier from the primary volume descriptor, without padding
+	const std::string &volumeID() const { return m_volumeID; }
+	
+	//Every entry. Entry 0 is the root directory, parents come before their
+	//children
+	const std::vector <IsoEntry> &entries() const { return m_entries; }
+	
+	//Name of an entry, without the ";1" version suffix
+	std::string name(const IsoEntry &entry) const {
+		return m_names.substr(entry.NAME, entry.NAME_LEN);
+	}
+	
+	//Full path of an entry, "/DIR/FILE.EXT". The root is "/"
+	std::string path(const size_t entryIdx) const;
+	
+	//Entry index of a path (any case, with or without the leading '/'), or
+	//-1 if it does not exist
+	long find(const std::string &path) const;
+	
+	/** Extraction Functions **************************************************/
+	//Extract one file entry to -outPath-. Returns 0 on success, 1 on failure
+	int extract(const size_t entryIdx, const std::string outPath);
+	
+	//Extract every directory and file under -outDir-, with the files shared
+	//between worker threads. Returns 0 on success, 1 if anything failed
+	int extractAll(const std::string outDir);
+	
+	private:
+	unsigned int m_threads = 0;
+	size_t m_batch = 64;
+	
+	//The TRACK being read
+	int m_fd = -1;
+	std::string m_path;
+	unsigned long long m_start = 0; //Byte offset of the TRACK in the bin file
+	unsigned long long m_sectors = 0; //Stored sectors in the TRACK
+	unsigned int m_sectorSize = 0; //Bytes per stored sector
+	size_t m_dataOffset = 0; //Offset of the 2048 bytes of user data
+	bool m_mode2 = false; //Stored sectors carry an XA subheader
+	
+	std::string m_volumeID;
+	std::vector <IsoEntry> m_entries;
+	std::string m_names; //Every name, back to back
+	
+	//Read -count- stored sectors starting at -lba- into -buf-. Returns 0 on
+	//success, 1 if they are past the end of the TRACK or could not be read
+	int readSectors(const uint32_t lba, const uint32_t count,
+	                uint8_t *buf) const;
+	
+	//Read -bytes- of user data (2048 per sector) starting at -lba-
+	int readData(const uint32_t lba, const uint32_t bytes,
+	             std::vector <uint8_t> &data) const;
+	
+	//Add the children of a directory entry to the index, noting where each
+	//subdirectory entry is by its LBA
+	int readDirectory(const size_t dirIdx,
+	                  std::unordered_map <uint32_t, uint32_t> &dirByLBA);
+	
+	//Extract one file using a caller owned buffer
+	int extractFile(const IsoEntry &entry, const std::string &outPath,
+	                std::vector <uint8_t> &buffer);
+	
+	//Print an error message to std::cerr, returns 1 for failure
+	int errorMsg(const std::string msg) const;
+};
+
+#endif
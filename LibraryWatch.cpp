@@ -0,0 +1,396 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* inotify watch of a library tree. See LibraryWatch.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "LibraryWatch.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+//Room for a batch of events
+const size_t eventBufferBytes = 64 * 1024;
+
+#if defined(__linux__)
+//Directory events that can concern a disc. IN_MODIFY only pushes the deadline
+//of a bin file being written, IN_CLOSE_WRITE is the end of the write
+const uint32_t watchMask = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE
+                         | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+#endif
+
+//Returns true if the name ends in .cue, in any case
+bool isCueName(const std::string &name) {
+	if(name.size() < 4) return false;
+	
+	std::string ext = name.substr(name.size() - 4);
+	for(char &chr : ext) chr = (char)tolower((unsigned char)chr);
+	return ext == ".cue";
+}
+
+//Returns the directory part of a path, ending in '/'
+std::string dirName(const std::string &path) {
+	size_t slash = path.find_last_of('/');
+	if(slash == std::string::npos) return "./";
+	return path.substr(0, slash + 1);
+}
+
+//Read a whole file. Returns 1 if it cannot be opened or is not a file
+int readFile(const std::string &path, std::string &text) {
+	struct stat info;
+	if(stat(path.c_str(), &info) != 0 || S_ISREG(info.st_mode) == false) {
+		return 1;
+	}
+	
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if(file.is_open() == false) return 1;
+	
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	text = contents.str();
+	return 0;
+}
+} //namespace
+
+/*** Watch Functions **********************************************************/
+int LibraryWatch::open(const std::string root) {
+	close();
+	
+	m_root = root;
+	if(m_root.empty() == false && m_root.back() != '/') m_root.push_back('/');
+	
+	#if defined(__linux__)
+	m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(m_fd < 0) return errorMsg("Could not start inotify");
+	
+	struct stat info;
+	if(stat(m_root.c_str(), &info) != 0 || S_ISDIR(info.st_mode) == false) {
+		close();
+		return errorMsg("Could not open directory " + root);
+	}
+	
+	addTree(m_root);
+	
+	//Nothing to wait for on the first poll()
+	t_clock::time_point due = t_clock::now()
+	                        - std::chrono::milliseconds(m_debounce);
+	for(auto &dirty : m_dirty) dirty.second = due;
+	
+	return 0;
+	#else
+	return errorMsg("Watching needs inotify (Linux)");
+	#endif
+}
+
+void LibraryWatch::close() {
+	#if defined(__linux__)
+	if(m_fd >= 0) ::close(m_fd);
+	#endif
+	
+	m_fd = -1;
+	m_watches.clear();
+	m_dirty.clear();
+}
+
+int LibraryWatch::poll(const int timeoutMs) {
+	m_changed.clear();
+	if(m_fd < 0) return -1;
+	
+	#if defined(__linux__)
+	const t_clock::duration debounce = std::chrono::milliseconds(m_debounce);
+	
+	//Wake up when the first waiting disc is due, if that is sooner
+	int wait = timeoutMs;
+	if(m_dirty.empty() == false) {
+		t_clock::time_point first = t_clock::time_point::max();
+		for(const auto &dirty : m_dirty) first = std::min(first, dirty.second);
+		
+		//Rounded up, so the disc is due when the wait ends
+		t_clock::duration left = first + debounce - t_clock::now();
+		long long dueMs = std::chrono::duration_cast
+		                  <std::chrono::milliseconds>(left).count() + 1;
+		if(left <= t_clock::duration::zero()) dueMs = 0;
+		if(wait < 0 || dueMs < wait) wait = (int)dueMs;
+	}
+	
+	struct pollfd pfd;
+	pfd.fd = m_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	
+	int ready = ::poll(&pfd, 1, wait);
+	if(ready < 0 && errno != EINTR) {
+		errorMsg("Waiting for inotify events failed");
+		return -1;
+	}
+	if(ready > 0 && readEvents() != 0) return -1;
+	
+	//Index the discs that have been quiet long enough, in path order
+	t_clock::time_point now = t_clock::now();
+	std::vector <std::string> due;
+	for(const auto &dirty : m_dirty) {
+		if(now - dirty.second >= debounce) due.push_back(dirty.first);
+	}
+	std::sort(due.begin(), due.end());
+	
+	for(const std::string &cuePath : due) {
+		m_dirty.erase(cuePath);
+		indexDisc(cuePath);
+		m_changed.push_back(cuePath);
+	}
+	
+	//Keep the new hashes
+	if(due.empty() == false && m_cache != nullptr && m_cache->writer()) {
+		if(m_cache->flush() != 0) errorMsg("Could not flush the cache");
+	}
+	
+	return (int)m_changed.size();
+	#else
+	(void)timeoutMs;
+	return -1;
+	#endif
+}
+
+/*** Private Functions ********************************************************/
+void LibraryWatch::addTree(const std::string dir) {
+	#if defined(__linux__)
+	//Watch before listing, so a file created in between is not missed. The
+	//same directory gives back the same descriptor
+	int wd = inotify_add_watch(m_fd, dir.c_str(), watchMask);
+	if(wd < 0) {
+		errorMsg("Could not watch " + dir);
+		return;
+	}
+	m_watches[wd] = dir;
+	
+	DIR *dirHandle = opendir(dir.c_str());
+	if(dirHandle == nullptr) return;
+	
+	struct dirent *entry;
+	while((entry = readdir(dirHandle)) != nullptr) {
+		std::string name = entry->d_name;
+		if(name == "." || name == "..") continue;
+		
+		std::string path = dir + name;
+		struct stat info;
+		if(lstat(path.c_str(), &info) != 0) continue;
+		
+		if(S_ISDIR(info.st_mode)) {
+			addTree(path + "/");
+		} else if(isCueName(name)) {
+			markDirty(path);
+		}
+	}
+	
+	closedir(dirHandle);
+	#else
+	(void)dir;
+	#endif
+}
+
+void LibraryWatch::removeTree(const std::string &dir) {
+	#if defined(__linux__)
+	for(auto watch = m_watches.begin(); watch != m_watches.end(); ) {
+		if(watch->second.compare(0, dir.size(), dir) == 0) {
+			inotify_rm_watch(m_fd, watch->first);
+			watch = m_watches.erase(watch);
+		} else {
+			++watch;
+		}
+	}
+	#endif
+	
+	for(const auto &disc : m_catalogue) {
+		if(disc.first.compare(0, dir.size(), dir) == 0) markDirty(disc.first);
+	}
+}
+
+int LibraryWatch::readEvents() {
+	#if defined(__linux__)
+	//inotify_event needs its alignment
+	alignas(struct inotify_event) char buffer[eventBufferBytes];
+	
+	while(true) {
+		ssize_t got = read(m_fd, buffer, sizeof(buffer));
+		if(got < 0 && errno == EINTR) continue;
+		if(got < 0 && errno == EAGAIN) break;
+		if(got <= 0) return errorMsg("Reading inotify events failed");
+		
+		ssize_t pos = 0;
+		while(pos < got) {
+			const struct inotify_event *event =
+			  (const struct inotify_event *)(buffer + pos);
+			pos += (ssize_t)(sizeof(struct inotify_event) + event->len);
+			
+			//Events were lost. Look at the whole tree again
+			if(event->mask & IN_Q_OVERFLOW) {
+				for(const auto &disc : m_catalogue) markDirty(disc.first);
+				addTree(m_root);
+				continue;
+			}
+			
+			//The directory is gone, or was never a directory
+			if(event->mask & IN_IGNORED) {
+				m_watches.erase(event->wd);
+				continue;
+			}
+			
+			auto watch = m_watches.find(event->wd);
+			if(watch == m_watches.end() || event->len == 0) continue;
+			std::string path = watch->second + event->name;
+			
+			if(event->mask & IN_ISDIR) {
+				if(event->mask & (IN_CREATE | IN_MOVED_TO)) addTree(path + "/");
+				if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+					removeTree(path + "/");
+				}
+				continue;
+			}
+			
+			fileChanged(path);
+		}
+	}
+	
+	return 0;
+	#else
+	return 1;
+	#endif
+}
+
+void LibraryWatch::markDirty(const std::string &cuePath) {
+	m_dirty[cuePath] = t_clock::now();
+}
+
+void LibraryWatch::fileChanged(const std::string &path) {
+	if(isCueName(path)) {
+		markDirty(path);
+		return;
+	}
+	
+	auto bin = m_binCues.find(path);
+	if(bin == m_binCues.end()) return;
+	
+	for(const std::string &cuePath : bin->second) markDirty(cuePath);
+}
+
+void LibraryWatch::indexDisc(const std::string &cuePath) {
+	auto old = m_catalogue.find(cuePath);
+	
+	//The .cue is gone, drop the disc
+	std::string text;
+	if(readFile(cuePath, text) != 0) {
+		if(old != m_catalogue.end()) {
+			setBins(cuePath, std::vector <std::string>());
+			m_catalogue.erase(old);
+		}
+		return;
+	}
+	
+	DiscEntry disc;
+	disc.CUE_PATH = cuePath;
+	if(old != m_catalogue.end()) {
+		disc.GENERATION = old->second.GENERATION;
+		
+		//Until it parses again, changes to the old bin files still count
+		disc.BINS = old->second.BINS;
+	}
+	disc.GENERATION++;
+	
+	//A .cue that is corrupt or still being written throws instead of exiting
+	try {
+		RecoverableCueHandler parsed(cuePath);
+		parsed.parseCueData(text.data(), text.size());
+		disc.CUE = parsed.snapshot();
+		disc.PARSED = true;
+	} catch(const CueError &err) {
+		disc.ERROR = err.what();
+		if(disc.ERROR.empty() == false && disc.ERROR.back() == '\n') {
+			disc.ERROR.pop_back();
+		}
+	}
+	
+	if(disc.PARSED) {
+		//Checking and hashing take a CueHandler
+		CueHandler cue(cuePath);
+		cue.restore(disc.CUE);
+		
+		//Bin files are relative to the directory of the .cue file
+		bool binsFound = true;
+		disc.BINS.clear();
+		for(const FileData &pFILE : cue.FILE) {
+			std::string binPath = dirName(cuePath) + pFILE.FILENAME;
+			
+			struct stat info;
+			if(stat(binPath.c_str(), &info) != 0) binsFound = false;
+			disc.BINS.push_back(binPath);
+		}
+		
+		TrackChecker checker;
+		checker.setThreads(m_threads);
+		checker.addCue(cue);
+		disc.CHECKS = checker.check();
+		
+		TrackDedup dedup;
+		dedup.setThreads(m_threads);
+		dedup.setFingerprintCache(m_cache);
+		dedup.addCue(cue);
+		bool hashed = (dedup.hashTracks() == 0);
+		disc.TRACKS = dedup.tracks();
+		
+		for(const TrackHash &track : disc.TRACKS) {
+			if(track.HASHED == false) hashed = false;
+		}
+		
+		//A TRACK that could not be read was not checked either
+		bool matched = true;
+		for(const TrackCheckResult &check : disc.CHECKS) {
+			if(check.MISMATCH || check.UNREADABLE) matched = false;
+		}
+		
+		disc.VERIFIED = binsFound && hashed && matched;
+	}
+	
+	setBins(cuePath, disc.BINS);
+	m_catalogue[cuePath] = std::move(disc);
+}
+
+void LibraryWatch::setBins(const std::string &cuePath,
+                           const std::vector <std::string> &bins) {
+	auto old = m_catalogue.find(cuePath);
+	if(old != m_catalogue.end()) {
+		for(const std::string &binPath : old->second.BINS) {
+			auto bin = m_binCues.find(binPath);
+			if(bin == m_binCues.end()) continue;
+			
+			bin->second.erase(cuePath);
+			if(bin->second.empty()) m_binCues.erase(bin);
+		}
+	}
+	
+	for(const std::string &binPath : bins) m_binCues[binPath].insert(cuePath);
+}
+
+int LibraryWatch::errorMsg(const std::string msg) {
+	std::cerr << "Error: LibraryWatch: " << msg << '.' << std::endl;
+	return 1;
+}
@@ -0,0 +1,155 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file keeps a catalogue of every disc (.cue file) in a library tree up
+* to date while the tree changes. Every directory is watched with inotify, and
+* a change to a .cue file, or to a bin file a .cue references, only indexes
+* that one disc again: the .cue is parsed, its TRACKs are sampled by
+* TrackChecker and hashed by TrackDedup (through a FingerprintCache, so bin
+* files that did not change are not read).
+*
+* Events come in storms (a bin file being copied sends thousands), so they are
+* coalesced per disc, and a disc is only indexed once its files have been quiet
+* for the debounce time.
+*
+* inotify is Linux only. Elsewhere open() fails.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef LIBRARY_WATCH_H
+#define LIBRARY_WATCH_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CueHandler.hpp"
+#include "FingerprintCache.hpp"
+#include "TrackCheck.hpp"
+#include "TrackDedup.hpp"
+
+/*** Structs ******************************************************************/
+//One disc in the catalogue
+struct DiscEntry {
+	std::string CUE_PATH;
+	CueSnapshot CUE; //Parsed FILE data. Empty if the .cue could not be parsed
+	std::vector <std::string> BINS; //Bin files the .cue references
+	std::vector <TrackHash> TRACKS; //Hashes of every TRACK
+	std::vector <TrackCheckResult> CHECKS; //Sampled sectors of every TRACK
+	
+	bool PARSED = false; //False if the .cue is unreadable or half written
+	std::string ERROR; //Why the .cue could not be parsed
+	bool VERIFIED = false; //Every bin found, read and hashed, no mismatches
+	uint64_t GENERATION = 0; //Times the disc has been indexed
+};
+
+/*** LibraryWatch Class *******************************************************/
+//poll() and the catalogue must be used from one thread
+class LibraryWatch {
+	public:
+	LibraryWatch() { }
+	
+	//Stops watching
+	~LibraryWatch() { close(); }
+	
+	/** Configuration Functions ***********************************************/
+	//Number of worker threads for checking and hashing. 0 uses the number of
+	//hardware threads
+	void setThreads(const unsigned int threads) { this->m_threads = threads; }
+	
+	//Milliseconds a disc's files must be quiet before it is indexed
+	void setDebounce(const unsigned int ms) { this->m_debounce = ms; }
+	
+	//Hash TRACKs through a FingerprintCache. If it was opened as the writer,
+	//new hashes are added and it is flushed after every batch of discs
+	void setFingerprintCache(FingerprintCache *cache) {
+		this->m_cache = cache;
+	}
+	
+	/** Watch Functions *******************************************************/
+	//Watch every directory under -root-, and queue every .cue file in it to
+	//be indexed by the first poll(). Returns 0 on success, 1 on failure
+	int open(const std::string root);
+	
+	//Stop watching. The catalogue is kept
+	void close();
+	
+	//Wait up to -timeoutMs- (-1 for ever) for changes, then index every disc
+	//that has been quiet for the debounce time. Returns early when events
+	//arrive, so call it in a loop. Returns the number of discs indexed or
+	//removed, or -1 on error
+	int poll(const int timeoutMs);
+	
+	/** Catalogue Functions ***************************************************/
+	//Every disc, by .cue path
+	const std::map <std::string, DiscEntry> &catalogue() const {
+		return m_catalogue;
+	}
+	
+	//.cue paths indexed (or removed from the catalogue) by the last poll()
+	const std::vector <std::string> &changed() const { return m_changed; }
+	
+	//Discs waiting for their files to be quiet
+	size_t pending() const { return m_dirty.size(); }
+	
+	private:
+	typedef std::chrono::steady_clock t_clock;
+	
+	unsigned int m_threads = 0;
+	unsigned int m_debounce = 2000;
+	FingerprintCache *m_cache = nullptr;
+	
+	std::string m_root;
+	int m_fd = -1;
+	
+	//Watched directory of each watch descriptor, ending in '/'
+	std::unordered_map <int, std::string> m_watches;
+	
+	//The .cue files referencing each bin file, missing ones included so
+	//that their arrival is noticed
+	std::unordered_map <std::string, std::set <std::string>> m_binCues;
+	
+	//Discs with changes, and when their last event was
+	std::unordered_map <std::string, t_clock::time_point> m_dirty;
+	
+	std::map <std::string, DiscEntry> m_catalogue;
+	std::vector <std::string> m_changed;
+	
+	//Watch a directory and every directory under it, and queue their .cue
+	//files
+	void addTree(const std::string dir);
+	
+	//Stop watching every directory under -dir- (removed or moved away), and
+	//queue the discs in it so they are dropped
+	void removeTree(const std::string &dir);
+	
+	//Read every waiting inotify event. Returns 1 on failure
+	int readEvents();
+	
+	//Queue a disc, or push its deadline back
+	void markDirty(const std::string &cuePath);
+	
+	//A file changed. Queues the .cue, or every .cue using the bin file
+	void fileChanged(const std::string &path);
+	
+	//Parse, check and hash one disc, or remove it if the .cue is gone
+	void indexDisc(const std::string &cuePath);
+	
+	//Replace the bin files a disc is listed under in m_binCues
+	void setBins(const std::string &cuePath,
+	             const std::vector <std::string> &bins);
+	
+	//Print an error message to std::cerr, returns 1 for failure
+	int errorMsg(const std::string msg);
+};
+
+#endif
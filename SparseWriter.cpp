@@ -0,0 +1,295 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* Sparse image file output. See SparseWriter.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "SparseWriter.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+//Zero runs are found in blocks this size, lined up with the output offset so
+//that whole filesystem blocks are left out
+const size_t SPARSE_BLOCK = 4096;
+
+//Zeros for writing runs that cannot be left as holes
+const uint8_t zeroBlock[SPARSE_BLOCK] = {0};
+} //namespace
+
+/*** Helper Functions *********************************************************/
+bool bytesAreZero(const uint8_t *data, const size_t len) {
+	size_t pos = 0;
+	
+	#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	for(; pos + 64 <= len; pos += 64) {
+		const __m128i *vec = (const __m128i *)(data + pos);
+		__m128i acc = _mm_or_si128(
+		  _mm_or_si128(_mm_loadu_si128(vec), _mm_loadu_si128(vec + 1)),
+		  _mm_or_si128(_mm_loadu_si128(vec + 2), _mm_loadu_si128(vec + 3)));
+		
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF) {
+			return false;
+		}
+	}
+	#else
+	for(; pos + 64 <= len; pos += 64) {
+		uint64_t words[8];
+		memcpy(words, data + pos, sizeof(words));
+		
+		uint64_t acc = 0;
+		for(int cWord = 0; cWord < 8; cWord++) acc |= words[cWord];
+		if(acc != 0) return false;
+	}
+	#endif
+	
+	for(; pos < len; pos++) {
+		if(data[pos] != 0) return false;
+	}
+	
+	return true;
+}
+
+std::vector <FileHole> fileHoles(const std::string &path,
+                                 const unsigned long long start,
+                                 const unsigned long long end) {
+	std::vector <FileHole> holes;
+	
+	#if defined(SEEK_HOLE) && defined(SEEK_DATA)
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0) return holes;
+	
+	struct stat info;
+	unsigned long long last = end;
+	if(fstat(fd, &info) == 0 && (unsigned long long)info.st_size < last) {
+		last = (unsigned long long)info.st_size;
+	}
+	
+	//Filesystems without holes report one at the end of the file, which is
+	//past -last-
+	unsigned long long pos = start;
+	while(pos < last) {
+		off_t hole = lseek(fd, (off_t)pos, SEEK_HOLE);
+		if(hole < 0 || (unsigned long long)hole >= last) break;
+		
+		//No data after the hole means it runs to the end of the file
+		off_t data = lseek(fd, hole, SEEK_DATA);
+		unsigned long long holeEnd = last;
+		if(data >= 0 && (unsigned long long)data < last) {
+			holeEnd = (unsigned long long)data;
+		}
+		
+		FileHole found;
+		found.START = (unsigned long long)hole;
+		found.END = holeEnd;
+		holes.push_back(found);
+		
+		pos = holeEnd;
+	}
+	
+	::close(fd);
+	#else
+	(void)path;
+	(void)start;
+	(void)end;
+	#endif
+	
+	return holes;
+}
+
+/*** File Functions ***********************************************************/
+int SparseWriter::open(const std::string path, const bool truncate) {
+	close();
+	m_path = path;
+	m_failed = false;
+	m_offset = 0;
+	m_existing = 0;
+	m_holeBytes = 0;
+	
+	#if defined(__unix__) || defined(__APPLE__)
+	int flags = O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0);
+	m_fd = ::open(path.c_str(), flags, 0644);
+	if(m_fd < 0) return errorMsg("Could not create " + path);
+	
+	struct stat info;
+	if(fstat(m_fd, &info) == 0) m_existing = (unsigned long long)info.st_size;
+	#else
+	std::ios::openmode mode = std::ios::out | std::ios::binary;
+	mode |= truncate ? std::ios::trunc : std::ios::in;
+	m_out.open(path, mode);
+	if(m_out.is_open() == false) return errorMsg("Could not create " + path);
+	#endif
+	
+	m_open = true;
+	return 0;
+}
+
+int SparseWriter::write(const uint8_t *data, const size_t len) {
+	if(m_open == false) return 1;
+	if(m_sparse == false) return writeData(data, len);
+	
+	//Split the data into runs of zero and non zero blocks. The first block
+	//only reaches the next block boundary of the output
+	size_t pos = 0;
+	while(pos < len) {
+		size_t step = SPARSE_BLOCK - (size_t)(m_offset % SPARSE_BLOCK);
+		if(step > len - pos) step = len - pos;
+		
+		bool zero = bytesAreZero(data + pos, step);
+		size_t runEnd = pos + step;
+		while(runEnd < len) {
+			size_t next = SPARSE_BLOCK;
+			if(next > len - runEnd) next = len - runEnd;
+			if(bytesAreZero(data + runEnd, next) != zero) break;
+			
+			runEnd += next;
+		}
+		
+		int status = zero ? writeHole(runEnd - pos)
+		                  : writeData(data + pos, runEnd - pos);
+		if(status != 0) return 1;
+		
+		pos = runEnd;
+	}
+	
+	return 0;
+}
+
+int SparseWriter::writeZeros(const unsigned long long bytes) {
+	if(m_open == false) return 1;
+	if(m_sparse) return writeHole(bytes);
+	
+	unsigned long long left = bytes;
+	while(left != 0) {
+		size_t step = SPARSE_BLOCK;
+		if(step > left) step = (size_t)left;
+		if(writeData(zeroBlock, step) != 0) return 1;
+		
+		left -= step;
+	}
+	
+	return 0;
+}
+
+int SparseWriter::close() {
+	if(m_open == false) return 0;
+	m_open = false;
+	
+	//Skipped bytes at the end only exist once the size is set
+	#if defined(__unix__) || defined(__APPLE__)
+	if(ftruncate(m_fd, (off_t)m_offset) != 0) m_failed = true;
+	if(::close(m_fd) != 0) m_failed = true;
+	m_fd = -1;
+	#else
+	m_out.close();
+	if(m_out.fail()) m_failed = true;
+	#endif
+	
+	if(m_failed) return errorMsg("Failed writing " + m_path);
+	return 0;
+}
+
+/*** Private Functions ********************************************************/
+int SparseWriter::writeData(const uint8_t *data, const size_t len) {
+	#if defined(__unix__) || defined(__APPLE__)
+	size_t done = 0;
+	while(done < len) {
+		ssize_t wrote = pwrite(m_fd, data + done, len - done,
+		                       (off_t)(m_offset + done));
+		if(wrote < 0 && errno == EINTR) continue;
+		if(wrote <= 0) {
+			m_failed = true;
+			return 1;
+		}
+		
+		done += (size_t)wrote;
+	}
+	#else
+	m_out.write((const char *)data, (std::streamsize)len);
+	if(m_out.fail()) {
+		m_failed = true;
+		return 1;
+	}
+	#endif
+	
+	m_offset += len;
+	return 0;
+}
+
+int SparseWriter::writeHole(const unsigned long long bytes) {
+	//Past the old end of the file, skipping is enough. Over old data the
+	//bytes have to be cleared, by punching them out or writing zeros
+	unsigned long long overlap = 0;
+	if(m_offset < m_existing) {
+		overlap = m_existing - m_offset;
+		if(overlap > bytes) overlap = bytes;
+	}
+	
+	#if defined(__unix__) || defined(__APPLE__)
+	bool cleared = (overlap == 0);
+	
+	#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+	if(cleared == false && fallocate(m_fd, FALLOC_FL_PUNCH_HOLE
+	                                 | FALLOC_FL_KEEP_SIZE, (off_t)m_offset,
+	                                 (off_t)overlap) == 0) {
+		cleared = true;
+	}
+	#endif
+	
+	unsigned long long skip = bytes;
+	if(cleared == false) {
+		//No hole punching, overwrite the old data and skip the rest
+		unsigned long long left = overlap;
+		while(left != 0) {
+			size_t step = SPARSE_BLOCK;
+			if(step > left) step = (size_t)left;
+			if(writeData(zeroBlock, step) != 0) return 1;
+			
+			left -= step;
+		}
+		
+		skip -= overlap;
+	}
+	
+	m_offset += skip;
+	m_holeBytes += skip;
+	#else
+	//Nothing to make holes with, write the zeros
+	(void)overlap;
+	unsigned long long left = bytes;
+	while(left != 0) {
+		size_t step = SPARSE_BLOCK;
+		if(step > left) step = (size_t)left;
+		if(writeData(zeroBlock, step) != 0) return 1;
+		
+		left -= step;
+	}
+	#endif
+	
+	return 0;
+}
+
+int SparseWriter::errorMsg(const std::string msg) {
+	std::cerr << "Error: SparseWriter: " << msg << '.' << std::endl;
+	return 1;
+}
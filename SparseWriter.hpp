@@ -0,0 +1,105 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file writes image files sparsely. Pregaps, padding and silence are
+* long runs of zero sectors, so every block of output that is all zero is
+* skipped with lseek() instead of written, leaving a hole in the file that
+* takes no disk space. When writing over an existing file, zero runs are
+* punched out with fallocate(PUNCH_HOLE) on Linux. Holes in an input file can
+* be found with SEEK_HOLE/SEEK_DATA, so they are carried over without being
+* read at all.
+*
+* Systems without these calls get a normal, fully written file.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef SPARSE_WRITER_H
+#define SPARSE_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*** Helper Functions *********************************************************/
+//Returns true if every byte is zero. Checks 64 bytes per step (SSE2 where
+//the compiler targets it)
+bool bytesAreZero(const uint8_t *data, const size_t len);
+
+//A run of zero bytes in a file that takes no disk space
+struct FileHole {
+	unsigned long long START = 0;
+	unsigned long long END = 0;
+};
+
+//Find the holes in bytes -start- to -end- of a file, in order, using
+//SEEK_HOLE/SEEK_DATA. Returns none if the system or filesystem cannot tell
+std::vector <FileHole> fileHoles(const std::string &path,
+                                 const unsigned long long start,
+                                 const unsigned long long end);
+
+/*** SparseWriter Class *******************************************************/
+class SparseWriter {
+	public:
+	SparseWriter() { }
+	
+	//Closes the file if it is still open
+	~SparseWriter() { close(); }
+	
+	/** Configuration Functions ***********************************************/
+	//Leave zero runs as holes. On by default
+	void setSparse(const bool sparse) { this->m_sparse = sparse; }
+	
+	/** File Functions ********************************************************/
+	//Open -path- for writing from the start. With -truncate- cleared an
+	//existing file is written over in place, and zero runs are punched out
+	//of it. Returns 0 on success, 1 on failure
+	int open(const std::string path, const bool truncate = true);
+	
+	//Write -len- bytes at the end of the output. Zero blocks become holes.
+	//Returns 0 on success, 1 on failure
+	int write(const uint8_t *data, const size_t len);
+	
+	//Add -bytes- of zeros without any data, e.g. a hole in the input.
+	//Returns 0 on success, 1 on failure
+	int writeZeros(const unsigned long long bytes);
+	
+	//Set the final size (so trailing holes are kept) and close the file.
+	//Returns 0 if every write succeeded, 1 otherwise
+	int close();
+	
+	//Bytes written so far, including holes
+	unsigned long long size() const { return m_offset; }
+	
+	//Bytes that were skipped or punched out instead of written
+	unsigned long long holeBytes() const { return m_holeBytes; }
+	
+	private:
+	bool m_sparse = true;
+	bool m_failed = false;
+	bool m_open = false;
+	std::string m_path;
+	
+	int m_fd = -1;
+	std::ofstream m_out; //Used instead of m_fd without POSIX calls
+	
+	unsigned long long m_offset = 0; //Where the next byte goes
+	unsigned long long m_existing = 0; //Bytes the file held when opened
+	unsigned long long m_holeBytes = 0;
+	
+	//Write bytes that hold data at m_offset
+	int writeData(const uint8_t *data, const size_t len);
+	
+	//Leave -bytes- of zeros at m_offset as a hole
+	int writeHole(const unsigned long long bytes);
+	
+	//Print an error message to std::cerr, returns 1 for failure
+	int errorMsg(const std::string msg);
+};
+
+#endif
@@ -12,11 +12,289 @@
 
 #include "TeFiEd.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <cstdio>
 #include <cstring>
+#include <utility>
+#include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+//Create a new temporary file next to -path- for an atomic write, named for
+//this process and write so concurrent writers never share one. Returns its
+//descriptor (name in -tempPath-), or -1
+int openTempFile(const char *path, std::string &tempPath) {
+	static std::atomic<unsigned int> writeCount(0);
+	
+	for(int tries = 0; tries < 100; tries++) {
+		tempPath = std::string(path) + ".tmp." + std::to_string(getpid())
+		         + '.' + std::to_string(writeCount++);
+		
+		//O_EXCL, never reuse a file that is already there
+		int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+		if(fd >= 0 || errno != EEXIST) return fd;
+	}
+	
+	return -1;
+}
+
+//Give the temporary file the mode and owner of the file it will replace, so
+//the rename does not change them. A new file keeps the umask default.
+//Returns 1 if the mode could not be set
+int copyOwnership(const int fd, const char *path) {
+	struct stat info;
+	if(::stat(path, &info) != 0) return 0;
+	
+	//Only root can give a file to another user, so failing is expected. The
+	//owner is set first, as it can clear setuid bits
+	int owned = ::fchown(fd, info.st_uid, info.st_gid);
+	(void)owned;
+	
+	return ::fchmod(fd, info.st_mode & 07777) != 0;
+}
+
+//fsync the directory -path- is in, so a rename into it is durable. Returns 1
+//on failure
+int syncParentDir(const char *path) {
+	std::string dir = path;
+	size_t slash = dir.find_last_of('/');
+	dir = (slash == std::string::npos) ? "." : dir.substr(0, slash + 1);
+	
+	int dirFd = ::open(dir.c_str(), O_RDONLY);
+	if(dirFd < 0) return 1;
+	
+	int status = ::fsync(dirFd);
+	::close(dirFd);
+	return status != 0;
+}
+} //namespace
+#endif
+
+/** LineBuffer ****************************************************************/
+void LineBuffer::insert(const size_t idx, std::string str) {
+	moveGap(idx);
+	growGap(1);
+	
+	//The gap slot is an empty string, swap the new line into it
+	m_data[m_gapStart].swap(str);
+	++m_gapStart;
+}
+
+void LineBuffer::insert(const size_t idx,
+                        const std::vector<std::string> &lines) {
+	moveGap(idx);
+	growGap(lines.size());
+	
+	for(size_t cLine = 0; cLine < lines.size(); cLine++) {
+		m_data[m_gapStart++] = lines[cLine];
+	}
+}
+
+void LineBuffer::erase(const size_t idx, size_t count) {
+	if(idx >= size()) return;
+	if(count > size() - idx) count = size() - idx;
+	
+	//Removed lines join the gap. Free their text now, not when reused
+	moveGap(idx);
+	while(count > 0) {
+		std::string().swap(m_data[m_gapEnd]);
+		++m_gapEnd;
+		--count;
+	}
+}
+
+void LineBuffer::clear() {
+	std::vector<std::string>().swap(m_data);
+	m_gapStart = 0;
+	m_gapEnd = 0;
+}
+
+void LineBuffer::assign(std::vector<std::string> lines) {
+	m_data = std::move(lines);
+	m_gapStart = m_data.size();
+	m_gapEnd = m_gapStart;
+}
+
+void LineBuffer::reserve(const size_t lines) {
+	if(lines > size()) growGap(lines - size());
+}
+
+void LineBuffer::shrink_to_fit() {
+	//Move the gap to the end, then cut it off
+	moveGap(size());
+	m_data.resize(m_gapStart);
+	m_data.shrink_to_fit();
+	m_gapEnd = m_gapStart;
+}
+
+MemoryUsage LineBuffer::memoryUsage() const {
+	MemoryUsage usage;
+	
+	//Gap slots are capacity with no line in them
+	if(m_data.capacity() != 0) {
+		usage.heapBytes += m_data.capacity() * sizeof(std::string);
+		usage.slackBytes += (m_data.capacity() - size()) * sizeof(std::string);
+		++usage.allocations;
+	}
+	
+	for(size_t cLine = 0; cLine < size(); cLine++) {
+		usage.addString((*this)[cLine]);
+	}
+	
+	return usage;
+}
+
+void LineBuffer::moveGap(const size_t idx) {
+	//Lines before the gap move to its end, or lines after it to its start.
+	//Gap slots are always empty strings, so swapping keeps them empty
+	while(m_gapStart > idx) {
+		--m_gapStart;
+		--m_gapEnd;
+		m_data[m_gapEnd].swap(m_data[m_gapStart]);
+	}
+	
+	while(m_gapStart < idx) {
+		m_data[m_gapStart].swap(m_data[m_gapEnd]);
+		++m_gapStart;
+		++m_gapEnd;
+	}
+}
+
+void LineBuffer::growGap(const size_t need) {
+	if(gapSize() >= need) return;
+	
+	//Double the storage (at least 16 slots), or more if the insert is bigger
+	size_t lines = size();
+	size_t newSize = m_data.size() * 2;
+	if(newSize < lines + need) newSize = lines + need;
+	if(newSize < 16) newSize = 16;
+	
+	//Lines before the gap stay at the front, lines after go to the back
+	std::vector<std::string> newData(newSize);
+	size_t after = m_data.size() - m_gapEnd;
+	
+	for(size_t cSlot = 0; cSlot < m_gapStart; cSlot++) {
+		newData[cSlot].swap(m_data[cSlot]);
+	}
+	for(size_t cSlot = 0; cSlot < after; cSlot++) {
+		newData[newSize - after + cSlot].swap(m_data[m_gapEnd + cSlot]);
+	}
+	
+	m_data.swap(newData);
+	m_gapEnd = newSize - after;
+}
+
+/** Line Tokenizer ************************************************************/
+LineFields::LineFields(const std::string &line, const char *delims,
+                       const bool quotes)
+  : m_data(line.data()), m_len(line.size()), m_delims(delims),
+    m_quotes(quotes) {
+	size_t pos = 0;
+	StrView word;
+	bool isQuoted;
+	
+	//Fill the array, remembering where the scan got to if it runs out
+	while(m_count < MAX_FIELDS && nextWord(pos, word, isQuoted)) {
+		if(isQuoted) {
+			m_quotedMask |= (uint32_t)1 << m_count;
+			
+			//A closed quote always has its closing quote after the word
+			if(word.DATA + word.LEN == m_data + m_len) m_badQuote = true;
+		}
+		m_fields[m_count++] = word;
+	}
+	m_resume = pos;
+}
+
+size_t LineFields::size() const {
+	size_t count = m_count;
+	
+	//Count the words the array had no room for
+	if(count == MAX_FIELDS) {
+		size_t pos = m_resume;
+		StrView word;
+		bool isQuoted;
+		while(nextWord(pos, word, isQuoted)) ++count;
+	}
+	
+	return count;
+}
+
+StrView LineFields::operator[](size_t index) const {
+	//Always 1 indexed
+	if(index == 0) index = 1;
+	if(index <= m_count) return m_fields[index - 1];
+	if(m_count < MAX_FIELDS) return StrView();
+	
+	//Past the array, carry on scanning from the last stored word
+	size_t pos = m_resume;
+	StrView word;
+	bool isQuoted;
+	for(size_t cWord = MAX_FIELDS; cWord < index; cWord++) {
+		if(nextWord(pos, word, isQuoted) == false) return StrView();
+	}
+	
+	return word;
+}
+
+bool LineFields::quoted(size_t index) const {
+	if(index == 0) index = 1;
+	if(index > m_count) return false;
+	
+	return (m_quotedMask >> (index - 1)) & 1;
+}
+
+bool LineFields::nextWord(size_t &pos, StrView &word,
+                          bool &isQuoted) const {
+	//Skip any delims before the word
+	while(pos < m_len && strchr(m_delims, m_data[pos]) != nullptr) ++pos;
+	if(pos >= m_len) return false;
+	
+	isQuoted = false;
+	size_t start = pos;
+	
+	//A quoted string runs to the closing quote, or the end of the line
+	if(m_quotes && m_data[pos] == '\"') {
+		const char *close = (const char *)memchr(m_data + pos + 1, '\"',
+		                                         m_len - pos - 1);
+		isQuoted = true;
+		start = pos + 1;
+		
+		pos = (close == nullptr) ? m_len : (size_t)(close - m_data);
+		
+		word = StrView(m_data + start, pos - start);
+		if(pos < m_len) ++pos;
+		return true;
+	}
+	
+	while(pos < m_len && strchr(m_delims, m_data[pos]) == nullptr) ++pos;
+	word = StrView(m_data + start, pos - start);
+	return true;
+}
+
+StrView trimView(const std::string &input, size_t s, size_t e) {
+	if(e > input.size()) e = input.size();
+	
+	//Move s forward and e back past any spaces or tabs
+	while(s < e && (input[s] == ' ' || input[s] == '\t')) ++s;
+	while(e > s && (input[e - 1] == ' ' || input[e - 1] == '\t')) --e;
+	
+	if(s >= e) return StrView();
+	return StrView(input.data() + s, e - s);
+}
+
+/** TeFiEd ********************************************************************/
 TeFiEd::TeFiEd(const char* filename) {
 	//Create a char array at m_filename the size of the input string.
 	m_filename = new char[ strlen(filename) + 1 ];
@@ -64,34 +342,33 @@ std::string TeFiEd::parentDir() {
 }
 
 size_t TeFiEd::bytes() {
-	//Return number of bytes in the file
-	size_t byteCount = 0;
-	
-	//Go through every element in the vector
-	size_t vectElement = 0;
-	while(vectElement < m_ramfile.size()) {
-		//For each element, add the string size to the count.
-		//NOTE <string>.size() returns number of bytes. it does not natively
-		//understand unicode or multi-byte character sets, so this should
-		//be a reliable method of getting bytes (as of 2022)
-		byteCount += m_ramfile[vectElement].size();
-	
-		//NOTE Strings do not know about their terminating \n, so add 
-		//1 byte to the count after every loop
-		//This has been tested to agree with both Thunar and Nautilus 
-		//file manager. may need rework later in time
-		++byteCount;
-	
-		++vectElement;
-	}
-	
-	return byteCount;
+	//Every edit keeps m_bytes up to date. It is the size of every string
+	//plus 1 per line for the terminating \n the strings do not know about.
+	//NOTE <string>.size() returns number of bytes. it does not natively
+	//understand unicode or multi-byte character sets, so this should
+	//be a reliable method of getting bytes (as of 2022)
+	//This has been tested to agree with both Thunar and Nautilus 
+	//file manager. may need rework later in time
+	return m_bytes;
 }
 
 size_t TeFiEd::lines() {
 	return m_ramfile.size();
 }
 
+MemoryUsage TeFiEd::memoryUsage() {
+	MemoryUsage usage;
+	
+	//The filename char array is exactly sized, so has no slack
+	usage.heapBytes += strlen(m_filename) + 1;
+	++usage.allocations;
+	
+	//The line storage, then every line string held in it
+	usage += m_ramfile.memoryUsage();
+	
+	return usage;
+}
+
 /** Basic Functions ***********************************************************/
 //Create empty file from filename
 int TeFiEd::create() {
@@ -149,6 +426,11 @@ int TeFiEd::read() {
 			//Error message
 			errorMsg("read", "File exceeds MAX_RAM_BYTES :", MAX_RAM_BYTES);
 			
+			//Drop the lines read so far, so the RAM file and m_bytes agree,
+			//and close the file
+			flush();
+			resetAndClose();
+			
 			//Return error status
 			return 1;
 		}
@@ -156,6 +438,7 @@ int TeFiEd::read() {
 		//if no failure, push string into vector
 		this->m_ramfile.push_back(lineStr);
 	}
+	m_bytes = byteCount;
 	
 	//Close the file. Saves IO space and isn't needd for now
 	resetAndClose();
@@ -176,16 +459,19 @@ bool TeFiEd::isOpen() {
 	return isOpenFlag;
 }
 
-std::string TeFiEd::getLine(size_t index) {
+const std::string &TeFiEd::getLine(size_t index) {
+	//Returned for lines that do not exist
+	static const std::string blankLine;
+	
 	//If the index is 0, return a blank string
-	if(index == 0) return "";
+	if(index == 0) return blankLine;
 	
 	//Always decriment index to fit the 1 index style
 	--index;
 	
 	if(index > this->m_ramfile.size() - 1) {
 		errorMsg("getLine", "Line", index + 1, "does not exist");
-		return "";
+		return blankLine;
 	}
 	
 	//If everything is normal
@@ -193,24 +479,13 @@ std::string TeFiEd::getLine(size_t index) {
 }
 
 int TeFiEd::overwrite() {
-	//Open file as output, truncate
-	this->m_file.open(m_filename, std::ios::out | std::ios::trunc);
-	
-	//Make sure file is open and exists
-	if(m_file.is_open() == 0) { 
-		errorMsg("overwrite", "Could not create file");
+	//Write parent object ram to file
+	if(writeLines(m_filename) != 0) { 
+		errorMsg("overwrite", "Could not write file");
 		
 		return 1;
 	}
 	
-	//Write parent object ram to file
-	for(std::string lineStr : this->m_ramfile) {
-		m_file << lineStr << std::endl;
-	}
-	
-	//Close file and clear flags
-	resetAndClose();
-	
 	//If verbosity is enabled, print a nice message
 	if(this->verbose == true) {
 		std::cout << "Overwrite " << m_filename << " Successful: wrote "
@@ -223,24 +498,13 @@ int TeFiEd::overwrite() {
 
 //Write RAM into another TeFiEd Object
 int TeFiEd::writeTo(TeFiEd &target) {
-	//Open file as output, truncate
-	target.m_file.open(target.m_filename, std::ios::out | std::ios::trunc);
-	
-	//Make sure file is open and exists
-	if(target.m_file.is_open() == 0) { 
-		errorMsg("writeTo", "Could not create file ", target.m_filename);
+	//Write parent ram to reference file
+	if(writeLines(target.m_filename) != 0) { 
+		errorMsg("writeTo", "Could not write file ", target.m_filename);
 		
 		return 1;
 	}
 	
-	//Write parent ram to reference file
-	for(std::string lineStr : this->m_ramfile) {
-		target.m_file << lineStr << std::endl;
-	}
-	
-	//Close file and clear flags
-	target.resetAndClose();
-	
 	//If verbosity is enabled, print a nice message
 	if(this->verbose == true) {
 		std::cout << "Write to " << target.m_filename << " Successful: wrote "
@@ -254,9 +518,9 @@ int TeFiEd::writeTo(TeFiEd &target) {
 
 //Delete all RAM File data
 void TeFiEd::flush() {
-	//Empties out the vector and shrinks its size
+	//Empties out the vector and releases its storage
 	m_ramfile.clear();
-	m_ramfile.shrink_to_fit();
+	m_bytes = 0;
 }
 
 /** File Edit Functions *******************************************************/
@@ -275,6 +539,7 @@ void TeFiEd::convertLineEnding(const LineEnding type) {
 			if(lastChar == 0x0D) {
 				//Remove the last char
 				m_ramfile[cLine].pop_back();		
+				--m_bytes;
 				//Incriment wrongLines
 				++wrongLines;
 			}
@@ -283,6 +548,7 @@ void TeFiEd::convertLineEnding(const LineEnding type) {
 			if(lastChar != 0x0D) {
 				//Add the \r to the end of line
 				m_ramfile[cLine].push_back(0x0D);
+				++m_bytes;
 				//Incriment wrongLines
 				++wrongLines;
 			}
@@ -313,6 +579,7 @@ int TeFiEd::append(const std::string inStr) {
 	
 	//push entry to back of the vector
 	m_ramfile.push_back(inStr);
+	m_bytes += inStr.size() + 1;
 	
 	//Complete
 	return 0;
@@ -337,7 +604,44 @@ int TeFiEd::insertLine(size_t line, const std::string inStr) {
 		return 1;
 	}
 	
-	m_ramfile.insert(m_ramfile.begin() + line, inStr);
+	m_ramfile.insert(line, inStr);
+	m_bytes += inStr.size() + 1;
+	return 0;
+}
+
+int TeFiEd::insertLines(size_t line, const std::vector<std::string> &lines) {
+	//Decriment line if above 0, RAM File is indexed +1 from 'normal' notation
+	if(line > 0) {
+		--line;
+	}
+
+	//Make sure that the vector has enough elements to allow the insert
+	if(line > m_ramfile.size()) {
+		//Error message and return fail
+		errorMsg("insertLines", "Line", line + 1, "does not exist");
+		
+		return 1;
+	}
+	
+	//Check every line, and the total size, before changing anything
+	size_t addBytes = 0;
+	for(size_t cLine = 0; cLine < lines.size(); cLine++) {
+		if(lines[cLine].size() > MAX_STRING_SIZE) {
+			errorMsg("insertLines", "Input string exceeds MAX_STRING_SIZE :",
+			         MAX_STRING_SIZE);
+			return 1;
+		}
+		addBytes += lines[cLine].size() + 1;
+	}
+	
+	if(m_bytes + addBytes > MAX_RAM_BYTES) {
+		errorMsg("insertLines", "Lines cause file to exceed MAX_RAM_BYTES :",
+		         MAX_RAM_BYTES);
+		return 2;
+	}
+	
+	m_ramfile.insert(line, lines);
+	m_bytes += addBytes;
 	return 0;
 }
 
@@ -357,6 +661,7 @@ int TeFiEd::appendLine(size_t line, const std::string inStr) {
 	
 	//append the string in the vector at index given
 	m_ramfile[line].append(inStr);
+	m_bytes += inStr.size();
 	
 	//Done
 	return 0;
@@ -369,7 +674,7 @@ int TeFiEd::replace(size_t line, std::string inStr) {
 	}
 	
 	//Make sure that the line requested is valid
-	if(line > m_ramfile.size()) {
+	if(line >= m_ramfile.size()) {
 		//Error message and return fail
 		errorMsg("replsce", "Line", line + 1, "does not exist");
 		
@@ -382,6 +687,7 @@ int TeFiEd::replace(size_t line, std::string inStr) {
 	}
 	
 	//Change the RAM vectors string to inStr
+	m_bytes = m_bytes - m_ramfile[line].size() + inStr.size();
 	m_ramfile[line] = inStr;
 	
 	//Done
@@ -395,17 +701,40 @@ int TeFiEd::remove(size_t index) {
 	}
 	
 	//Make sure that the vector has the correct number of elements
-	if(index > m_ramfile.size()) {
+	if(index >= m_ramfile.size()) {
 		//Error message and return error value
 		errorMsg("removeLine", "Line", index + 1, "does not exist");
 			
 		return 1;
 	}
 		
-	//Erase line specified
-	m_ramfile.erase(m_ramfile.begin() + index);
-	//Shrink the vector
-	m_ramfile.shrink_to_fit();
+	//Erase line specified. The slot is kept for the next insert, flush()
+	//releases the storage
+	m_bytes -= m_ramfile[index].size() + 1;
+	m_ramfile.erase(index);
+	
+	//Return success
+	return 0;
+}
+
+int TeFiEd::removeLines(size_t index, const size_t count) {
+	//Decriment index if above 0, RAM File is indexed +1 from 'normal' notation
+	if(index > 0) {
+		--index;
+	}
+	
+	//Make sure every line to remove exists
+	if(index >= m_ramfile.size() || count > m_ramfile.size() - index) {
+		//Error message and return error value
+		errorMsg("removeLines", "Lines from", index + 1, "do not exist");
+			
+		return 1;
+	}
+	
+	for(size_t cLine = index; cLine < index + count; cLine++) {
+		m_bytes -= m_ramfile[cLine].size() + 1;
+	}
+	m_ramfile.erase(index, count);
 	
 	//Return success
 	return 0;
@@ -420,45 +749,10 @@ std::string TeFiEd::getWord(const size_t line, unsigned int index) {
 }
 
 //Overloaded version of getWord (string and index)
-std::string TeFiEd::getWord(const std::string input, unsigned int index) {
-	//If index is 0, set it to 1. always 1 indexed
-	if(index == 0) index = 1;
-	
-	//Create output string object
-	std::string output;
-
-	//Set the delim string -- Regular delims, and Tab, Carriage Return (Windows)
-	const std::string delim = " .,;\t\r";
-	
-	//Start and end of word, and current word found.
-	size_t wordStart = 0, wordEnd = 0, wordIndex = 0;
-	
-	//Find the start and end of a word
-	do {
-		//Get the start and end of a word, detected by delim
-		wordStart = input.find_first_not_of(delim, wordEnd);	
-		wordEnd = input.find_first_of(delim, wordStart);
-		
-		//wordEnd can be allowed to overflow, but wordStart cannot.
-		if(wordStart != std::string::npos) {
-			//Incriment word index.
-			++wordIndex;
-			
-			//If this index is the one requested, set output
-			if(wordIndex == index) {
-				output = input.substr(wordStart, wordEnd - wordStart);
-				break;
-			}
-		}
-	
-	} while(wordStart < input.size());	
-	
-	//If the index could not be found, return an empty string
-	if(wordIndex < index) {
-		output = "";
-	}
-	
-	return output;
+std::string TeFiEd::getWord(const std::string &input, unsigned int index) {
+	//Regular delims, and Tab, Carriage Return (Windows). Empty string when
+	//there is no such word
+	return LineFields(input, " .,;\t\r")[index].str();
 }
 
 size_t TeFiEd::find(std::string search, size_t offset) {
@@ -538,6 +832,154 @@ size_t TeFiEd::findNext(std::string search) {
 	return matchLine;
 }
 
+/** Transaction ***************************************************************/
+void TeFiEd::Transaction::insertLine(size_t line, std::string str) {
+	push(t_EDIT::INSERT, line, std::move(str));
+}
+
+void TeFiEd::Transaction::append(std::string str) {
+	Edit edit;
+	edit.TYPE = t_EDIT::INSERT;
+	edit.LINE = END_LINE;
+	edit.TEXT = std::move(str);
+	m_edits.push_back(std::move(edit));
+}
+
+void TeFiEd::Transaction::replace(size_t line, std::string str) {
+	push(t_EDIT::REPLACE, line, std::move(str));
+}
+
+void TeFiEd::Transaction::remove(size_t line) {
+	push(t_EDIT::REMOVE, line, std::string());
+}
+
+void TeFiEd::Transaction::removeLines(size_t line, const size_t count) {
+	if(line == 0) line = 1;
+	for(size_t cLine = line; cLine < line + count; cLine++) remove(cLine);
+}
+
+int TeFiEd::Transaction::commit() {
+	LineBuffer &ramfile = m_file.m_ramfile;
+	const size_t lines = ramfile.size();
+	
+	//Order the edits by line, inserts before the other edits of their line.
+	//Sorting indexes leaves the queue as it was if the commit fails
+	auto lineOf = [&](const Edit &edit) {
+		return (edit.LINE == END_LINE) ? lines : edit.LINE;
+	};
+	
+	std::vector<size_t> order(m_edits.size());
+	for(size_t cEdit = 0; cEdit < order.size(); cEdit++) order[cEdit] = cEdit;
+	
+	std::stable_sort(order.begin(), order.end(),
+	  [&](const size_t a, const size_t b) {
+		size_t lineA = lineOf(m_edits[a]), lineB = lineOf(m_edits[b]);
+		if(lineA != lineB) return lineA < lineB;
+		return m_edits[a].TYPE == t_EDIT::INSERT
+		    && m_edits[b].TYPE != t_EDIT::INSERT;
+	});
+	
+	//Check every edit, and work out the size of the file after all of them
+	size_t newBytes = m_file.m_bytes;
+	bool reshape = false; //Lines are inserted or removed, not only replaced
+	
+	for(size_t cEdit = 0; cEdit < order.size(); ) {
+		const Edit &first = m_edits[order[cEdit]];
+		size_t line = lineOf(first);
+		
+		//Every edit of this line: inserts, then the last replace or a remove
+		const Edit *replaced = nullptr;
+		bool removed = false;
+		for(; cEdit < order.size() && lineOf(m_edits[order[cEdit]]) == line;
+		    cEdit++) {
+			const Edit &edit = m_edits[order[cEdit]];
+			
+			//Inserts can go after the last line, other edits must be on one
+			if(line > lines || (edit.TYPE != t_EDIT::INSERT && line == lines)) {
+				m_file.errorMsg("commit", "Line", line + 1, "does not exist");
+				return 1;
+			}
+			if(edit.TEXT.size() > m_file.MAX_STRING_SIZE) {
+				m_file.errorMsg("commit", "Input string exceeds "
+				                "MAX_STRING_SIZE :", m_file.MAX_STRING_SIZE);
+				return 1;
+			}
+			
+			if(edit.TYPE == t_EDIT::INSERT) {
+				newBytes += edit.TEXT.size() + 1;
+				reshape = true;
+			} else if(edit.TYPE == t_EDIT::REMOVE) {
+				removed = true;
+			} else {
+				replaced = &edit;
+			}
+		}
+		
+		if(removed) {
+			newBytes -= ramfile[line].size() + 1;
+			reshape = true;
+		} else if(replaced != nullptr) {
+			newBytes = newBytes - ramfile[line].size() + replaced->TEXT.size();
+		}
+	}
+	
+	if(newBytes > m_file.MAX_RAM_BYTES) {
+		m_file.errorMsg("commit", "Edits cause file to exceed MAX_RAM_BYTES :",
+		                m_file.MAX_RAM_BYTES);
+		return 2;
+	}
+	
+	//Merge the edits with the file in one pass. Strings are moved, never
+	//copied. If only replaces were queued the lines are changed in place
+	std::vector<std::string> merged;
+	if(reshape) merged.reserve(lines + m_edits.size());
+	
+	size_t cEdit = 0;
+	for(size_t line = 0; line <= lines; line++) {
+		//Lines inserted before this one
+		while(cEdit < order.size()) {
+			Edit &edit = m_edits[order[cEdit]];
+			if(lineOf(edit) != line || edit.TYPE != t_EDIT::INSERT) break;
+			
+			merged.push_back(std::move(edit.TEXT));
+			++cEdit;
+		}
+		if(line == lines) break;
+		
+		//The line itself, replaced or removed
+		Edit *replaced = nullptr;
+		bool removed = false;
+		while(cEdit < order.size() && lineOf(m_edits[order[cEdit]]) == line) {
+			Edit &edit = m_edits[order[cEdit]];
+			if(edit.TYPE == t_EDIT::REMOVE) removed = true;
+			if(edit.TYPE == t_EDIT::REPLACE) replaced = &edit;
+			++cEdit;
+		}
+		
+		if(removed) continue;
+		if(replaced != nullptr) ramfile[line] = std::move(replaced->TEXT);
+		if(reshape) merged.push_back(std::move(ramfile[line]));
+	}
+	
+	if(reshape) ramfile.assign(std::move(merged));
+	m_file.m_bytes = newBytes;
+	
+	m_edits.clear();
+	return 0;
+}
+
+void TeFiEd::Transaction::push(const t_EDIT type, size_t line,
+                               std::string str) {
+	//RAM File is indexed +1 from 'normal' notation
+	if(line > 0) --line;
+	
+	Edit edit;
+	edit.TYPE = type;
+	edit.LINE = line;
+	edit.TEXT = std::move(str);
+	m_edits.push_back(std::move(edit));
+}
+
 /** Internal only functions ***************************************************/
 //Checks the validity of a passed string, and if it will exceed the failsafes
 int TeFiEd::checkString(std::string testString) {
@@ -564,6 +1006,109 @@ int TeFiEd::checkString(std::string testString) {
 	return 0;
 }
 
+int TeFiEd::writeLines(const char *path) {
+	std::string outPath = path;
+	int failed = 0;
+	
+#if defined(__unix__) || defined(__APPLE__)
+	//Atomic writes go to a temporary file next to the target first
+	int fd;
+	if(atomicWrites) {
+		fd = openTempFile(path, outPath);
+		if(fd >= 0 && copyOwnership(fd, path) != 0) {
+			::close(fd);
+			std::remove(outPath.c_str());
+			return 1;
+		}
+	} else {
+		fd = ::open(outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+	if(fd < 0) return 1;
+	
+	//Each line takes 2 iovecs, its text and a shared newline
+#ifdef IOV_MAX
+	const size_t batchMax = (IOV_MAX < 1024) ? IOV_MAX : 1024;
+#else
+	const size_t batchMax = 1024;
+#endif
+	static char newline = '\n';
+	
+	std::vector<struct iovec> iov;
+	iov.reserve(batchMax);
+	
+	size_t cLine = 0;
+	while(cLine < m_ramfile.size() && failed == 0) {
+		//Point a batch of iovecs at the line strings, no copies
+		iov.clear();
+		while(cLine < m_ramfile.size() && iov.size() + 2 <= batchMax) {
+			const std::string &line = m_ramfile[cLine];
+			if(line.empty() == false) {
+				struct iovec text = {(void *)line.data(), line.size()};
+				iov.push_back(text);
+			}
+			
+			struct iovec lineEnd = {&newline, 1};
+			iov.push_back(lineEnd);
+			++cLine;
+		}
+		
+		//writev can write less than asked, carry on from where it stopped
+		struct iovec *pos = iov.data();
+		size_t count = iov.size();
+		while(count > 0) {
+			ssize_t written = ::writev(fd, pos, (int)count);
+			if(written < 0) {
+				if(errno == EINTR) continue;
+				failed = 1;
+				break;
+			}
+			
+			size_t left = (size_t)written;
+			while(count > 0 && left >= pos->iov_len) {
+				left -= pos->iov_len;
+				++pos;
+				--count;
+			}
+			if(count > 0) {
+				pos->iov_base = (char *)pos->iov_base + left;
+				pos->iov_len -= left;
+			}
+		}
+	}
+	
+	if(failed == 0 && syncWrites && ::fsync(fd) != 0) failed = 1;
+	if(::close(fd) != 0) failed = 1;
+#else
+	//Atomic writes go to a temporary file next to the target first
+	if(atomicWrites) outPath.append(".tmp");
+	
+	//No writev, write through one stream and flush once at the end
+	std::ofstream outFile(outPath, std::ios::out | std::ios::trunc);
+	if(outFile.is_open() == false) return 1;
+	
+	for(size_t cLine = 0; cLine < m_ramfile.size(); cLine++) {
+		outFile << m_ramfile[cLine] << '\n';
+	}
+	outFile.flush();
+	if(outFile.fail()) failed = 1;
+	outFile.close();
+#endif
+	
+	if(failed == 0 && atomicWrites) {
+		if(std::rename(outPath.c_str(), path) != 0) failed = 1;
+		
+#if defined(__unix__) || defined(__APPLE__)
+		//The rename is only on disk once the directory is
+		if(failed == 0 && syncWrites && syncParentDir(path) != 0) failed = 1;
+#endif
+	}
+	
+	//Never leave a half written temporary file behind
+	if(failed != 0 && atomicWrites) std::remove(outPath.c_str());
+	
+	return failed;
+}
+
 void TeFiEd::resetAndClose() {
 	//Private function. resets bit flags and closes the file
 	//Clar flags
@@ -15,14 +15,183 @@
 #ifndef TeFiEd_H
 #define TeFiEd_H
 
+#include <cstdint>
 #include <fstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 /*** Enum and types ***********************************************************/
 //Line ending type, for convertLineEnding
 enum class LineEnding { DOS, Unix };
 
+//Heap memory accounting, used by memoryUsage(). Sizes are in bytes.
+struct MemoryUsage {
+	size_t heapBytes = 0; //Bytes of heap held (including capacity slack)
+	size_t slackBytes = 0; //Bytes of heap reserved but not holding data
+	size_t allocations = 0; //Number of live heap blocks
+	
+	//Add another MemoryUsage to this one
+	MemoryUsage &operator+=(const MemoryUsage &other) {
+		heapBytes += other.heapBytes;
+		slackBytes += other.slackBytes;
+		allocations += other.allocations;
+		return *this;
+	}
+	
+	//Account for a string. Strings short enough to be stored inside the object
+	//itself (small string optimisation) hold no heap.
+	void addString(const std::string &str) {
+		const char *data = str.data();
+		const char *obj = reinterpret_cast<const char *>(&str);
+		if(data >= obj && data < obj + sizeof(std::string)) return;
+		
+		//+1 for the null terminator the string always allocates
+		heapBytes += str.capacity() + 1;
+		slackBytes += str.capacity() - str.size();
+		++allocations;
+	}
+	
+	//Account for the buffer of a vector (not the heap its elements own)
+	template <typename T>
+	void addVector(const std::vector<T> &vect) {
+		if(vect.capacity() == 0) return;
+		
+		heapBytes += vect.capacity() * sizeof(T);
+		slackBytes += (vect.capacity() - vect.size()) * sizeof(T);
+		++allocations;
+	}
+};
+
+/*** LineBuffer class *********************************************************/
+//Gap buffer of lines, the RAM File storage. Lines live in one vector with a
+//gap of empty slots left at the last edit, so inserts and removes near the
+//previous edit are amortised O(1) instead of shifting every later line.
+//Moving the gap swaps strings, which only swaps their pointers.
+class LineBuffer {
+	public:
+	//Number of lines
+	size_t size() const { return m_data.size() - gapSize(); }
+	bool empty() const { return size() == 0; }
+	
+	//Line at a 0 indexed position
+	const std::string &operator[](const size_t idx) const {
+		return m_data[slot(idx)];
+	}
+	std::string &operator[](const size_t idx) { return m_data[slot(idx)]; }
+	
+	//Add a line to the end
+	void push_back(std::string str) { insert(size(), std::move(str)); }
+	
+	//Insert one line, or many at once (the gap moves and grows only once)
+	void insert(const size_t idx, std::string str);
+	void insert(const size_t idx, const std::vector<std::string> &lines);
+	
+	//Remove -count- lines starting at idx
+	void erase(const size_t idx, size_t count = 1);
+	
+	//Remove every line, and release the storage
+	void clear();
+	
+	//Replace every line with -lines-, leaving no gap
+	void assign(std::vector<std::string> lines);
+	
+	//Make room for -lines- lines in total without reallocating
+	void reserve(const size_t lines);
+	
+	//Release the gap, so the storage is exactly sized
+	void shrink_to_fit();
+	
+	//Heap used by the storage and every line
+	MemoryUsage memoryUsage() const;
+	
+	private:
+	std::vector<std::string> m_data; //Lines, with the gap somewhere inside
+	size_t m_gapStart = 0; //First empty slot
+	size_t m_gapEnd = 0; //One past the last empty slot
+	
+	size_t gapSize() const { return m_gapEnd - m_gapStart; }
+	
+	//Position in m_data of a line
+	size_t slot(const size_t idx) const {
+		return (idx < m_gapStart) ? idx : idx + gapSize();
+	}
+	
+	//Move the gap to start at line idx
+	void moveGap(const size_t idx);
+	
+	//Make the gap at least -need- slots, doubling the storage when it grows
+	void growGap(const size_t need);
+};
+
+/*** Line Tokenizer ***********************************************************/
+//Read-only view of part of a string. Holds no memory, so it is only valid
+//while the string it points into is alive and unchanged
+struct StrView {
+	const char *DATA = nullptr;
+	size_t LEN = 0;
+	
+	StrView() { }
+	StrView(const char *data, const size_t len) : DATA(data), LEN(len) { }
+	
+	bool empty() const { return LEN == 0; }
+	
+	//Copy the viewed characters into a string
+	std::string str() const { return std::string(DATA, LEN); }
+	
+	//Returns true if the view holds exactly the same characters as -cmp-
+	bool equals(const std::string &cmp) const {
+		return cmp.size() == LEN && cmp.compare(0, LEN, DATA, LEN) == 0;
+	}
+};
+
+//Splits a line into words in one pass, keeping views into the line in a
+//fixed array, so nothing is allocated. Words past MAX_FIELDS are found by
+//carrying on the scan from the last stored word. The line must outlive the
+//LineFields object
+class LineFields {
+	public:
+	static const size_t MAX_FIELDS = 16;
+	
+	//Split a line on any of -delims-. With -quotes- set, a "quoted string"
+	//is one word (without its quotes), whatever delims it contains
+	LineFields(const std::string &line, const char *delims = " \t\r",
+	           const bool quotes = false);
+	
+	//Number of words, counting any past MAX_FIELDS
+	size_t size() const;
+	
+	//Word -index-, 1 indexed. Index 0 is treated as 1. Empty when there is
+	//no such word
+	StrView operator[](size_t index) const;
+	
+	//Returns true if word -index- was a quoted string
+	bool quoted(size_t index) const;
+	
+	//Returns true if a quote in the first MAX_FIELDS words was never closed
+	bool badQuote() const { return m_badQuote; }
+	
+	private:
+	const char *m_data;
+	size_t m_len;
+	const char *m_delims;
+	bool m_quotes;
+	
+	StrView m_fields[MAX_FIELDS];
+	uint32_t m_quotedMask = 0; //Bit n set if field n was quoted
+	size_t m_count = 0; //Stored fields
+	size_t m_resume = 0; //Offset the scan stopped at, if the array filled
+	bool m_badQuote = false;
+	
+	//Find the next word at or after -pos-. Returns false at the end of the
+	//line, otherwise sets -word-, -isQuoted- and moves -pos- past the word
+	bool nextWord(size_t &pos, StrView &word, bool &isQuoted) const;
+};
+
+//Returns a view of [s, e) of a string with spaces and tabs trimmed off both
+//ends. -e- is clamped to the string length
+StrView trimView(const std::string &input, size_t s, size_t e);
+
 /*** TeFiEd class *************************************************************/
 class TeFiEd {
 	public:
@@ -43,6 +212,15 @@ class TeFiEd {
 	//Sets the maximum number of -CHARS- a line can have before failsafe.
 	void setStringLimit(const size_t chars) { this->MAX_STRING_SIZE = chars; }
 	
+	//Sets if overwrite() and writeTo() fsync the file before returning (and
+	//its directory, after an atomic write's rename)
+	void setSyncWrites(const bool sync) { this->syncWrites = sync; }
+	
+	//Sets if overwrite() and writeTo() write a temporary file then rename it
+	//over the target, so the file is never seen half written. The temporary
+	//name is unique to each write, and takes the target's mode and owner
+	void setAtomicWrites(const bool atomic) { this->atomicWrites = atomic; }
+	
 	/** File Metadata getters *************************************************/
 	//Return the filename string (converted from const char* to string)
 	std::string filename();
@@ -53,12 +231,16 @@ class TeFiEd {
 	//e.g. /usr/test.txt will return /usr/
 	std::string parentDir();
 	
-	//Scan the vector and return the number of bytes used. (Can be slow)
+	//Return the number of bytes used, including a newline per line
 	size_t bytes();
 	
 	//Return number of elements in the vector, which is 1:1 for lines of output
 	size_t lines();
 	
+	//Returns the live heap bytes, capacity slack and allocations held by the
+	//object, including the filename and every line in the RAM File.
+	MemoryUsage memoryUsage();
+	
 	/** Basic Functions *******************************************************/
 	//Creates an empty file from the filename
 	int create();
@@ -71,8 +253,9 @@ class TeFiEd {
 	bool isOpen();
 	
 	//Return the line string at the passed index. Request for line 0 will return
-	//A blank string. This is intended
-	std::string getLine(size_t);
+	//A blank string. This is intended. The reference is valid until the next
+	//edit of the file
+	const std::string &getLine(size_t);
 	
 	//Overwrite the original file with the RAM file
 	int overwrite();
@@ -97,17 +280,27 @@ class TeFiEd {
 	//Inserts a line of text into the vector at passed line.
 	int insertLine(size_t line, const std::string);
 	
+	//Inserts many lines at once before the passed line. Much faster than a
+	//loop of insertLine for bulk edits. Nothing is inserted if any line fails
+	int insertLines(size_t line, const std::vector<std::string> &);
+	
 	//Replaces [line] with the string passed
 	int replace(size_t line, std::string);
 	
 	//Remove the specified line from RAM File.
 	int remove(size_t line);
 	
+	//Remove -count- lines starting from the specified line
+	int removeLines(size_t line, const size_t count);
+	
+	//Collects many edits and applies them in one pass. See below
+	class Transaction;
+	
 	//Gets -index- word in a string. Overloaded with 2 methods:
 	//Pass line No & index, return string - blank when no match.
 	//Pass string & index, return string - blank when no match.
 	std::string getWord(const size_t line, unsigned int index);
-	std::string getWord(const std::string, unsigned int index);
+	std::string getWord(const std::string &, unsigned int index);
 	
 	//Find the first line containing a string, returns line number
 	//Pass a line to start from (defaults to first line)
@@ -137,10 +330,15 @@ class TeFiEd {
 	//Error messages are enabled regardless. 
 	bool verbose = false;
 	
+	//fsync after writing, and write to a temporary file then rename it
+	bool syncWrites = false;
+	bool atomicWrites = false;
+	
 	/** File Variables ********************************************************/
 	char* m_filename; //Filename as char array
 	std::fstream m_file; //fsteam object of file
-	std::vector<std::string> m_ramfile; //File RAM vector	
+	LineBuffer m_ramfile; //File RAM lines
+	size_t m_bytes = 0; //Bytes in m_ramfile, kept up to date by every edit
 	
 	//Flag to see if the file is open successfully.
 	bool isOpenFlag = false;
@@ -152,6 +350,10 @@ class TeFiEd {
 	//Perform sanity checks on input string check if it will activate a failsafe
 	int checkString(std::string inputStr);	
 	
+	//Write every line of the RAM File to -path-, in batches of writev calls
+	//that point straight at the line strings. Returns 0 on success
+	int writeLines(const char *path);
+	
 	//TODO redo this this
 	/** Error Message Handling*************************************************/
 	//Three message input
@@ -165,4 +367,58 @@ class TeFiEd {
 	void errorMsg(std::string, T1);
 };
 
+/*** TeFiEd Transaction *******************************************************/
+//Collects edits to a TeFiEd and applies them all with commit(). Line numbers
+//always refer to the file as it was before any queued edit, so edits never
+//shift each other. commit() checks every edit and MAX_RAM_BYTES once, then
+//rebuilds the RAM File in a single merge. If any edit fails, nothing changes.
+//Several edits to one line: lines inserted before it stay in queued order,
+//the last replace wins, and a remove wins over any replace.
+class TeFiEd::Transaction {
+	public:
+	Transaction(TeFiEd &file) : m_file(file) { }
+	
+	//Insert a line before [line]. lines() + 1 adds it to the end
+	void insertLine(size_t line, std::string str);
+	
+	//Add a line to the end of the file
+	void append(std::string str);
+	
+	//Replace [line] with the string passed
+	void replace(size_t line, std::string str);
+	
+	//Remove [line], or -count- lines starting from [line]
+	void remove(size_t line);
+	void removeLines(size_t line, const size_t count);
+	
+	//Number of queued edits
+	size_t size() const { return m_edits.size(); }
+	
+	//Drop every queued edit
+	void clear() { m_edits.clear(); }
+	
+	//Check and apply every queued edit, then clear the queue. Returns 0 on
+	//success, 1 if a line does not exist or a string is too long, 2 if the
+	//file would exceed MAX_RAM_BYTES. Nothing is changed on failure
+	int commit();
+	
+	private:
+	enum class t_EDIT { INSERT, REPLACE, REMOVE, MAX_TYPES };
+	
+	struct Edit {
+		t_EDIT TYPE;
+		size_t LINE; //0 indexed, in the file before the transaction
+		std::string TEXT;
+	};
+	
+	//LINE of an append, which is the end of the file at commit()
+	static const size_t END_LINE = (size_t)-1;
+	
+	TeFiEd &m_file;
+	std::vector<Edit> m_edits;
+	
+	//Queue an edit, converting the 1 indexed line
+	void push(const t_EDIT type, size_t line, std::string str);
+};
+
 #endif
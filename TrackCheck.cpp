@@ -0,0 +1,270 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* Cross-checks declared TRACK types against sampled sectors. See TrackCheck.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "TrackCheck.hpp"
+#include "CDSector.hpp"
+#include "CueHandler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+namespace {
+//Samples per job. TRACKs are split so one long TRACK can use every thread
+const unsigned long long JOB_SAMPLES = 256;
+
+//Samples of one TRACK handed to a thread
+struct SampleJob {
+	size_t track; //Index into the TRACK list
+	unsigned long long firstSample;
+	unsigned long long samples;
+};
+
+//Returns true if the two copies of an XA subheader match
+inline bool subheaderMatches(const uint8_t *subheader) {
+	return memcmp(subheader, subheader + 4, 4) == 0;
+}
+
+//Count the mode 2 XA form of a subheader
+void countXA(const uint8_t *subheader, TrackCheckResult &result) {
+	++result.MODE2;
+	if(subheaderMatches(subheader) == false) ++result.BAD_SUBHEADER;
+	
+	//Bit 5 of the submode byte is set for Form 2
+	if(subheader[2] & 0x20) {
+		++result.FORM2;
+	} else {
+		++result.FORM1;
+	}
+}
+
+//Classify one sampled sector of a 2352 byte TRACK
+void sampleRaw(const uint8_t *sector, TrackCheckResult &result) {
+	//Anything without a sync pattern, or with an invalid mode, is audio
+	if(sectorHasSync(sector) == false) {
+		++result.NO_SYNC;
+		return;
+	}
+	
+	switch(sector[SECTOR_HEADER + 3]) {
+		case 0:
+			++result.MODE0;
+			break;
+		
+		case 1:
+			++result.MODE1;
+			break;
+		
+		case 2:
+			countXA(sector + SECTOR_SUBHEADER, result);
+			break;
+		
+		default:
+			++result.NO_SYNC;
+			break;
+	}
+}
+
+//Returns true if the types store the same sectors
+bool sameLayout(const t_TRACK a, const t_TRACK b) {
+	if(a == b) return true;
+	
+	//CDI sectors are Mode 2 XA sectors, they cannot be told apart
+	if((a == t_TRACK::CDI_2352 && b == t_TRACK::MODE2_2352)
+	   || (a == t_TRACK::MODE2_2352 && b == t_TRACK::CDI_2352)) return true;
+	if((a == t_TRACK::CDI_2336 && b == t_TRACK::MODE2_2336)
+	   || (a == t_TRACK::MODE2_2336 && b == t_TRACK::CDI_2336)) return true;
+	
+	return false;
+}
+
+//Decide what the samples of a TRACK point to
+void decide(TrackCheckResult &result, const unsigned int sectorSize) {
+	if(result.SAMPLES == 0) return;
+	result.CHECKED = true;
+	
+	if(sectorSize == SECTOR_RAW) {
+		//Mostly no sync is audio, otherwise the most common data mode. A
+		//TRACK of only empty mode 0 sectors fits either data mode
+		if(result.NO_SYNC * 2 > result.SAMPLES) {
+			result.DETECTED = t_TRACK::AUDIO;
+		} else if(result.MODE1 == 0 && result.MODE2 == 0) {
+			result.DETECTED = result.DECLARED;
+			if(result.DETECTED == t_TRACK::AUDIO) {
+				result.DETECTED = t_TRACK::MODE1_2352;
+			}
+		} else if(result.MODE1 >= result.MODE2) {
+			result.DETECTED = t_TRACK::MODE1_2352;
+		} else {
+			result.DETECTED = t_TRACK::MODE2_2352;
+		}
+	} else {
+		//2336 byte sectors start with the subheader. If most copies do not
+		//match it is not Mode 2 XA data
+		if(result.BAD_SUBHEADER * 2 > result.SAMPLES) {
+			result.DETECTED = t_TRACK::UNKNOWN;
+		} else {
+			result.DETECTED = t_TRACK::MODE2_2336;
+		}
+	}
+	
+	result.MISMATCH = !sameLayout(result.DECLARED, result.DETECTED);
+}
+} //namespace
+
+/*** Checking *****************************************************************/
+void TrackChecker::addCue(CueHandler &cue) {
+	std::vector <TrackSpan> spans = cue.getTrackSpans();
+	
+	for(const TrackSpan &span : spans) {
+		TrackJob job;
+		job.RESULT.PATH = span.PATH;
+		job.RESULT.TRACK = span.ID;
+		job.RESULT.DECLARED = span.TYPE;
+		job.RESULT.DETECTED = span.TYPE;
+		job.START = span.START;
+		job.END = span.END;
+		job.SECTOR_SIZE = cue.TRACKSectorSize(span.TYPE);
+		
+		m_jobs.push_back(job);
+	}
+}
+
+std::vector <TrackCheckResult> TrackChecker::check() {
+	//TRACKs whose bin file is missing. It has no size, so they have no
+	//samples to count as unread
+	std::vector <char> missing(m_jobs.size(), 0);
+	
+	//Only raw and 2336 byte sectors carry anything to check
+	std::vector <SampleJob> jobs;
+	for(size_t cTrack = 0; cTrack < m_jobs.size(); cTrack++) {
+		const TrackJob &track = m_jobs[cTrack];
+		if(track.SECTOR_SIZE != SECTOR_RAW && track.SECTOR_SIZE != 2336) {
+			continue;
+		}
+		
+		std::ifstream binFile(track.RESULT.PATH,
+		                      std::ios::in | std::ios::binary);
+		if(binFile.is_open() == false) {
+			missing[cTrack] = 1;
+			continue;
+		}
+		
+		unsigned long long sectors = (track.END - track.START)
+		                           / track.SECTOR_SIZE;
+		unsigned long long samples = (sectors + m_stride - 1) / m_stride;
+		
+		for(unsigned long long first = 0; first < samples;
+		    first += JOB_SAMPLES) {
+			SampleJob job;
+			job.track = cTrack;
+			job.firstSample = first;
+			job.samples = std::min(JOB_SAMPLES, samples - first);
+			jobs.push_back(job);
+		}
+	}
+	
+	unsigned int threadCount = m_threads;
+	if(threadCount == 0) threadCount = std::thread::hardware_concurrency();
+	if(threadCount == 0) threadCount = 1;
+	if(threadCount > jobs.size()) threadCount = (unsigned int)jobs.size();
+	
+	//Each job counts into its own result, so no locking is needed
+	std::vector <TrackCheckResult> partial(jobs.size());
+	std::atomic <size_t> nextJob(0);
+	
+	auto worker = [&]() {
+		uint8_t sector[SECTOR_RAW];
+		std::ifstream binFile;
+		std::string openPath;
+		
+		size_t jobIdx;
+		while((jobIdx = nextJob.fetch_add(1)) < jobs.size()) {
+			const SampleJob &job = jobs[jobIdx];
+			const TrackJob &track = m_jobs[job.track];
+			TrackCheckResult &result = partial[jobIdx];
+			
+			//Keep the bin file open between jobs in the same file
+			if(openPath != track.RESULT.PATH) {
+				binFile.close();
+				binFile.clear();
+				binFile.open(track.RESULT.PATH,
+				             std::ios::in | std::ios::binary);
+				openPath = track.RESULT.PATH;
+			}
+			if(binFile.is_open() == false) {
+				result.UNREAD += job.samples;
+				continue;
+			}
+			
+			for(unsigned long long cSample = 0; cSample < job.samples;
+			    cSample++) {
+				unsigned long long sect = (job.firstSample + cSample)
+				                        * m_stride;
+				unsigned long long offset = track.START
+				                          + sect * track.SECTOR_SIZE;
+				
+				binFile.seekg((std::streamoff)offset);
+				binFile.read((char *)sector, track.SECTOR_SIZE);
+				if((size_t)binFile.gcount() != track.SECTOR_SIZE) {
+					binFile.clear();
+					result.UNREAD += job.samples - cSample;
+					break;
+				}
+				
+				++result.SAMPLES;
+				if(track.SECTOR_SIZE == SECTOR_RAW) {
+					sampleRaw(sector, result);
+				} else {
+					countXA(sector, result);
+				}
+			}
+		}
+	};
+	
+	std::vector <std::thread> threads;
+	for(unsigned int cThread = 0; cThread < threadCount; cThread++) {
+		threads.push_back(std::thread(worker));
+	}
+	for(size_t cThread = 0; cThread < threads.size(); cThread++) {
+		threads[cThread].join();
+	}
+	
+	//Sum each TRACK's jobs, then decide what it holds
+	std::vector <TrackCheckResult> results;
+	results.reserve(m_jobs.size());
+	for(const TrackJob &track : m_jobs) results.push_back(track.RESULT);
+	
+	for(size_t jobIdx = 0; jobIdx < jobs.size(); jobIdx++) {
+		const TrackCheckResult &part = partial[jobIdx];
+		TrackCheckResult &result = results[jobs[jobIdx].track];
+		
+		result.SAMPLES += part.SAMPLES;
+		result.NO_SYNC += part.NO_SYNC;
+		result.MODE0 += part.MODE0;
+		result.MODE1 += part.MODE1;
+		result.MODE2 += part.MODE2;
+		result.FORM1 += part.FORM1;
+		result.FORM2 += part.FORM2;
+		result.BAD_SUBHEADER += part.BAD_SUBHEADER;
+		result.UNREAD += part.UNREAD;
+	}
+	
+	for(size_t cTrack = 0; cTrack < results.size(); cTrack++) {
+		TrackCheckResult &result = results[cTrack];
+		result.UNREADABLE = missing[cTrack] || result.UNREAD != 0;
+		decide(result, m_jobs[cTrack].SECTOR_SIZE);
+	}
+	
+	return results;
+}
@@ -0,0 +1,84 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file cross-checks the TRACK types a .cue declares against the sectors
+* in the bin files. Every Nth sector of each TRACK is sampled for the sync
+* pattern, mode byte and XA subheader, across multiple threads, and TRACKs
+* whose sectors do not match their declared type are reported.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef TRACK_CHECK_H
+#define TRACK_CHECK_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "CueHandler.hpp"
+
+/*** Structs ******************************************************************/
+//What the samples of one TRACK contained
+struct TrackCheckResult {
+	std::string PATH; //bin file the TRACK is in
+	unsigned int TRACK = 0; //TRACK ID
+	t_TRACK DECLARED = t_TRACK::UNKNOWN; //Type given in the .cue
+	t_TRACK DETECTED = t_TRACK::UNKNOWN; //Type the samples point to
+	
+	unsigned long long SAMPLES = 0; //Sectors sampled
+	unsigned long long NO_SYNC = 0; //Raw sectors without a sync pattern
+	unsigned long long MODE0 = 0; //Empty mode 0 sectors
+	unsigned long long MODE1 = 0;
+	unsigned long long MODE2 = 0;
+	unsigned long long FORM1 = 0; //Mode 2 XA Form 1 sectors
+	unsigned long long FORM2 = 0; //Mode 2 XA Form 2 sectors
+	unsigned long long BAD_SUBHEADER = 0; //XA subheader copies differ
+	unsigned long long UNREAD = 0; //Samples that could not be read
+	
+	bool CHECKED = false; //False for types that cannot be checked (2048, CDG)
+	bool UNREADABLE = false; //The bin file is missing, or samples were unread
+	bool MISMATCH = false; //DETECTED does not agree with DECLARED
+};
+
+/*** TrackChecker Class *******************************************************/
+class TrackChecker {
+	public:
+	TrackChecker() { }
+	
+	/** Configuration Functions ***********************************************/
+	//Number of worker threads. 0 uses the number of hardware threads
+	void setThreads(const unsigned int threads) { this->m_threads = threads; }
+	
+	//Sample every Nth sector of a TRACK. 1 checks every sector
+	void setStride(const unsigned long stride) {
+		this->m_stride = (stride == 0) ? 1 : stride;
+	}
+	
+	/** Checking **************************************************************/
+	//Add every TRACK of a CueHandler with its cue data loaded (getCueData).
+	//Many .cue files can be added and checked in one pass
+	void addCue(CueHandler &cue);
+	
+	//Sample every added TRACK. Returns one result per TRACK, in the order
+	//they were added
+	std::vector <TrackCheckResult> check();
+	
+	private:
+	unsigned int m_threads = 0;
+	unsigned long m_stride = 75;
+	
+	//A TRACK to check, with its byte range and sector size
+	struct TrackJob {
+		TrackCheckResult RESULT;
+		unsigned long long START;
+		unsigned long long END;
+		unsigned int SECTOR_SIZE;
+	};
+	std::vector <TrackJob> m_jobs;
+};
+
+#endif
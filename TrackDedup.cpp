@@ -0,0 +1,534 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file finds identical TRACKs across a library. See TrackDedup.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "TrackDedup.hpp"
+#include "CueHash.hpp"
+#include "CueHandler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+/*** Helper Functions *********************************************************/
+namespace {
+const char indexMagic[4] = {'C', 'U', 'E', 'D'};
+const uint32_t indexVersion = 2;
+
+void writeLE(std::ofstream &out, uint64_t val, const size_t bytes) {
+	uint8_t buf[8];
+	for(size_t cByte = 0; cByte < bytes; cByte++) {
+		buf[cByte] = (uint8_t)val;
+		val >>= 8;
+	}
+	out.write((const char *)buf, (std::streamsize)bytes);
+}
+
+uint64_t readLE(std::ifstream &in, const size_t bytes) {
+	uint8_t buf[8] = {0};
+	in.read((char *)buf, (std::streamsize)bytes);
+	
+	uint64_t val = 0;
+	for(size_t cByte = bytes; cByte > 0; cByte--) {
+		val = (val << 8) | buf[cByte - 1];
+	}
+	return val;
+}
+
+//Get the size, modify time and inode of a TRACK's bin file. Returns false if
+//it does not exist
+bool statFile(TrackHash &track) {
+	FingerprintKey key;
+	if(FingerprintCache::fileKey(track.PATH, key) == false) return false;
+	
+	track.FILESIZE = key.SIZE;
+	track.MTIME = (long long)key.MTIME;
+	track.DEVICE = key.DEVICE;
+	track.INODE = key.INODE;
+	return true;
+}
+
+//Returns true if both TRACKs were hashed from the same state of their file
+bool sameState(const TrackHash &a, const TrackHash &b) {
+	return a.FILESIZE == b.FILESIZE && a.MTIME == b.MTIME
+	    && a.DEVICE == b.DEVICE && a.INODE == b.INODE;
+}
+
+//Returns true if the bin file of a TRACK is still as it was when hashed
+bool unchanged(const TrackHash &track) {
+	TrackHash now;
+	now.PATH = track.PATH;
+	return statFile(now) && sameState(now, track);
+}
+
+//Compare two files byte for byte. Returns true if both read fully and match
+bool sameContents(const std::string pathA, const std::string pathB,
+                  unsigned long long bytes, const size_t bufferBytes) {
+	std::ifstream fileA(pathA, std::ios::in | std::ios::binary);
+	std::ifstream fileB(pathB, std::ios::in | std::ios::binary);
+	if(fileA.is_open() == false || fileB.is_open() == false) return false;
+	
+	std::vector <char> bufA(bufferBytes), bufB(bufferBytes);
+	while(bytes > 0) {
+		size_t chunk = bufferBytes;
+		if(bytes < chunk) chunk = (size_t)bytes;
+		
+		fileA.read(bufA.data(), (std::streamsize)chunk);
+		fileB.read(bufB.data(), (std::streamsize)chunk);
+		if((size_t)fileA.gcount() != chunk || (size_t)fileB.gcount() != chunk
+		   || memcmp(bufA.data(), bufB.data(), chunk) != 0) {
+			return false;
+		}
+		
+		bytes -= chunk;
+	}
+	
+	return true;
+}
+
+//Returns true if both paths are the same file (already linked)
+bool sameFile(const std::string pathA, const std::string pathB) {
+	struct stat infoA, infoB;
+	if(stat(pathA.c_str(), &infoA) != 0 || stat(pathB.c_str(), &infoB) != 0) {
+		return false;
+	}
+	
+	return infoA.st_dev == infoB.st_dev && infoA.st_ino == infoB.st_ino;
+}
+
+//Replace -dup- with a link to -keep-. The link is made under a temporary
+//name first and renamed over -dup-, so -dup- is never missing
+bool linkFile(const std::string keep, const std::string dup,
+              const t_LINK mode) {
+	#if defined(__unix__) || defined(__APPLE__)
+	std::string temp = dup + ".dedup-tmp";
+	
+	if(mode == t_LINK::HARDLINK) {
+		if(link(keep.c_str(), temp.c_str()) != 0) return false;
+	} else {
+		#ifdef FICLONE
+		int src = open(keep.c_str(), O_RDONLY);
+		if(src < 0) return false;
+		
+		int dst = open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if(dst < 0) {
+			close(src);
+			return false;
+		}
+		
+		int status = ioctl(dst, FICLONE, src);
+		close(src);
+		close(dst);
+		
+		if(status != 0) {
+			unlink(temp.c_str());
+			return false;
+		}
+		#else
+		//Reflinks are not available on this platform
+		return false;
+		#endif
+	}
+	
+	if(rename(temp.c_str(), dup.c_str()) != 0) {
+		unlink(temp.c_str());
+		return false;
+	}
+	
+	return true;
+	#else
+	//Linking is not supported on this platform
+	(void)keep; (void)dup; (void)mode;
+	return false;
+	#endif
+}
+} //namespace
+
+/*** TrackDedup Functions *****************************************************/
+std::string TrackDedup::trackKey(const TrackHash &track) {
+	return track.PATH + '\n' + std::to_string(track.START) + '\n'
+	     + std::to_string(track.END);
+}
+
+void TrackDedup::addCue(CueHandler &cue) {
+	std::vector <TrackSpan> spans = cue.getTrackSpans();
+	
+	for(size_t cSpan = 0; cSpan < spans.size(); cSpan++) {
+		TrackHash track;
+		track.PATH = spans[cSpan].PATH;
+		track.TRACK = spans[cSpan].ID;
+		track.TYPE = spans[cSpan].TYPE;
+		track.START = spans[cSpan].START;
+		track.END = spans[cSpan].END;
+		statFile(track);
+		
+		std::string key = trackKey(track);
+		auto found = m_lookup.find(key);
+		
+		//A new TRACK
+		if(found == m_lookup.end()) {
+			m_lookup[key] = m_tracks.size();
+			m_tracks.push_back(track);
+			continue;
+		}
+		
+		//A TRACK that is already known. Keep its hashes only if the bin file
+		//has not changed since it was hashed
+		TrackHash &known = m_tracks[found->second];
+		if(sameState(known, track) == false) {
+			known = track;
+		} else {
+			known.TRACK = track.TRACK;
+			known.TYPE = track.TYPE;
+		}
+	}
+}
+
+int TrackDedup::hashTracks() {
+	//Jobs are all the TRACKs not hashed yet, largest first to balance threads
+	std::vector <size_t> jobs;
+	for(size_t cTrack = 0; cTrack < m_tracks.size(); cTrack++) {
+		if(m_tracks[cTrack].HASHED == false) jobs.push_back(cTrack);
+	}
+	
+	std::sort(jobs.begin(), jobs.end(), [&](size_t a, size_t b) {
+		return (m_tracks[a].END - m_tracks[a].START)
+		     > (m_tracks[b].END - m_tracks[b].START);
+	});
+	
+	unsigned int threadCount = m_threads;
+	if(threadCount == 0) threadCount = std::thread::hardware_concurrency();
+	if(threadCount == 0) threadCount = 1;
+	if(threadCount > jobs.size()) threadCount = (unsigned int)jobs.size();
+	
+	std::atomic <size_t> nextJob(0);
+	std::atomic <bool> failed(false);
+	
+	//Each worker reads a TRACK's byte range once, feeding both hashes
+	auto worker = [&]() {
+		std::vector <uint8_t> buffer(m_bufferBytes);
+		XXH64Hasher fast;
+		SHA1Hasher strong;
+		
+		size_t job;
+		while((job = nextJob.fetch_add(1)) < jobs.size()) {
+			TrackHash &track = m_tracks[jobs[job]];
+			
+			//The state is taken before reading, so a file changed while it is
+			//read gets a new state (and cache key) next time
+			FingerprintKey key;
+			if(FingerprintCache::fileKey(track.PATH, key) == false) {
+				failed = true;
+				continue;
+			}
+			track.FILESIZE = key.SIZE;
+			track.MTIME = (long long)key.MTIME;
+			track.DEVICE = key.DEVICE;
+			track.INODE = key.INODE;
+			key.START = track.START;
+			key.END = track.END;
+			
+			//A cached fingerprint of the same file, unchanged, needs no read
+			Fingerprint print;
+			bool keyed = (m_cache != nullptr);
+			if(keyed) {
+				if(m_cache->lookup(key, print)) {
+					track.FAST = print.FAST;
+					memcpy(track.SHA1, print.SHA1, sizeof(track.SHA1));
+					track.HASHED = true;
+					continue;
+				}
+			}
+			
+			std::ifstream binFile(track.PATH, std::ios::in | std::ios::binary);
+			if(binFile.is_open() == false) {
+				failed = true;
+				continue;
+			}
+			binFile.seekg((std::streamoff)track.START);
+			
+			fast.reset();
+			strong.reset();
+			
+			unsigned long long left = track.END - track.START;
+			while(left > 0) {
+				size_t chunk = buffer.size();
+				if(left < chunk) chunk = (size_t)left;
+				
+				binFile.read((char *)buffer.data(), (std::streamsize)chunk);
+				if((size_t)binFile.gcount() != chunk) break;
+				
+				fast.update(buffer.data(), chunk);
+				strong.update(buffer.data(), chunk);
+				left -= chunk;
+			}
+			
+			if(left != 0) {
+				failed = true;
+				continue;
+			}
+			
+			track.FAST = fast.digest();
+			strong.digest(track.SHA1);
+			track.HASHED = true;
+			
+			if(keyed && m_cache->writer()) {
+				print.FAST = track.FAST;
+				memcpy(print.SHA1, track.SHA1, sizeof(print.SHA1));
+				m_cache->insert(key, print);
+			}
+		}
+	};
+	
+	std::vector <std::thread> threads;
+	for(unsigned int cThread = 0; cThread < threadCount; cThread++) {
+		threads.push_back(std::thread(worker));
+	}
+	for(size_t cThread = 0; cThread < threads.size(); cThread++) {
+		threads[cThread].join();
+	}
+	
+	if(failed) {
+		std::cerr << "Error: TrackDedup: Some bin files could not be read."
+		          << std::endl;
+		return 1;
+	}
+	
+	return 0;
+}
+
+std::vector <DuplicateGroup> TrackDedup::findDuplicates() {
+	//Sort hashed, non-empty TRACKs so equal size and XXH64 are adjacent
+	std::vector <size_t> order;
+	for(size_t cTrack = 0; cTrack < m_tracks.size(); cTrack++) {
+		const TrackHash &track = m_tracks[cTrack];
+		if(track.HASHED && track.END > track.START) order.push_back(cTrack);
+	}
+	
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		const TrackHash &ta = m_tracks[a], &tb = m_tracks[b];
+		unsigned long long sizeA = ta.END - ta.START, sizeB = tb.END - tb.START;
+		if(sizeA != sizeB) return sizeA < sizeB;
+		if(ta.FAST != tb.FAST) return ta.FAST < tb.FAST;
+		return memcmp(ta.SHA1, tb.SHA1, 20) < 0;
+	});
+	
+	//Runs with the same size, XXH64 and SHA-1 are duplicates. Sorting by the
+	//SHA-1 last splits any XXH64 collision into separate runs
+	std::vector <DuplicateGroup> groups;
+	size_t runStart = 0;
+	for(size_t cOrder = 1; cOrder <= order.size(); cOrder++) {
+		bool same = false;
+		if(cOrder < order.size()) {
+			const TrackHash &prev = m_tracks[order[cOrder - 1]];
+			const TrackHash &curr = m_tracks[order[cOrder]];
+			
+			same = (prev.END - prev.START) == (curr.END - curr.START)
+			    && prev.FAST == curr.FAST
+			    && memcmp(prev.SHA1, curr.SHA1, 20) == 0;
+		}
+		if(same) continue;
+		
+		if(cOrder - runStart > 1) {
+			DuplicateGroup group;
+			group.TRACKS.assign(order.begin() + runStart,
+			                    order.begin() + cOrder);
+			groups.push_back(group);
+		}
+		runStart = cOrder;
+	}
+	
+	return groups;
+}
+
+size_t TrackDedup::linkDuplicates(const std::vector <DuplicateGroup> &groups,
+                                  const t_LINK mode) {
+	size_t linked = 0;
+	
+	for(size_t cGroup = 0; cGroup < groups.size(); cGroup++) {
+		const std::vector <size_t> &group = groups[cGroup].TRACKS;
+		const TrackHash &keep = m_tracks[group[0]];
+		
+		//The kept TRACK must be its whole bin file to be linked to
+		if(keep.START != 0 || keep.END != keep.FILESIZE) continue;
+		
+		for(size_t cTrack = 1; cTrack < group.size(); cTrack++) {
+			TrackHash &dup = m_tracks[group[cTrack]];
+			if(dup.START != 0 || dup.END != dup.FILESIZE) continue;
+			if(dup.PATH == keep.PATH || sameFile(keep.PATH, dup.PATH)) continue;
+			
+			//Linking destroys the duplicate's data. Make sure neither file
+			//has changed since it was hashed, and that they really match
+			if(unchanged(keep) == false || unchanged(dup) == false
+			   || sameContents(keep.PATH, dup.PATH, keep.FILESIZE,
+			                   m_bufferBytes) == false) {
+				std::cerr << "Error: TrackDedup: " << dup.PATH
+				          << " changed since it was hashed, not linked."
+				          << std::endl;
+				continue;
+			}
+			
+			if(linkFile(keep.PATH, dup.PATH, mode) == false) {
+				std::cerr << "Error: TrackDedup: Could not link " << dup.PATH
+				          << '.' << std::endl;
+				continue;
+			}
+			
+			//The new link has a new modify time, keep the index up to date
+			statFile(dup);
+			++linked;
+		}
+	}
+	
+	return linked;
+}
+
+/*** Persistent Index *********************************************************/
+/*	Index file, all values little endian
+	"CUED" magic, u32 version, u64 number of entries, then per entry:
+	u32 path length, path, u32 TRACK, u8 TYPE, u64 START, u64 END,
+	u64 FILESIZE, i64 MTIME (nanoseconds), u64 DEVICE, u64 INODE, u64 FAST,
+	SHA1[20]                                                                  */
+int TrackDedup::loadIndex(const std::string path) {
+	std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+	if(in.is_open() == false) return 0;
+	
+	//Lengths in the file are checked against its size before allocating
+	unsigned long long fileBytes = (unsigned long long)in.tellg();
+	in.seekg(0);
+	
+	char magic[4];
+	in.read(magic, 4);
+	if(memcmp(magic, indexMagic, 4) != 0 || readLE(in, 4) != indexVersion) {
+		std::cerr << "Error: TrackDedup: " << path << ": Not an index file."
+		          << std::endl;
+		return 1;
+	}
+	
+	//Bytes of an entry besides its path
+	const unsigned long long entryBytes = 4 + 4 + 1 + 8 * 7 + 20;
+	
+	uint64_t entries = readLE(in, 8);
+	unsigned long long left = fileBytes - 16;
+	if(in.good() == false || entries > left / entryBytes) {
+		std::cerr << "Error: TrackDedup: " << path << ": Index is corrupt."
+		          << std::endl;
+		return 1;
+	}
+	
+	for(uint64_t cEntry = 0; cEntry < entries && in.good(); cEntry++) {
+		TrackHash track;
+		
+		uint32_t pathLen = (uint32_t)readLE(in, 4);
+		left = fileBytes - (unsigned long long)in.tellg();
+		if(in.good() == false || pathLen + (entryBytes - 4) > left) {
+			std::cerr << "Error: TrackDedup: " << path << ": Index is corrupt."
+			          << std::endl;
+			return 1;
+		}
+		track.PATH.resize(pathLen);
+		in.read(&track.PATH[0], pathLen);
+		
+		track.TRACK = (unsigned int)readLE(in, 4);
+		track.TYPE = (t_TRACK)readLE(in, 1);
+		track.START = readLE(in, 8);
+		track.END = readLE(in, 8);
+		track.FILESIZE = readLE(in, 8);
+		track.MTIME = (long long)readLE(in, 8);
+		track.DEVICE = readLE(in, 8);
+		track.INODE = readLE(in, 8);
+		track.FAST = readLE(in, 8);
+		in.read((char *)track.SHA1, 20);
+		track.HASHED = true;
+		
+		if(in.good() == false) break;
+		
+		std::string key = trackKey(track);
+		auto found = m_lookup.find(key);
+		if(found == m_lookup.end()) {
+			m_lookup[key] = m_tracks.size();
+			m_tracks.push_back(track);
+		} else if(m_tracks[found->second].HASHED == false) {
+			m_tracks[found->second] = track;
+		}
+	}
+	
+	if(in.good() == false) {
+		std::cerr << "Error: TrackDedup: " << path << ": Index is truncated."
+		          << std::endl;
+		return 1;
+	}
+	
+	return 0;
+}
+
+int TrackDedup::saveIndex(const std::string path) {
+	//Write to a temporary file and rename, so a crash never loses the index
+	std::string temp = path + ".tmp";
+	std::ofstream out(temp, std::ios::out | std::ios::trunc | std::ios::binary);
+	if(out.is_open() == false) {
+		std::cerr << "Error: TrackDedup: Could not create " << temp << '.'
+		          << std::endl;
+		return 1;
+	}
+	
+	uint64_t entries = 0;
+	for(size_t cTrack = 0; cTrack < m_tracks.size(); cTrack++) {
+		if(m_tracks[cTrack].HASHED) ++entries;
+	}
+	
+	out.write(indexMagic, 4);
+	writeLE(out, indexVersion, 4);
+	writeLE(out, entries, 8);
+	
+	for(size_t cTrack = 0; cTrack < m_tracks.size(); cTrack++) {
+		const TrackHash &track = m_tracks[cTrack];
+		if(track.HASHED == false) continue;
+		
+		writeLE(out, track.PATH.size(), 4);
+		out.write(track.PATH.data(), (std::streamsize)track.PATH.size());
+		writeLE(out, track.TRACK, 4);
+		writeLE(out, (uint64_t)track.TYPE, 1);
+		writeLE(out, track.START, 8);
+		writeLE(out, track.END, 8);
+		writeLE(out, track.FILESIZE, 8);
+		writeLE(out, (uint64_t)track.MTIME, 8);
+		writeLE(out, track.DEVICE, 8);
+		writeLE(out, track.INODE, 8);
+		writeLE(out, track.FAST, 8);
+		out.write((const char *)track.SHA1, 20);
+	}
+	
+	out.close();
+	if(out.fail() || std::rename(temp.c_str(), path.c_str()) != 0) {
+		std::cerr << "Error: TrackDedup: Failed writing " << path << '.'
+		          << std::endl;
+		return 1;
+	}
+	
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file finds identical TRACKs across a library of .cue files. Each TRACK's
+* byte range is read once, and hashed with XXH64 (to find candidates) and SHA-1
+* (to confirm them) in the same pass, across multiple threads. The hashes are
+* kept in a persistent index file so unchanged bin files are not read again,
+* and duplicate bin files can be replaced with hardlinks or reflinks.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef TRACK_DEDUP_H
+#define TRACK_DEDUP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CueHandler.hpp"
+#include "FingerprintCache.hpp"
+
+/*** Enums and structs ********************************************************/
+//How linkDuplicates() replaces a duplicate file
+enum class t_LINK {
+	HARDLINK, //Hardlink to the kept file. Both names share one inode
+	REFLINK //Copy-on-write clone of the kept file's data (Linux, btrfs/xfs)
+};
+
+//One TRACK and its hashes
+struct TrackHash {
+	std::string PATH; //bin file the TRACK is in
+	unsigned int TRACK = 0; //TRACK ID
+	t_TRACK TYPE = t_TRACK::UNKNOWN;
+	unsigned long long START = 0; //Byte range of the TRACK in the bin file
+	unsigned long long END = 0;
+	//State of the bin file when it was hashed, to detect changes
+	unsigned long long FILESIZE = 0;
+	long long MTIME = 0; //Nanoseconds (seconds on some systems)
+	uint64_t DEVICE = 0; //st_dev
+	uint64_t INODE = 0; //st_ino
+	uint64_t FAST = 0; //XXH64 of the byte range
+	uint8_t SHA1[20] = {0}; //SHA-1 of the byte range
+	bool HASHED = false; //Hashes are valid
+};
+
+//TRACKs with identical contents. Values are indexes into tracks()
+struct DuplicateGroup {
+	std::vector <size_t> TRACKS; //The first TRACK is the one to keep
+};
+
+/*** TrackDedup Class *********************************************************/
+class TrackDedup {
+	public:
+	TrackDedup() { }
+	
+	/** Configuration Functions ***********************************************/
+	//Number of worker threads. 0 uses the number of hardware threads
+	void setThreads(const unsigned int threads) { this->m_threads = threads; }
+	
+	//Bytes read from disk at once, per thread
+	void setBufferBytes(const size_t bytes) { this->m_bufferBytes = bytes; }
+	
+	//Look TRACKs up in a FingerprintCache before reading them, by the bin
+	//file's inode and modify time. If the cache was opened as the writer,
+	//new hashes are added to it (call its flush() to keep them)
+	void setFingerprintCache(FingerprintCache *cache) {
+		this->m_cache = cache;
+	}
+	
+	/** Library Functions *****************************************************/
+	//Add every TRACK of a CueHandler with its cue data loaded (getCueData).
+	//TRACKs already in the index with an unchanged bin file keep their hashes
+	void addCue(CueHandler &cue);
+	
+	//Hash every TRACK that has not been hashed yet. Returns 0 on success,
+	//1 if any bin file could not be read (those TRACKs stay unhashed)
+	int hashTracks();
+	
+	//Group TRACKs with the same size, XXH64 and SHA-1. Empty TRACKs are ignored
+	std::vector <DuplicateGroup> findDuplicates();
+	
+	//Replace every duplicate bin file with a link to the first file in its
+	//group. Only TRACKs that make up a whole bin file on both sides can be
+	//linked. Both files are checked against their hashed state and compared
+	//byte for byte right before linking, and skipped if they differ. Returns
+	//the number of files replaced
+	size_t linkDuplicates(const std::vector <DuplicateGroup> &groups,
+	                      const t_LINK mode);
+	
+	//All the TRACKs added or loaded so far
+	const std::vector <TrackHash> &tracks() const { return m_tracks; }
+	
+	/** Persistent Index ******************************************************/
+	//Load a saved index. Entries are matched to TRACKs by addCue(). Returns 0
+	//on success (or if the file does not exist yet), 1 if it is corrupt
+	int loadIndex(const std::string path);
+	
+	//Save every hashed TRACK to an index file. Returns 0 on success
+	int saveIndex(const std::string path);
+	
+	private:
+	unsigned int m_threads = 0;
+	size_t m_bufferBytes = 4 * 1024 * 1024;
+	FingerprintCache *m_cache = nullptr;
+	
+	std::vector <TrackHash> m_tracks;
+	
+	//Position in m_tracks of each PATH + byte range
+	std::unordered_map <std::string, size_t> m_lookup;
+	
+	//Key for m_lookup
+	static std::string trackKey(const TrackHash &);
+};
+
+#endif
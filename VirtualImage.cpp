@@ -0,0 +1,220 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* Read-only single image view of a multi bin .cue. See VirtualImage.hpp
+*
+* (c) ADBeta
+*******************************************************************************/
+#include "VirtualImage.hpp"
+#include "CueHandler.hpp"
+#include "CueTOC.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/*** Image Functions **********************************************************/
+int VirtualImage::open(CueHandler &cue, StatCache *cache) {
+	close();
+	
+	StatCache localCache;
+	if(cache == nullptr) cache = &localCache;
+	
+	//Bin files are relative to the directory of the .cue file
+	std::string binDir = cue.cueFile->parentDir();
+	int missing = 0;
+	
+	for(const FileData &pFILE : cue.FILE) {
+		Part part;
+		part.PATH = binDir + pFILE.FILENAME;
+		part.START = m_size;
+		part.SIZE = 0;
+		part.FD = -1;
+		part.USERS = 0;
+		part.LAST_USE = 0;
+		
+		if(cache->fileSize(part.PATH, part.SIZE) == false) {
+			std::cerr << "Error: VirtualImage: Could not stat " << part.PATH
+			          << ".\n";
+			missing = 1;
+		}
+		
+		//Empty files take up no range, and can never be read
+		m_size += part.SIZE;
+		m_parts.push_back(part);
+		m_starts.push_back(part.START);
+	}
+	
+	return missing;
+}
+
+void VirtualImage::close() {
+	std::lock_guard <std::mutex> lock(m_mutex);
+	
+	for(Part &part : m_parts) {
+		if(part.FD >= 0) ::close(part.FD);
+	}
+	
+	m_parts.clear();
+	m_starts.clear();
+	m_size = 0;
+	m_openCount = 0;
+	m_lastEnd = 0;
+}
+
+long long VirtualImage::read(const unsigned long long offset, void *buf,
+                             size_t len) {
+	if(offset >= m_size) return 0;
+	if(len > m_size - offset) len = (size_t)(m_size - offset);
+	
+	//Reads that carry on from the last one are sequential, so have the next
+	//stretch read ahead while this one is copied
+	bool sequential = false;
+	{
+		std::lock_guard <std::mutex> lock(m_mutex);
+		sequential = (offset == m_lastEnd);
+		m_lastEnd = offset + len;
+	}
+	if(sequential && m_readahead != 0) willNeed(offset + len, m_readahead);
+	
+	uint8_t *out = (uint8_t *)buf;
+	unsigned long long pos = offset;
+	size_t left = len;
+	size_t partIdx = findPart(pos);
+	
+	//Each part is read with pread, moving to the next file at its end
+	while(left > 0 && partIdx < m_parts.size()) {
+		const Part &part = m_parts[partIdx];
+		unsigned long long local = pos - part.START;
+		
+		if(local >= part.SIZE) {
+			++partIdx;
+			continue;
+		}
+		
+		size_t chunk = left;
+		if(chunk > part.SIZE - local) chunk = (size_t)(part.SIZE - local);
+		
+		int fd = acquire(partIdx);
+		if(fd < 0) return -1;
+		
+		size_t done = 0;
+		while(done < chunk) {
+			ssize_t got = pread(fd, out + done, chunk - done,
+			                    (off_t)(local + done));
+			if(got < 0 && errno == EINTR) continue;
+			if(got <= 0) break;
+			done += (size_t)got;
+		}
+		release(partIdx);
+		
+		//A file shorter than when it was stat'd is an error
+		if(done != chunk) return -1;
+		
+		out += chunk;
+		pos += chunk;
+		left -= chunk;
+		++partIdx;
+	}
+	
+	return (long long)(len - left);
+}
+
+void VirtualImage::willNeed(const unsigned long long offset, const size_t len) {
+	if(offset >= m_size) return;
+	
+	unsigned long long pos = offset;
+	unsigned long long end = std::min(offset + len, m_size);
+	
+	for(size_t partIdx = findPart(pos);
+	    pos < end && partIdx < m_parts.size(); partIdx++) {
+		const Part &part = m_parts[partIdx];
+		unsigned long long partEnd = part.START + part.SIZE;
+		if(partEnd <= pos) continue;
+		
+		unsigned long long stop = std::min(end, partEnd);
+		adviseRange(partIdx, pos - part.START, stop - pos);
+		pos = stop;
+	}
+}
+
+/*** Private Functions ********************************************************/
+size_t VirtualImage::findPart(const unsigned long long offset) const {
+	//The last part starting at or before the offset. Empty parts share a
+	//START with the next one, so this always skips past them
+	auto next = std::upper_bound(m_starts.begin(), m_starts.end(), offset);
+	if(next == m_starts.begin()) return 0;
+	
+	return (size_t)(next - m_starts.begin()) - 1;
+}
+
+int VirtualImage::acquire(const size_t partIdx) {
+	std::lock_guard <std::mutex> lock(m_mutex);
+	Part &part = m_parts[partIdx];
+	
+	if(part.FD < 0) {
+		//Make room by closing the least recently used idle file
+		if(m_openCount >= m_maxOpen) {
+			Part *oldest = nullptr;
+			for(Part &other : m_parts) {
+				if(other.FD < 0 || other.USERS != 0) continue;
+				if(oldest == nullptr || other.LAST_USE < oldest->LAST_USE) {
+					oldest = &other;
+				}
+			}
+			
+			if(oldest != nullptr) {
+				::close(oldest->FD);
+				oldest->FD = -1;
+				--m_openCount;
+			}
+		}
+		
+		part.FD = ::open(part.PATH.c_str(), O_RDONLY);
+		if(part.FD < 0) {
+			std::cerr << "Error: VirtualImage: Could not open " << part.PATH
+			          << ".\n";
+			return -1;
+		}
+		++m_openCount;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+		//Bin files are mostly read start to end
+		posix_fadvise(part.FD, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	}
+	
+	++part.USERS;
+	part.LAST_USE = ++m_clock;
+	return part.FD;
+}
+
+void VirtualImage::release(const size_t partIdx) {
+	std::lock_guard <std::mutex> lock(m_mutex);
+	--m_parts[partIdx].USERS;
+}
+
+void VirtualImage::adviseRange(const size_t partIdx, unsigned long long offset,
+                               unsigned long long len) {
+#ifdef POSIX_FADV_WILLNEED
+	int fd = acquire(partIdx);
+	if(fd < 0) return;
+	
+	posix_fadvise(fd, (off_t)offset, (off_t)len, POSIX_FADV_WILLNEED);
+	release(partIdx);
+#else
+	(void)partIdx;
+	(void)offset;
+	(void)len;
+#endif
+}
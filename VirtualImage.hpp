@@ -0,0 +1,100 @@
+/*******************************************************************************
+* This file is part of psXtract.
+*
+* psXtract is a program to extract filesystem files/folders and CDDA audio from
+* PSX/PS1 games.
+*
+* This file presents every bin file in a .cue as one read-only image, as if
+* they had been merged, without writing anything. Reads are served with
+* pread() across file boundaries, a few file descriptors are kept open and
+* the kernel is told what will be read next (posix_fadvise).
+*
+* Byte offsets match a merged bin (FILE order), and so the LBAs of a CueTOC.
+*
+* (c) ADBeta
+*******************************************************************************/
+
+#ifndef VIRTUAL_IMAGE_H
+#define VIRTUAL_IMAGE_H
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "CueHandler.hpp"
+#include "CueTOC.hpp"
+
+/*** VirtualImage Class *******************************************************/
+class VirtualImage {
+	public:
+	VirtualImage() { }
+	
+	//Closes every open file
+	~VirtualImage() { close(); }
+	
+	/** Configuration Functions ***********************************************/
+	//Most bin files kept open at once. The least recently used is closed
+	void setMaxOpenFiles(const size_t files) { this->m_maxOpen = files; }
+	
+	//Bytes to ask the kernel to read ahead when reads are sequential. 0 off
+	void setReadahead(const size_t bytes) { this->m_readahead = bytes; }
+	
+	/** Image Functions *******************************************************/
+	//Map every FILE of a CueHandler with its cue data loaded (getCueData).
+	//Sizes come from -cache-, or are stat'd if none is passed. Returns 0 on
+	//success, 1 if a bin file is missing
+	int open(CueHandler &cue, StatCache *cache = nullptr);
+	
+	//Close every file and forget the mapping
+	void close();
+	
+	//Total bytes in the image
+	unsigned long long size() const { return m_size; }
+	
+	//Read up to -len- bytes at -offset- into -buf-, across file boundaries.
+	//Returns the bytes read (short only at the end of the image), or -1 if a
+	//file could not be read. Safe to call from many threads at once
+	long long read(const unsigned long long offset, void *buf, size_t len);
+	
+	//Tell the kernel a range will be read soon
+	void willNeed(const unsigned long long offset, const size_t len);
+	
+	private:
+	//One bin file in the image
+	struct Part {
+		std::string PATH;
+		unsigned long long START; //Offset of the file in the image
+		unsigned long long SIZE;
+		int FD; //-1 when closed
+		unsigned int USERS; //Reads in progress. Never closed while > 0
+		unsigned long long LAST_USE; //For least recently used eviction
+	};
+	
+	std::vector <Part> m_parts;
+	std::vector <unsigned long long> m_starts; //START of every part, packed
+	unsigned long long m_size = 0;
+	
+	size_t m_maxOpen = 8;
+	size_t m_readahead = 1024 * 1024;
+	
+	//Guards the fd cache and the sequential read tracking
+	std::mutex m_mutex;
+	size_t m_openCount = 0;
+	unsigned long long m_clock = 0;
+	unsigned long long m_lastEnd = 0;
+	
+	//Index of the part holding an image offset
+	size_t findPart(const unsigned long long offset) const;
+	
+	//Get an open fd for a part (opening it, and closing another if needed),
+	//and release it when done. acquire returns -1 if it cannot be opened
+	int acquire(const size_t part);
+	void release(const size_t part);
+	
+	//Hint a range of a single part
+	void adviseRange(const size_t part, unsigned long long offset,
+	                 unsigned long long len);
+};
+
+#endif